@@ -0,0 +1,369 @@
+// Runtime benchmark for programs produced by flit.
+// Every kernel in bench/kernels is built with each optimization configuration, run several times and measured with
+// hardware counters from perf_event_open (cycles, instructions, branch misses) and the number of syscalls.
+// When a counter isn't available (no permission, virtual machine, ...) it is reported as missing and only the wall
+// clock time is used. The output of every configuration is compared against the first one so that a broken optimizer
+// shows up as a mismatch instead of a speedup.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace fs = std::filesystem;
+
+struct Config {
+    std::string name;
+    std::vector<std::string> flags;
+};
+
+// optimization configurations every kernel is built with, the first one is the reference for output checks
+const std::vector<Config> configs = {
+        {"O0", {"-O0"}},
+        {"O1", {"-O1"}},
+        {"O2", {"-O2"}},
+};
+
+enum Counter {
+    cycles,
+    instructions,
+    branch_misses,
+    syscalls,
+    counter_count
+};
+
+const char *counter_names[counter_count] = {"cycles", "instructions", "branch_misses", "syscalls"};
+
+struct Sample {
+    double wall_ms;
+    std::optional<uint64_t> counters[counter_count];
+};
+
+struct Result {
+    std::string kernel;
+    std::string config;
+    bool built = false;
+    bool output_matches = true;
+    int exit_code = 0;
+    std::vector<Sample> samples;
+};
+
+long perf_event_open(perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+// id of the raw_syscalls:sys_enter tracepoint, counting it gives the number of syscalls made by the process
+std::optional<uint64_t> syscall_tracepoint_id() {
+    for (const char *path: {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                            "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"}) {
+        std::ifstream file(path);
+        uint64_t id;
+        if (file >> id) {
+            return id;
+        }
+    }
+    return {};
+}
+
+// opens a counter for the given process which starts counting when the process calls exec
+int open_counter(Counter counter, pid_t pid) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_hv = 1;
+    switch (counter) {
+        case cycles:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            attr.exclude_kernel = 1;
+            break;
+        case instructions:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            attr.exclude_kernel = 1;
+            break;
+        case branch_misses:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            attr.exclude_kernel = 1;
+            break;
+        case syscalls: {
+            static const std::optional<uint64_t> id = syscall_tracepoint_id();
+            if (!id.has_value()) {
+                return -1;
+            }
+            attr.type = PERF_TYPE_TRACEPOINT;
+            attr.config = id.value();
+            break;
+        }
+        default:
+            return -1;
+    }
+    return static_cast<int>(perf_event_open(&attr, pid, -1, -1, 0));
+}
+
+// builds the kernel with flit, returns whether flit succeeded and wrote the executable
+bool build(const std::string &flit, const Config &config, const fs::path &kernel, const fs::path &exe) {
+    std::vector<std::string> args = {flit, "--no-run", "-o", exe.string()};
+    args.insert(args.end(), config.flags.begin(), config.flags.end());
+    args.push_back(kernel.string());
+    std::vector<char *> argv;
+    for (std::string &arg: args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    const int error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+        std::cerr << "Failed to run " << flit << ": " << strerror(error) << std::endl;
+        return false;
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid) {
+        return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 && fs::exists(exe);
+}
+
+// runs the executable once with its output captured in memory, returns the sample, the output and the exit code
+std::optional<Sample> run_once(const fs::path &exe, std::string &output, int &exit_code) {
+    int out_fd = memfd_create("flit-bench-output", 0);
+    int go[2];
+    if (out_fd < 0) {
+        return {};
+    }
+    if (pipe(go) != 0) {
+        close(out_fd);
+        return {};
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(out_fd);
+        close(go[0]);
+        close(go[1]);
+        return {};
+    }
+    if (pid == 0) {
+        // wait until the parent attached the counters, they start counting at exec
+        char c;
+        close(go[1]);
+        if (read(go[0], &c, 1) != 1) {
+            _exit(127);
+        }
+        dup2(out_fd, STDOUT_FILENO);
+        execl(exe.c_str(), exe.c_str(), nullptr);
+        _exit(127);
+    }
+    close(go[0]);
+
+    int fds[counter_count];
+    for (int counter = 0; counter < counter_count; counter++) {
+        fds[counter] = open_counter(static_cast<Counter>(counter), pid);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    write(go[1], "g", 1);
+    close(go[1]);
+    int status;
+    waitpid(pid, &status, 0);
+    const auto end = std::chrono::steady_clock::now();
+
+    Sample sample{};
+    sample.wall_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    for (int counter = 0; counter < counter_count; counter++) {
+        uint64_t value;
+        if (fds[counter] >= 0 && read(fds[counter], &value, sizeof(value)) == sizeof(value)) {
+            sample.counters[counter] = value;
+        }
+        if (fds[counter] >= 0) {
+            close(fds[counter]);
+        }
+    }
+
+    output.resize(lseek(out_fd, 0, SEEK_END));
+    pread(out_fd, output.data(), output.size(), 0);
+    close(out_fd);
+    exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return sample;
+}
+
+// median is less sensitive to a single noisy run than the mean
+template<typename T>
+T median(std::vector<T> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+std::optional<uint64_t> median_counter(const Result &result, int counter) {
+    std::vector<uint64_t> values;
+    for (const Sample &sample: result.samples) {
+        if (!sample.counters[counter].has_value()) {
+            return {};
+        }
+        values.push_back(sample.counters[counter].value());
+    }
+    if (values.empty()) {
+        return {};
+    }
+    return median(values);
+}
+
+double median_wall(const Result &result) {
+    std::vector<double> values;
+    for (const Sample &sample: result.samples) {
+        values.push_back(sample.wall_ms);
+    }
+    return values.empty() ? 0 : median(values);
+}
+
+void print_table(const std::vector<Result> &results) {
+    std::cout << std::left << std::setw(24) << "kernel" << std::setw(16) << "config" << std::right
+              << std::setw(12) << "wall ms";
+    for (const char *name: counter_names) {
+        std::cout << std::setw(16) << name;
+    }
+    std::cout << std::setw(10) << "speedup" << "  output" << std::endl;
+
+    double reference_wall = 0;
+    for (const Result &result: results) {
+        std::cout << std::left << std::setw(24) << result.kernel << std::setw(16) << result.config << std::right;
+        if (!result.built) {
+            std::cout << "  build failed" << std::endl;
+            continue;
+        }
+        const double wall = median_wall(result);
+        if (result.config == configs.front().name) {
+            reference_wall = wall;
+        }
+        std::cout << std::setw(12) << std::fixed << std::setprecision(2) << wall;
+        for (int counter = 0; counter < counter_count; counter++) {
+            auto value = median_counter(result, counter);
+            std::cout << std::setw(16) << (value.has_value() ? std::to_string(value.value()) : "n/a");
+        }
+        std::cout << std::setw(9) << std::setprecision(2) << (wall > 0 ? reference_wall / wall : 0) << "x"
+                  << (result.output_matches ? "  ok" : "  MISMATCH") << std::endl;
+    }
+}
+
+void write_json(const std::vector<Result> &results, std::ostream &out) {
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        out << "  {\"kernel\": \"" << result.kernel << "\", \"config\": \"" << result.config << "\", \"built\": "
+            << (result.built ? "true" : "false") << ", \"output_matches\": " << (result.output_matches ? "true" : "false")
+            << ", \"exit_code\": " << result.exit_code << ", \"runs\": " << result.samples.size()
+            << ", \"wall_ms\": " << median_wall(result);
+        for (int counter = 0; counter < counter_count; counter++) {
+            auto value = median_counter(result, counter);
+            out << ", \"" << counter_names[counter] << "\": " << (value.has_value() ? std::to_string(value.value()) : "null");
+        }
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+int main(int argc, char *argv[]) {
+    std::string flit = FLIT_BINARY;
+    fs::path kernels_dir = FLIT_BENCH_KERNELS;
+    std::optional<std::string> json_path;
+    int runs = 5;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc) {
+            runs = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (arg == "--flit" && i + 1 < argc) {
+            flit = argv[++i];
+        } else if (arg == "--kernels" && i + 1 < argc) {
+            kernels_dir = argv[++i];
+        } else {
+            std::cerr << "Usage: flit_runtime_bench [--runs <n>] [--json <file>] [--flit <compiler>] [--kernels <dir>]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<fs::path> kernels;
+    for (const auto &entry: fs::directory_iterator(kernels_dir)) {
+        if (entry.path().extension() == ".flt") {
+            kernels.push_back(fs::absolute(entry.path()));
+        }
+    }
+    std::sort(kernels.begin(), kernels.end());
+
+    const fs::path work_dir = fs::temp_directory_path() / ("flit-bench-" + std::to_string(getpid()));
+    fs::create_directories(work_dir);
+
+    std::vector<Result> results;
+    for (const fs::path &kernel: kernels) {
+        std::string reference_output;
+        int reference_exit_code = 0;
+
+        for (const Config &config: configs) {
+            Result result{};
+            result.kernel = kernel.stem().string();
+            result.config = config.name;
+            const fs::path exe = work_dir / (result.kernel + "-" + config.name);
+            result.built = build(flit, config, kernel, exe);
+
+            for (int run = 0; result.built && run < runs; run++) {
+                std::string output;
+                auto sample = run_once(exe, output, result.exit_code);
+                if (!sample.has_value()) {
+                    break;
+                }
+                result.samples.push_back(sample.value());
+
+                if (&config == &configs.front() && run == 0) {
+                    reference_output = output;
+                    reference_exit_code = result.exit_code;
+                } else if (output != reference_output || result.exit_code != reference_exit_code) {
+                    result.output_matches = false;
+                }
+            }
+            std::cerr << "[bench] " << result.kernel << " " << config.name << (result.built ? "" : " (build failed)") << std::endl;
+            results.push_back(std::move(result));
+        }
+    }
+    fs::remove_all(work_dir);
+
+    print_table(results);
+    if (json_path.has_value()) {
+        std::ofstream json(json_path.value());
+        write_json(results, json);
+    } else {
+        write_json(results, std::cout);
+    }
+
+    const bool ok = std::ranges::all_of(results, [](const Result &result) {
+        return result.built && result.output_matches;
+    });
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
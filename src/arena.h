@@ -1,22 +1,57 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <vector>
+
 class ArenaAllocator {
 private:
     size_t m_size;
     std::byte *m_buffer; // whole memory block
     std::byte *m_offset; // pointer to the location at memory block
+    std::byte *m_end; // end of the current memory block
+    std::vector<std::byte *> m_blocks; // every block this arena owns, the last one is m_buffer
+
+    struct Destructor {
+        void (*destroy)(void *);
+        void *object;
+    };
+    std::vector<Destructor> m_destructors; // nodes that own memory outside the arena (vectors, strings), in order
+
+    // when the current block is full we chain a new block instead of writing past the end of it
+    void grow(size_t bytes) {
+        const size_t block_size = bytes > m_size ? bytes : m_size;
+        m_buffer = static_cast<std::byte *>(malloc(block_size));
+        m_offset = m_buffer;
+        m_end = m_buffer + block_size;
+        m_blocks.push_back(m_buffer);
+    }
 
 public:
     explicit ArenaAllocator(size_t bytes) : m_size(bytes) {
-        m_buffer = static_cast<std::byte *>(malloc(m_size));
-        m_offset = m_buffer;
+        grow(m_size);
     }
 
     template<typename T>
     T *alloc() {
-        void *offset = m_offset;
-        m_offset += sizeof(T); // increase the offset to the next free location
-        return static_cast<T *> (offset);
+        // round the offset up so that every node is correctly aligned
+        size_t used = m_offset - m_buffer;
+        used = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+        if (m_buffer + used + sizeof(T) > m_end) {
+            grow(sizeof(T));
+            used = 0;
+        }
+        void *offset = m_buffer + used;
+        m_offset = m_buffer + used + sizeof(T); // increase the offset to the next free location
+        T *node = new(offset) T(); // construct the node so its members (vectors, optionals) start in a valid state
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            m_destructors.push_back({[](void *object) {
+                static_cast<T *>(object)->~T();
+            }, node});
+        }
+        return node;
     }
 
     // this deletes the copy constructor (which was being automatically generated) for this class as it would cause problem if there were
@@ -38,6 +73,12 @@ public:
     ArenaAllocator operator=(const ArenaAllocator &other) = delete;
 
     ~ArenaAllocator() {
-        free(m_buffer);
+        // the nodes go before the memory they live in, the last one allocated first
+        for (auto destructor = m_destructors.rbegin(); destructor != m_destructors.rend(); ++destructor) {
+            destructor->destroy(destructor->object);
+        }
+        for (std::byte *block: m_blocks) {
+            free(block);
+        }
     }
 };
\ No newline at end of file
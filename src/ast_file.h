@@ -0,0 +1,755 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "diagnostics.h"
+#include "passes/pass.h"
+#include "structures/ast_nodes.h"
+
+// precompiled AST: `flit --emit-ast` writes the parsed program to <output>.ast and passing that file as the input
+// skips the tokenizer and the parser, so the same program can go through different passes and flags quickly.
+//
+// layout: a Header followed by the payload its checksum covers. The payload starts with the interned strings
+// (identifiers, integer literals and folded output), each a uint32 length and the bytes padded to 4, and then has the
+// nodes in post-order, each a uint32 kind followed by uint32 fields. Nodes refer to their children by how many nodes
+// back they are (0 for a missing optional child), so there are no pointers and a child is always decoded before its
+// parent. The last node is the program.
+namespace ast_file {
+
+    constexpr char magic[8] = {'F', 'L', 'I', 'T', 'A', 'S', 'T', '\n'};
+    constexpr uint32_t version = 5;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t string_count;
+        uint32_t node_count;
+        uint32_t source_name; // string the program was parsed from, debug info refers to it
+        uint64_t payload_size;
+        uint64_t checksum;
+    };
+
+    enum class Kind : uint32_t {
+        // int_lit(string), ident(string), paren(expr), index(string, expr), len(string), call(string, count, expr...),
+        // add/minus/multi/div/eq/ne/lt/le/gt/ge/and/or(lhs, rhs)
+        int_lit, ident, paren, index, len, call, add, minus, multi, div, eq, ne, lt, le, gt, ge, and_, or_,
+        // (line, ...): exit(expr), print(expr), let(string, expr), assign(string, expr), scope(scope),
+        // if(expr, scope, pred), while(expr, scope), write(string, string), let_array(string, string),
+        // assign_index(string, expr, expr), parallel(expr, scope, count, (op, string)...),
+        // fn(string, count, string..., scope), return(expr)
+        stmt_exit, stmt_print, stmt_let, stmt_assign, stmt_scope, stmt_if, stmt_while, stmt_write, stmt_let_array,
+        stmt_assign_index, stmt_parallel, stmt_fn, stmt_return,
+        // scope(count, stmt...), elif(line, expr, scope, pred), else(scope), prog(count, stmt...)
+        scope, elif, else_, prog
+    };
+
+    // FNV-1a
+    inline uint64_t checksum(const char *data, size_t size) {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    class Writer {
+    private:
+        std::vector<std::string_view> m_strings;
+        std::unordered_map<std::string_view, uint32_t> m_string_ids;
+        std::vector<uint32_t> m_words;
+        uint32_t m_node_count = 0;
+
+        uint32_t intern(std::string_view str) {
+            auto [it, inserted] = m_string_ids.try_emplace(str, m_strings.size());
+            if (inserted) {
+                m_strings.push_back(str);
+            }
+            return it->second;
+        }
+
+        // starts a node after its children were written, returns its index
+        uint32_t begin(Kind kind) {
+            m_words.push_back(static_cast<uint32_t>(kind));
+            return m_node_count++;
+        }
+
+        void field(uint32_t value) {
+            m_words.push_back(value);
+        }
+
+        void child(uint32_t node, uint32_t child) {
+            m_words.push_back(node - child);
+        }
+
+        // operands are written before the node referring to them
+        uint32_t write_expr(const NodeExpr *root) {
+            std::vector<uint32_t> written;
+            passes::walk_post_order(root, [&](const auto &frame, auto &frames) {
+                if (!frame.operands_done && passes::push_operands(frames, frame)) {
+                    return;
+                }
+
+                if (auto term = std::get_if<NodeTerm *>(&frame.expr->var)) {
+                    if (auto int_lit = std::get_if<NodeTermIntLit *>(&(*term)->var)) {
+                        const uint32_t node = begin(Kind::int_lit);
+                        field(intern((*int_lit)->int_lit.value.value()));
+                        written.push_back(node);
+                    } else if (auto ident = std::get_if<NodeTermIdent *>(&(*term)->var)) {
+                        const uint32_t node = begin(Kind::ident);
+                        field(intern((*ident)->ident.value.value()));
+                        written.push_back(node);
+                    } else if (auto term_len = std::get_if<NodeTermLen *>(&(*term)->var)) {
+                        const uint32_t node = begin(Kind::len);
+                        field(intern((*term_len)->ident.value.value()));
+                        written.push_back(node);
+                    } else if (auto term_call = std::get_if<NodeTermCall *>(&(*term)->var)) {
+                        const std::vector<NodeExpr *> &args = (*term_call)->args;
+                        const auto first = written.end() - static_cast<long>(args.size());
+                        const std::vector<uint32_t> children(first, written.end());
+                        written.resize(written.size() - args.size());
+                        const uint32_t node = begin(Kind::call);
+                        field(intern((*term_call)->ident.value.value()));
+                        field(children.size());
+                        for (uint32_t arg: children) {
+                            child(node, arg);
+                        }
+                        written.push_back(node);
+                    } else {
+                        const uint32_t inner = written.back();
+                        if (auto term_index = std::get_if<NodeTermIndex *>(&(*term)->var)) {
+                            written.back() = begin(Kind::index);
+                            field(intern((*term_index)->ident.value.value()));
+                        } else {
+                            written.back() = begin(Kind::paren);
+                        }
+                        child(written.back(), inner);
+                    }
+                    return;
+                }
+
+                const NodeBinExpr *bin_expr = std::get<NodeBinExpr *>(frame.expr->var);
+                const uint32_t rhs = written.back();
+                written.pop_back();
+                const uint32_t lhs = written.back();
+                const Kind kinds[] = {Kind::add, Kind::minus, Kind::multi, Kind::div, Kind::eq, Kind::ne, Kind::lt,
+                                      Kind::le, Kind::gt, Kind::ge, Kind::and_, Kind::or_};
+                written.back() = begin(kinds[bin_expr->var.index()]);
+                child(written.back(), lhs);
+                child(written.back(), rhs);
+            });
+            return written.back();
+        }
+
+        uint32_t write_stmts(Kind kind, const std::vector<NodeStmt *> &stmts) {
+            std::vector<uint32_t> children;
+            children.reserve(stmts.size());
+            for (const NodeStmt *stmt: stmts) {
+                children.push_back(write_stmt(stmt));
+            }
+            const uint32_t node = begin(kind);
+            field(children.size());
+            for (uint32_t stmt: children) {
+                child(node, stmt);
+            }
+            return node;
+        }
+
+        uint32_t write_pred(const NodeIfPred *pred) {
+            if (auto elif = std::get_if<NodeIfPredElif *>(&pred->var)) {
+                const uint32_t expr = write_expr((*elif)->expr);
+                const uint32_t scope = write_stmts(Kind::scope, (*elif)->scope->stmts);
+                const std::optional<uint32_t> next = (*elif)->pred.has_value()
+                                                     ? std::optional(write_pred((*elif)->pred.value()))
+                                                     : std::nullopt;
+                const uint32_t node = begin(Kind::elif);
+                field((*elif)->line);
+                child(node, expr);
+                child(node, scope);
+                field(next.has_value() ? node - next.value() : 0);
+                return node;
+            }
+            const uint32_t scope = write_stmts(Kind::scope, std::get<NodeIfPredElse *>(pred->var)->scope->stmts);
+            const uint32_t node = begin(Kind::else_);
+            child(node, scope);
+            return node;
+        }
+
+        uint32_t write_stmt(const NodeStmt *stmt) {
+            struct StmtVisitor {
+                Writer &writer;
+                int line;
+
+                // writes the expression, then the statement node with its line and the expression
+                uint32_t with_expr(Kind kind, const NodeExpr *expr, std::optional<std::string_view> name = {}) const {
+                    const uint32_t child = writer.write_expr(expr);
+                    const uint32_t node = writer.begin(kind);
+                    writer.field(line);
+                    if (name.has_value()) {
+                        writer.field(writer.intern(name.value()));
+                    }
+                    writer.child(node, child);
+                    return node;
+                }
+
+                uint32_t operator()(const NodeStmtExit *stmt_exit) const {
+                    return with_expr(Kind::stmt_exit, stmt_exit->expr);
+                }
+
+                uint32_t operator()(const NodeStmtPrint *stmt_print) const {
+                    return with_expr(Kind::stmt_print, stmt_print->expr);
+                }
+
+                uint32_t operator()(const NodeStmtLet *stmt_let) const {
+                    return with_expr(Kind::stmt_let, stmt_let->expr, stmt_let->ident.value.value());
+                }
+
+                uint32_t operator()(const NodeStmtAssign *stmt_assign) const {
+                    return with_expr(Kind::stmt_assign, stmt_assign->expr, stmt_assign->ident.value.value());
+                }
+
+                uint32_t operator()(const NodeScope *scope) const {
+                    const uint32_t child = writer.write_stmts(Kind::scope, scope->stmts);
+                    const uint32_t node = writer.begin(Kind::stmt_scope);
+                    writer.field(line);
+                    writer.child(node, child);
+                    return node;
+                }
+
+                uint32_t operator()(const NodeStmtIf *stmt_if) const {
+                    const uint32_t expr = writer.write_expr(stmt_if->expr);
+                    const uint32_t scope = writer.write_stmts(Kind::scope, stmt_if->scope->stmts);
+                    const std::optional<uint32_t> pred = stmt_if->pred.has_value()
+                                                         ? std::optional(writer.write_pred(stmt_if->pred.value()))
+                                                         : std::nullopt;
+                    const uint32_t node = writer.begin(Kind::stmt_if);
+                    writer.field(line);
+                    writer.child(node, expr);
+                    writer.child(node, scope);
+                    writer.field(pred.has_value() ? node - pred.value() : 0);
+                    return node;
+                }
+
+                uint32_t operator()(const NodeStmtWhile *stmt_while) const {
+                    const uint32_t expr = writer.write_expr(stmt_while->expr);
+                    const uint32_t scope = writer.write_stmts(Kind::scope, stmt_while->scope->stmts);
+                    const uint32_t node = writer.begin(Kind::stmt_while);
+                    writer.field(line);
+                    writer.child(node, expr);
+                    writer.child(node, scope);
+                    return node;
+                }
+
+                uint32_t operator()(const NodeStmtWrite *stmt_write) const {
+                    const uint32_t node = writer.begin(Kind::stmt_write);
+                    writer.field(line);
+                    writer.field(writer.intern(stmt_write->text));
+                    writer.field(writer.intern(stmt_write->digit_space));
+                    return node;
+                }
+
+                uint32_t operator()(const NodeStmtLetArray *stmt_let_array) const {
+                    const uint32_t node = writer.begin(Kind::stmt_let_array);
+                    writer.field(line);
+                    writer.field(writer.intern(stmt_let_array->ident.value.value()));
+                    writer.field(writer.intern(stmt_let_array->size.value.value()));
+                    return node;
+                }
+
+                uint32_t operator()(const NodeStmtAssignIndex *assign_index) const {
+                    const uint32_t index = writer.write_expr(assign_index->index);
+                    const uint32_t expr = writer.write_expr(assign_index->expr);
+                    const uint32_t node = writer.begin(Kind::stmt_assign_index);
+                    writer.field(line);
+                    writer.field(writer.intern(assign_index->ident.value.value()));
+                    writer.child(node, index);
+                    writer.child(node, expr);
+                    return node;
+                }
+
+                uint32_t operator()(const NodeStmtFn *stmt_fn) const {
+                    const uint32_t scope = writer.write_stmts(Kind::scope, stmt_fn->scope->stmts);
+                    const uint32_t node = writer.begin(Kind::stmt_fn);
+                    writer.field(line);
+                    writer.field(writer.intern(stmt_fn->ident.value.value()));
+                    writer.field(stmt_fn->params.size());
+                    for (const Token &param: stmt_fn->params) {
+                        writer.field(writer.intern(param.value.value()));
+                    }
+                    writer.child(node, scope);
+                    return node;
+                }
+
+                uint32_t operator()(const NodeStmtReturn *stmt_return) const {
+                    return with_expr(Kind::stmt_return, stmt_return->expr);
+                }
+
+                uint32_t operator()(const NodeStmtParallel *stmt_parallel) const {
+                    const uint32_t expr = writer.write_expr(stmt_parallel->loop->expr);
+                    const uint32_t scope = writer.write_stmts(Kind::scope, stmt_parallel->loop->scope->stmts);
+                    const uint32_t node = writer.begin(Kind::stmt_parallel);
+                    writer.field(line);
+                    writer.child(node, expr);
+                    writer.child(node, scope);
+                    writer.field(stmt_parallel->reductions.size());
+                    for (const NodeReduction &reduction: stmt_parallel->reductions) {
+                        writer.field(static_cast<uint32_t>(reduction.op));
+                        writer.field(writer.intern(reduction.ident.value.value()));
+                    }
+                    return node;
+                }
+            };
+
+            StmtVisitor visitor{.writer = *this, .line = stmt->line};
+            return std::visit(visitor, stmt->var);
+        }
+
+    public:
+        // writes the program parsed from source_name
+        void write(const NodeProg &prog, const std::string &source_name, std::ostream &out) {
+            write_stmts(Kind::prog, prog.stmts);
+            const uint32_t source = intern(source_name);
+
+            std::string payload;
+            for (std::string_view str: m_strings) {
+                const uint32_t size = str.size();
+                payload.append(reinterpret_cast<const char *>(&size), sizeof(size));
+                payload.append(str);
+                payload.append((4 - str.size() % 4) % 4, '\0');
+            }
+            payload.append(reinterpret_cast<const char *>(m_words.data()), m_words.size() * sizeof(uint32_t));
+
+            Header header{};
+            std::memcpy(header.magic, magic, sizeof(magic));
+            header.version = version;
+            header.string_count = m_strings.size();
+            header.node_count = m_node_count;
+            header.source_name = source;
+            header.payload_size = payload.size();
+            header.checksum = checksum(payload.data(), payload.size());
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        }
+    };
+
+    // whether the file starts like a precompiled AST, sources can't since they don't contain '\0'
+    inline bool is_ast_file(const std::string &path) {
+        char start[sizeof(magic)] = {};
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        const bool matches = read(fd, start, sizeof(start)) == sizeof(start) &&
+                             std::memcmp(start, magic, sizeof(magic)) == 0;
+        close(fd);
+        return matches;
+    }
+
+    struct Loaded {
+        NodeProg prog;
+        std::string source_name;
+    };
+
+    // maps the file and decodes it into nodes allocated in allocator, in a single pass over the nodes
+    inline Loaded load(const std::string &path, ArenaAllocator &allocator) {
+        const auto fail = [&](const std::string &reason) {
+            throw CompileError({.stage = Diagnostic::Stage::system,
+                                .message = "Invalid AST file " + path + ": " + reason});
+        };
+
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fail(strerror(errno));
+        }
+        struct stat info{};
+        const size_t size = fstat(fd, &info) == 0 ? info.st_size : 0;
+        Header header{};
+        if (size < sizeof(header)) {
+            close(fd);
+            fail("truncated header");
+        }
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            fail(strerror(errno));
+        }
+        // unmaps the file however decoding ends
+        struct Unmap {
+            void *mapping;
+            size_t size;
+
+            ~Unmap() {
+                munmap(mapping, size);
+            }
+        } unmap{mapping, size};
+        const char *data = static_cast<const char *>(mapping);
+
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+            fail("not an AST file");
+        }
+        if (header.version != version) {
+            fail("version " + std::to_string(header.version) + ", this compiler reads version " +
+                 std::to_string(version));
+        }
+        if (header.payload_size != size - sizeof(header) || header.payload_size % 4 != 0) {
+            fail("size doesn't match the header");
+        }
+        const char *payload = data + sizeof(header);
+        if (checksum(payload, header.payload_size) != header.checksum) {
+            fail("checksum mismatch");
+        }
+
+        const uint32_t *word = reinterpret_cast<const uint32_t *>(payload);
+        const uint32_t *end = word + header.payload_size / 4;
+        const auto next = [&]() {
+            if (word == end) {
+                fail("truncated");
+            }
+            return *word++;
+        };
+
+        std::vector<std::string_view> strings;
+        strings.reserve(header.string_count);
+        for (uint32_t i = 0; i < header.string_count; i++) {
+            const uint32_t length = next();
+            if (length > (end - word) * 4) {
+                fail("truncated string");
+            }
+            strings.emplace_back(reinterpret_cast<const char *>(word), length);
+            word += (length + 3) / 4;
+        }
+        const auto string = [&]() {
+            const uint32_t id = next();
+            if (id >= strings.size()) {
+                fail("string out of range");
+            }
+            return std::string(strings[id]);
+        };
+        if (header.source_name >= strings.size()) {
+            fail("string out of range");
+        }
+
+        // decoded nodes by index, with what each one is so a child of the wrong kind is caught
+        enum class Category : uint8_t { expr, stmt, scope, pred };
+        std::vector<void *> nodes;
+        std::vector<Category> categories;
+        nodes.reserve(header.node_count);
+        categories.reserve(header.node_count);
+        const auto child = [&](Category category, uint32_t back) {
+            if (back == 0 || back > nodes.size() || categories[nodes.size() - back] != category) {
+                fail("bad child reference");
+            }
+            return nodes[nodes.size() - back];
+        };
+        const auto expr = [&]() {
+            return static_cast<NodeExpr *>(child(Category::expr, next()));
+        };
+        const auto scope = [&]() {
+            return static_cast<NodeScope *>(child(Category::scope, next()));
+        };
+        const auto pred = [&]() -> std::optional<NodeIfPred *> {
+            const uint32_t back = next();
+            if (back == 0) {
+                return {};
+            }
+            return static_cast<NodeIfPred *>(child(Category::pred, back));
+        };
+        const auto stmts = [&]() {
+            std::vector<NodeStmt *> children(next());
+            for (NodeStmt *&stmt: children) {
+                stmt = static_cast<NodeStmt *>(child(Category::stmt, next()));
+            }
+            return children;
+        };
+        const auto term = [&](auto *node) {
+            auto new_term = allocator.alloc<NodeTerm>();
+            new_term->var = node;
+            auto new_expr = allocator.alloc<NodeExpr>();
+            new_expr->var = new_term;
+            return new_expr;
+        };
+        const auto bin = [&](auto *node) {
+            node->lhs = expr();
+            node->rhs = expr();
+            auto bin_expr = allocator.alloc<NodeBinExpr>();
+            bin_expr->var = node;
+            auto new_expr = allocator.alloc<NodeExpr>();
+            new_expr->var = bin_expr;
+            return new_expr;
+        };
+        const auto stmt = [&](auto *node, int line) {
+            auto new_stmt = allocator.alloc<NodeStmt>();
+            new_stmt->line = line;
+            new_stmt->var = node;
+            return new_stmt;
+        };
+
+        std::optional<NodeProg> prog;
+        while (word != end) {
+            if (prog.has_value()) {
+                fail("nodes after the program");
+            }
+            const auto kind = static_cast<Kind>(next());
+            void *node = nullptr;
+            Category category = Category::expr;
+            switch (kind) {
+                case Kind::int_lit: {
+                    auto int_lit = allocator.alloc<NodeTermIntLit>();
+                    int_lit->int_lit = {.type = TokenType::int_lit, .line = 0, .value = string()};
+                    node = term(int_lit);
+                    break;
+                }
+                case Kind::ident: {
+                    auto ident = allocator.alloc<NodeTermIdent>();
+                    ident->ident = {.type = TokenType::ident, .line = 0, .value = string()};
+                    node = term(ident);
+                    break;
+                }
+                case Kind::paren: {
+                    auto paren = allocator.alloc<NodeTermParen>();
+                    paren->expr = expr();
+                    node = term(paren);
+                    break;
+                }
+                case Kind::call: {
+                    auto call = allocator.alloc<NodeTermCall>();
+                    call->ident = {.type = TokenType::ident, .line = 0, .value = string()};
+                    call->args.resize(next());
+                    for (NodeExpr *&arg: call->args) {
+                        arg = expr();
+                    }
+                    node = term(call);
+                    break;
+                }
+                case Kind::index: {
+                    auto index = allocator.alloc<NodeTermIndex>();
+                    index->ident = {.type = TokenType::ident, .line = 0, .value = string()};
+                    index->index = expr();
+                    node = term(index);
+                    break;
+                }
+                case Kind::len: {
+                    auto term_len = allocator.alloc<NodeTermLen>();
+                    term_len->ident = {.type = TokenType::ident, .line = 0, .value = string()};
+                    node = term(term_len);
+                    break;
+                }
+                case Kind::add:
+                    node = bin(allocator.alloc<NodeBinExprAdd>());
+                    break;
+                case Kind::minus:
+                    node = bin(allocator.alloc<NodeBinExprMinus>());
+                    break;
+                case Kind::multi:
+                    node = bin(allocator.alloc<NodeBinExprMulti>());
+                    break;
+                case Kind::div:
+                    node = bin(allocator.alloc<NodeBinExprDiv>());
+                    break;
+                case Kind::eq:
+                    node = bin(allocator.alloc<NodeBinExprEq>());
+                    break;
+                case Kind::ne:
+                    node = bin(allocator.alloc<NodeBinExprNotEq>());
+                    break;
+                case Kind::lt:
+                    node = bin(allocator.alloc<NodeBinExprLess>());
+                    break;
+                case Kind::le:
+                    node = bin(allocator.alloc<NodeBinExprLessEq>());
+                    break;
+                case Kind::gt:
+                    node = bin(allocator.alloc<NodeBinExprGreater>());
+                    break;
+                case Kind::ge:
+                    node = bin(allocator.alloc<NodeBinExprGreaterEq>());
+                    break;
+                case Kind::and_:
+                    node = bin(allocator.alloc<NodeBinExprAnd>());
+                    break;
+                case Kind::or_:
+                    node = bin(allocator.alloc<NodeBinExprOr>());
+                    break;
+                case Kind::stmt_exit: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_exit = allocator.alloc<NodeStmtExit>();
+                    stmt_exit->expr = expr();
+                    node = stmt(stmt_exit, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_print: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_print = allocator.alloc<NodeStmtPrint>();
+                    stmt_print->expr = expr();
+                    node = stmt(stmt_print, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_let: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_let = allocator.alloc<NodeStmtLet>();
+                    stmt_let->ident = {.type = TokenType::ident, .line = line, .value = string()};
+                    stmt_let->expr = expr();
+                    node = stmt(stmt_let, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_assign: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_assign = allocator.alloc<NodeStmtAssign>();
+                    stmt_assign->ident = {.type = TokenType::ident, .line = line, .value = string()};
+                    stmt_assign->expr = expr();
+                    node = stmt(stmt_assign, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_scope: {
+                    const int line = static_cast<int>(next());
+                    node = stmt(scope(), line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_if: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_if = allocator.alloc<NodeStmtIf>();
+                    stmt_if->expr = expr();
+                    stmt_if->scope = scope();
+                    stmt_if->pred = pred();
+                    node = stmt(stmt_if, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_while: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_while = allocator.alloc<NodeStmtWhile>();
+                    stmt_while->expr = expr();
+                    stmt_while->scope = scope();
+                    node = stmt(stmt_while, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_write: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_write = allocator.alloc<NodeStmtWrite>();
+                    stmt_write->text = string();
+                    stmt_write->digit_space = string();
+                    node = stmt(stmt_write, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_let_array: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_let_array = allocator.alloc<NodeStmtLetArray>();
+                    stmt_let_array->ident = {.type = TokenType::ident, .line = line, .value = string()};
+                    stmt_let_array->size = {.type = TokenType::int_lit, .line = line, .value = string()};
+                    node = stmt(stmt_let_array, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_assign_index: {
+                    const int line = static_cast<int>(next());
+                    auto assign_index = allocator.alloc<NodeStmtAssignIndex>();
+                    assign_index->ident = {.type = TokenType::ident, .line = line, .value = string()};
+                    assign_index->index = expr();
+                    assign_index->expr = expr();
+                    node = stmt(assign_index, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_parallel: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_parallel = allocator.alloc<NodeStmtParallel>();
+                    stmt_parallel->loop = allocator.alloc<NodeStmtWhile>();
+                    stmt_parallel->loop->expr = expr();
+                    stmt_parallel->loop->scope = scope();
+                    stmt_parallel->reductions.resize(next());
+                    for (NodeReduction &reduction: stmt_parallel->reductions) {
+                        const uint32_t op = next();
+                        if (op > static_cast<uint32_t>(NodeReduction::Op::max)) {
+                            fail("unknown reduction " + std::to_string(op));
+                        }
+                        reduction.op = static_cast<NodeReduction::Op>(op);
+                        reduction.ident = {.type = TokenType::ident, .line = line, .value = string()};
+                    }
+                    node = stmt(stmt_parallel, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_fn: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_fn = allocator.alloc<NodeStmtFn>();
+                    stmt_fn->ident = {.type = TokenType::ident, .line = line, .value = string()};
+                    stmt_fn->params.resize(next());
+                    for (Token &param: stmt_fn->params) {
+                        param = {.type = TokenType::ident, .line = line, .value = string()};
+                    }
+                    stmt_fn->scope = scope();
+                    node = stmt(stmt_fn, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::stmt_return: {
+                    const int line = static_cast<int>(next());
+                    auto stmt_return = allocator.alloc<NodeStmtReturn>();
+                    stmt_return->expr = expr();
+                    node = stmt(stmt_return, line);
+                    category = Category::stmt;
+                    break;
+                }
+                case Kind::scope: {
+                    auto new_scope = allocator.alloc<NodeScope>();
+                    new_scope->stmts = stmts();
+                    node = new_scope;
+                    category = Category::scope;
+                    break;
+                }
+                case Kind::elif: {
+                    auto elif = allocator.alloc<NodeIfPredElif>();
+                    elif->line = static_cast<int>(next());
+                    elif->expr = expr();
+                    elif->scope = scope();
+                    elif->pred = pred();
+                    auto if_pred = allocator.alloc<NodeIfPred>();
+                    if_pred->var = elif;
+                    node = if_pred;
+                    category = Category::pred;
+                    break;
+                }
+                case Kind::else_: {
+                    auto else_ = allocator.alloc<NodeIfPredElse>();
+                    else_->scope = scope();
+                    auto if_pred = allocator.alloc<NodeIfPred>();
+                    if_pred->var = else_;
+                    node = if_pred;
+                    category = Category::pred;
+                    break;
+                }
+                case Kind::prog:
+                    prog = NodeProg{.stmts = stmts()};
+                    continue;
+                default:
+                    fail("unknown node kind " + std::to_string(static_cast<uint32_t>(kind)));
+            }
+            nodes.push_back(node);
+            categories.push_back(category);
+        }
+        if (!prog.has_value()) {
+            fail("no program");
+        }
+        return {.prog = std::move(prog.value()), .source_name = std::string(strings[header.source_name])};
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// a problem that stops the compilation, message is the text the command line compiler prints for it
+struct Diagnostic {
+    enum class Stage {
+        lex,
+        parse,
+        generate,
+        assemble,
+        link,
+        run,
+        system,
+    };
+
+    Stage stage;
+    std::string message;
+    int line = 0; // source line the problem is on, 0 when it isn't tied to one
+};
+
+inline const char *to_string(Diagnostic::Stage stage) {
+    switch (stage) {
+        case Diagnostic::Stage::lex:
+            return "lex";
+        case Diagnostic::Stage::parse:
+            return "parse";
+        case Diagnostic::Stage::generate:
+            return "generate";
+        case Diagnostic::Stage::assemble:
+            return "assemble";
+        case Diagnostic::Stage::link:
+            return "link";
+        case Diagnostic::Stage::run:
+            return "run";
+        case Diagnostic::Stage::system:
+            return "system";
+    }
+    return "unknown";
+}
+
+// thrown wherever the compiler can't go on. The command line compiler prints the message and exits with
+// EXIT_FAILURE, the library returns the diagnostic to the caller
+class CompileError : public std::runtime_error {
+public:
+    Diagnostic diagnostic;
+
+    explicit CompileError(Diagnostic diagnostic) : std::runtime_error(diagnostic.message), diagnostic(std::move(diagnostic)) {
+    }
+};
@@ -0,0 +1,584 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "parser.h"
+#include "passes/pass.h"
+
+// Flit programs have no input, so most of them are completely determined at compile time.
+// The evaluator runs the program under a step and memory budget: if it finishes, the whole program is replaced by
+// a single write of its output and its exit code. If the budget runs out, the output and variables of the top level
+// statements that did complete are folded and the remaining statements are left for normal code generation.
+class Evaluator {
+private:
+    const NodeProg &m_prog;
+    const size_t m_max_steps;
+    const size_t m_max_memory;
+    size_t m_steps = 0;
+    size_t m_folded = 0;
+    ArenaAllocator &m_allocator;
+
+    struct Var {
+        std::string name;
+        std::optional<uint64_t> value; // empty while the `let` declaring it is being evaluated
+    };
+    std::vector<Var> m_vars{};
+    std::vector<size_t> m_scopes{};
+
+    // assignments done by the current top level statement to variables declared before it, so that they can be
+    // rolled back if the budget runs out in the middle of that statement
+    struct Undo {
+        size_t index;
+        uint64_t value;
+    };
+    std::vector<Undo> m_undo{};
+    size_t m_top_level_vars = 0;
+
+    std::unordered_map<std::string, size_t> m_functions{}; // parameter counts of the functions the program declares
+    bool m_in_function = false; // checking the body of a function
+
+    std::string m_output;
+    std::string m_digit_space; // mirrors the digitSpace buffer used by _printRAX, stale digits can end up in output
+    uint64_t m_exit_code = 0;
+
+    enum class Status {
+        ok,
+        exited,
+        aborted // out of budget, or the program would fault or fail to compile
+    };
+
+    [[nodiscard]] bool tick() {
+        m_steps++;
+        return m_steps <= m_max_steps && m_output.size() + m_vars.size() * sizeof(Var) + m_undo.size() * sizeof(Undo) <= m_max_memory;
+    }
+
+    std::optional<size_t> find_var(const std::string &name) const {
+        auto it = std::ranges::find_if(m_vars, [&](const Var &var) {
+            return var.name == name;
+        });
+        if (it == m_vars.cend()) {
+            return {};
+        }
+        return it - m_vars.cbegin();
+    }
+
+    // same algorithm as _printRAX: the digits are written after a newline in reverse order and printed backwards
+    // starting one byte past the last digit
+    void print(uint64_t value) {
+        std::fill_n(m_digit_space.begin(), 8, '\0'); // `mov [rcx], rbx` stores the newline as a whole qword
+        m_digit_space[0] = '\n';
+        size_t pos = 1;
+        do {
+            m_digit_space[pos++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        for (size_t i = pos + 1; i-- > 0;) {
+            m_output.push_back(m_digit_space[i]);
+        }
+    }
+
+    std::optional<uint64_t> eval_expr(const NodeExpr *expr) {
+        // the state of a frame tells whether rhs was walked, `&&` and `||` evaluate lhs first and rhs only when it's
+        // needed
+        std::vector<uint64_t> values;
+        const bool done = passes::walk_post_order(expr, false, [&](const auto &frame, auto &frames) {
+            if (!tick()) {
+                return false;
+            }
+
+            if (auto term = std::get_if<NodeTerm *>(&frame.expr->var)) {
+                if (auto term_int_lit = std::get_if<NodeTermIntLit *>(&(*term)->var)) {
+                    const std::string &lit = (*term_int_lit)->int_lit.value.value();
+                    uint64_t value;
+                    if (std::from_chars(lit.data(), lit.data() + lit.size(), value).ec != std::errc()) {
+                        return false; // doesn't fit in 64 bits, leave it to the assembler
+                    }
+                    values.push_back(value);
+                } else if (auto term_ident = std::get_if<NodeTermIdent *>(&(*term)->var)) {
+                    auto index = find_var((*term_ident)->ident.value.value());
+                    if (!index.has_value() || !m_vars[index.value()].value.has_value()) {
+                        return false;
+                    }
+                    values.push_back(m_vars[index.value()].value.value());
+                } else if (auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+                    frames.push_back({(*term_paren)->expr, false, false});
+                } else {
+                    return false; // arrays and calls are only ever generated
+                }
+                return true;
+            }
+
+            const NodeBinExpr *bin_expr = std::get<NodeBinExpr *>(frame.expr->var);
+            const auto [lhs_expr, rhs_expr] = std::visit([](const auto *bin) {
+                return std::pair<const NodeExpr *, const NodeExpr *>{bin->lhs, bin->rhs};
+            }, bin_expr->var);
+            const bool is_and = std::holds_alternative<NodeBinExprAnd *>(bin_expr->var);
+            if (is_and || std::holds_alternative<NodeBinExprOr *>(bin_expr->var)) {
+                if (!frame.operands_done) {
+                    frames.push_back({frame.expr, true, false});
+                    frames.push_back({lhs_expr, false, false});
+                } else if (!frame.state && (values.back() != 0) == is_and) {
+                    values.pop_back();
+                    frames.push_back({frame.expr, true, true});
+                    frames.push_back({rhs_expr, false, false});
+                } else {
+                    values.back() = values.back() != 0;
+                }
+                return true;
+            }
+            if (!frame.operands_done) {
+                passes::push_operands(frames, frame);
+                return true;
+            }
+
+            const uint64_t rhs = values.back();
+            values.pop_back();
+            const uint64_t lhs = values.back();
+            // arithmetic is unsigned 64 bit and wraps around, like `add`, `sub`, `mul` and `div` do
+            if (std::holds_alternative<NodeBinExprAdd *>(bin_expr->var)) {
+                values.back() = lhs + rhs;
+            } else if (std::holds_alternative<NodeBinExprMinus *>(bin_expr->var)) {
+                values.back() = lhs - rhs;
+            } else if (std::holds_alternative<NodeBinExprMulti *>(bin_expr->var)) {
+                values.back() = lhs * rhs;
+            } else if (std::holds_alternative<NodeBinExprEq *>(bin_expr->var)) {
+                values.back() = lhs == rhs;
+            } else if (std::holds_alternative<NodeBinExprNotEq *>(bin_expr->var)) {
+                values.back() = lhs != rhs;
+            } else if (std::holds_alternative<NodeBinExprLess *>(bin_expr->var)) {
+                values.back() = lhs < rhs;
+            } else if (std::holds_alternative<NodeBinExprLessEq *>(bin_expr->var)) {
+                values.back() = lhs <= rhs;
+            } else if (std::holds_alternative<NodeBinExprGreater *>(bin_expr->var)) {
+                values.back() = lhs > rhs;
+            } else if (std::holds_alternative<NodeBinExprGreaterEq *>(bin_expr->var)) {
+                values.back() = lhs >= rhs;
+            } else {
+                if (rhs == 0) {
+                    return false; // the program would crash here, let the generated code do that
+                }
+                values.back() = lhs / rhs;
+            }
+            return true;
+        });
+        if (!done) {
+            return {};
+        }
+        return values.back();
+    }
+
+    void begin_scope() {
+        m_scopes.push_back(m_vars.size());
+    }
+
+    void end_scope() {
+        m_vars.resize(m_scopes.back());
+        m_scopes.pop_back();
+    }
+
+    Status exec_scope(const NodeScope *scope) {
+        begin_scope();
+        for (const NodeStmt *stmt: scope->stmts) {
+            if (Status status = exec_stmt(stmt); status != Status::ok) {
+                return status;
+            }
+        }
+        end_scope();
+        return Status::ok;
+    }
+
+    Status exec_if_pred(const NodeIfPred *if_pred) {
+        if (auto elif = std::get_if<NodeIfPredElif *>(&if_pred->var)) {
+            auto cond = eval_expr((*elif)->expr);
+            if (!cond.has_value()) {
+                return Status::aborted;
+            }
+            if (cond.value() != 0) {
+                return exec_scope((*elif)->scope);
+            }
+            if ((*elif)->pred.has_value()) {
+                return exec_if_pred((*elif)->pred.value());
+            }
+            return Status::ok;
+        }
+        return exec_scope(std::get<NodeIfPredElse *>(if_pred->var)->scope);
+    }
+
+    Status exec_stmt(const NodeStmt *stmt) {
+        struct StmtVisitor {
+            Evaluator &eval;
+
+            Status operator()(const NodeStmtExit *stmt_exit) const {
+                auto value = eval.eval_expr(stmt_exit->expr);
+                if (!value.has_value()) {
+                    return Status::aborted;
+                }
+                eval.m_exit_code = value.value();
+                return Status::exited;
+            }
+
+            Status operator()(const NodeStmtLet *stmt_let) const {
+                if (eval.find_var(stmt_let->ident.value.value()).has_value()) {
+                    return Status::aborted;
+                }
+                Var var{};
+                var.name = stmt_let->ident.value.value();
+                eval.m_vars.push_back(std::move(var));
+                auto value = eval.eval_expr(stmt_let->expr);
+                if (!value.has_value()) {
+                    return Status::aborted;
+                }
+                eval.m_vars.back().value = value;
+                return Status::ok;
+            }
+
+            Status operator()(const NodeStmtPrint *stmt_print) const {
+                auto value = eval.eval_expr(stmt_print->expr);
+                if (!value.has_value()) {
+                    return Status::aborted;
+                }
+                eval.print(value.value());
+                return Status::ok;
+            }
+
+            Status operator()(const NodeScope *scope) const {
+                return eval.exec_scope(scope);
+            }
+
+            Status operator()(const NodeStmtIf *stmt_if) const {
+                auto cond = eval.eval_expr(stmt_if->expr);
+                if (!cond.has_value()) {
+                    return Status::aborted;
+                }
+                if (cond.value() != 0) {
+                    return eval.exec_scope(stmt_if->scope);
+                }
+                if (stmt_if->pred.has_value()) {
+                    return eval.exec_if_pred(stmt_if->pred.value());
+                }
+                return Status::ok;
+            }
+
+            Status operator()(const NodeStmtAssign *stmt_assign) const {
+                auto index = eval.find_var(stmt_assign->ident.value.value());
+                if (!index.has_value()) {
+                    return Status::aborted;
+                }
+                auto value = eval.eval_expr(stmt_assign->expr);
+                if (!value.has_value()) {
+                    return Status::aborted;
+                }
+                if (index.value() < eval.m_top_level_vars) {
+                    eval.m_undo.push_back({.index = index.value(), .value = eval.m_vars[index.value()].value.value()});
+                }
+                eval.m_vars[index.value()].value = value;
+                return Status::ok;
+            }
+
+            Status operator()(const NodeStmtWhile *stmt_while) const {
+                while (true) {
+                    auto cond = eval.eval_expr(stmt_while->expr);
+                    if (!cond.has_value()) {
+                        return Status::aborted;
+                    }
+                    if (cond.value() == 0) {
+                        return Status::ok;
+                    }
+                    if (Status status = eval.exec_scope(stmt_while->scope); status != Status::ok) {
+                        return status;
+                    }
+                }
+            }
+
+            Status operator()(const NodeStmtWrite *stmt_write) const {
+                eval.m_output += stmt_write->text;
+                eval.m_digit_space = stmt_write->digit_space;
+                return Status::ok;
+            }
+
+            // arrays aren't tracked, the program is folded up to the first statement using one
+            Status operator()(const NodeStmtLetArray *) const {
+                return Status::aborted;
+            }
+
+            Status operator()(const NodeStmtAssignIndex *) const {
+                return Status::aborted;
+            }
+
+            // the iterations run in any order, so the loop is left to the threads
+            Status operator()(const NodeStmtParallel *) const {
+                return Status::aborted;
+            }
+
+            // the declaration doesn't do anything when it runs, it is kept in the residual program for the calls
+            Status operator()(const NodeStmtFn *) const {
+                return Status::ok;
+            }
+
+            Status operator()(const NodeStmtReturn *) const {
+                return Status::aborted;
+            }
+        };
+
+        if (!tick()) {
+            return Status::aborted;
+        }
+        StmtVisitor visitor{.eval = *this};
+        return std::visit(visitor, stmt->var);
+    }
+
+    // the generator rejects programs using undeclared or redeclared identifiers even in code that never runs,
+    // so the program is only folded when it would have compiled. This mirrors the scoping rules of the generator.
+    bool check_expr(const NodeExpr *expr, std::vector<std::string> &names) {
+        std::vector<const NodeExpr *> pending{expr};
+        while (!pending.empty()) {
+            const NodeExpr *curr = pending.back();
+            pending.pop_back();
+            if (auto term = std::get_if<NodeTerm *>(&curr->var)) {
+                if (auto term_ident = std::get_if<NodeTermIdent *>(&(*term)->var)) {
+                    if (std::ranges::find(names, (*term_ident)->ident.value.value()) == names.cend()) {
+                        return false;
+                    }
+                } else if (auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+                    pending.push_back((*term_paren)->expr);
+                } else if (auto term_index = std::get_if<NodeTermIndex *>(&(*term)->var)) {
+                    if (std::ranges::find(names, (*term_index)->ident.value.value()) == names.cend()) {
+                        return false;
+                    }
+                    pending.push_back((*term_index)->index);
+                } else if (auto term_len = std::get_if<NodeTermLen *>(&(*term)->var)) {
+                    if (std::ranges::find(names, (*term_len)->ident.value.value()) == names.cend()) {
+                        return false;
+                    }
+                } else if (auto term_call = std::get_if<NodeTermCall *>(&(*term)->var)) {
+                    auto function = m_functions.find((*term_call)->ident.value.value());
+                    if (function == m_functions.end() || function->second != (*term_call)->args.size()) {
+                        return false;
+                    }
+                    pending.insert(pending.end(), (*term_call)->args.begin(), (*term_call)->args.end());
+                }
+                continue;
+            }
+            std::visit([&](const auto *bin) {
+                pending.push_back(bin->lhs);
+                pending.push_back(bin->rhs);
+            }, std::get<NodeBinExpr *>(curr->var)->var);
+        }
+        return true;
+    }
+
+    bool check_scope(const NodeScope *scope, std::vector<std::string> &names) {
+        const size_t scope_start = names.size();
+        for (const NodeStmt *stmt: scope->stmts) {
+            if (std::holds_alternative<NodeStmtFn *>(stmt->var) || !check_stmt(stmt, names)) {
+                return false;
+            }
+        }
+        names.resize(scope_start);
+        return true;
+    }
+
+    bool check_if_pred(const NodeIfPred *if_pred, std::vector<std::string> &names) {
+        if (auto elif = std::get_if<NodeIfPredElif *>(&if_pred->var)) {
+            return check_expr((*elif)->expr, names) && check_scope((*elif)->scope, names) &&
+                   (!(*elif)->pred.has_value() || check_if_pred((*elif)->pred.value(), names));
+        }
+        return check_scope(std::get<NodeIfPredElse *>(if_pred->var)->scope, names);
+    }
+
+    bool check_stmt(const NodeStmt *stmt, std::vector<std::string> &names) {
+        if (auto stmt_let = std::get_if<NodeStmtLet *>(&stmt->var)) {
+            const std::string &name = (*stmt_let)->ident.value.value();
+            if (std::ranges::find(names, name) != names.cend()) {
+                return false;
+            }
+            names.push_back(name);
+            return check_expr((*stmt_let)->expr, names);
+        }
+        if (auto stmt_assign = std::get_if<NodeStmtAssign *>(&stmt->var)) {
+            return std::ranges::find(names, (*stmt_assign)->ident.value.value()) != names.cend() &&
+                   check_expr((*stmt_assign)->expr, names);
+        }
+        if (auto stmt_let_array = std::get_if<NodeStmtLetArray *>(&stmt->var)) {
+            const std::string &name = (*stmt_let_array)->ident.value.value();
+            if (std::ranges::find(names, name) != names.cend()) {
+                return false;
+            }
+            names.push_back(name);
+            return true;
+        }
+        if (auto assign_index = std::get_if<NodeStmtAssignIndex *>(&stmt->var)) {
+            return std::ranges::find(names, (*assign_index)->ident.value.value()) != names.cend() &&
+                   check_expr((*assign_index)->index, names) && check_expr((*assign_index)->expr, names);
+        }
+        if (auto stmt_exit = std::get_if<NodeStmtExit *>(&stmt->var)) {
+            return check_expr((*stmt_exit)->expr, names);
+        }
+        if (auto stmt_print = std::get_if<NodeStmtPrint *>(&stmt->var)) {
+            return check_expr((*stmt_print)->expr, names);
+        }
+        if (auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+            return check_scope(*scope, names);
+        }
+        if (auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+            return check_expr((*stmt_if)->expr, names) && check_scope((*stmt_if)->scope, names) &&
+                   (!(*stmt_if)->pred.has_value() || check_if_pred((*stmt_if)->pred.value(), names));
+        }
+        if (auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+            return check_expr((*stmt_while)->expr, names) && check_scope((*stmt_while)->scope, names);
+        }
+        if (auto stmt_parallel = std::get_if<NodeStmtParallel *>(&stmt->var)) {
+            for (const NodeReduction &reduction: (*stmt_parallel)->reductions) {
+                if (std::ranges::find(names, reduction.ident.value.value()) == names.cend()) {
+                    return false;
+                }
+            }
+            return check_expr((*stmt_parallel)->loop->expr, names) && check_scope((*stmt_parallel)->loop->scope, names);
+        }
+        if (auto stmt_return = std::get_if<NodeStmtReturn *>(&stmt->var)) {
+            return m_in_function && check_expr((*stmt_return)->expr, names);
+        }
+        if (auto stmt_fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+            // check_scope rejects declarations that aren't at the top level, the body sees nothing but the parameters
+            std::vector<std::string> params;
+            for (const Token &param: (*stmt_fn)->params) {
+                if (std::ranges::find(params, param.value.value()) != params.cend()) {
+                    return false;
+                }
+                params.push_back(param.value.value());
+            }
+            m_in_function = true;
+            const bool valid = check_scope((*stmt_fn)->scope, params);
+            m_in_function = false;
+            return valid;
+        }
+        return true;
+    }
+
+    NodeStmt *make_write() {
+        auto stmt_write = m_allocator.alloc<NodeStmtWrite>();
+        stmt_write->text = m_output;
+        stmt_write->digit_space = m_digit_space;
+        auto stmt = m_allocator.alloc<NodeStmt>();
+        stmt->var = stmt_write;
+        return stmt;
+    }
+
+    NodeExpr *make_int_lit(uint64_t value) {
+        auto term_int_lit = m_allocator.alloc<NodeTermIntLit>();
+        term_int_lit->int_lit = {};
+        term_int_lit->int_lit.type = TokenType::int_lit;
+        term_int_lit->int_lit.value = std::to_string(value);
+        auto term = m_allocator.alloc<NodeTerm>();
+        term->var = term_int_lit;
+        auto expr = m_allocator.alloc<NodeExpr>();
+        expr->var = term;
+        return expr;
+    }
+
+public:
+    // nodes of the residual program are allocated from the given arena, so it must outlive the generator
+    Evaluator(const NodeProg &prog, ArenaAllocator &allocator, size_t max_steps, size_t max_memory) :
+            m_prog(prog),
+            m_max_steps(max_steps),
+            m_max_memory(max_memory),
+            m_allocator(allocator),
+            m_digit_space(100, '\0') {
+    }
+
+    // number of top level statements of the original program that were folded by the last evaluate()
+    [[nodiscard]] size_t folded() const {
+        return m_folded;
+    }
+
+    // returns the program that is left to generate after folding everything that could run at compile time
+    NodeProg evaluate() {
+        for (const NodeStmt *stmt: m_prog.stmts) {
+            if (auto stmt_fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+                if ((*stmt_fn)->params.size() > max_params ||
+                    !m_functions.try_emplace((*stmt_fn)->ident.value.value(), (*stmt_fn)->params.size()).second) {
+                    return m_prog;
+                }
+            }
+        }
+        std::vector<std::string> names;
+        for (const NodeStmt *stmt: m_prog.stmts) {
+            if (!check_stmt(stmt, names)) {
+                return m_prog; // let the generator report the error
+            }
+        }
+
+        size_t done = 0; // number of top level statements that completed
+        size_t output_size = 0;
+        std::string digit_space = m_digit_space;
+        Status status = Status::ok;
+
+        for (const NodeStmt *stmt: m_prog.stmts) {
+            m_undo.clear();
+            m_top_level_vars = m_vars.size();
+            output_size = m_output.size();
+            digit_space = m_digit_space;
+
+            status = exec_stmt(stmt);
+            if (status != Status::ok) {
+                break;
+            }
+            done++;
+        }
+
+        NodeProg residual;
+        if (status != Status::aborted) {
+            m_folded = m_prog.stmts.size();
+            // the whole program ran, all that is left is its output and exit code
+            if (!m_output.empty()) {
+                residual.stmts.push_back(make_write());
+            }
+            if (status == Status::exited) {
+                auto stmt_exit = m_allocator.alloc<NodeStmtExit>();
+                stmt_exit->expr = make_int_lit(m_exit_code);
+                auto stmt = m_allocator.alloc<NodeStmt>();
+                stmt->var = stmt_exit;
+                residual.stmts.push_back(stmt);
+            }
+            return residual;
+        }
+
+        if (done == 0) {
+            return m_prog;
+        }
+        m_folded = done;
+
+        // roll back the partially executed statement to the state right after the last completed one
+        for (auto it = m_undo.rbegin(); it != m_undo.rend(); ++it) {
+            m_vars[it->index].value = it->value;
+        }
+        m_vars.resize(m_top_level_vars);
+        m_output.resize(output_size);
+        m_digit_space = digit_space;
+
+        if (!m_output.empty()) {
+            residual.stmts.push_back(make_write());
+        }
+        // the statements left can call the functions declared by the folded ones
+        for (size_t i = 0; i < done; i++) {
+            if (std::holds_alternative<NodeStmtFn *>(m_prog.stmts[i]->var)) {
+                residual.stmts.push_back(m_prog.stmts[i]);
+            }
+        }
+        for (const Var &var: m_vars) {
+            auto stmt_let = m_allocator.alloc<NodeStmtLet>();
+            stmt_let->ident = {};
+            stmt_let->ident.type = TokenType::ident;
+            stmt_let->ident.value = var.name;
+            stmt_let->expr = make_int_lit(var.value.value());
+            auto stmt = m_allocator.alloc<NodeStmt>();
+            stmt->var = stmt_let;
+            residual.stmts.push_back(stmt);
+        }
+        residual.stmts.insert(residual.stmts.end(), m_prog.stmts.begin() + static_cast<long>(done), m_prog.stmts.end());
+        return residual;
+    }
+};
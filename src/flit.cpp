@@ -0,0 +1,284 @@
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <optional>
+#include <vector>
+
+#include <fcntl.h>
+
+#include "ast_file.h"
+#include "flit.h"
+#include "generator.h"
+#include "incremental.h"
+#include "passes/pass_manager.h"
+#include "toolchain.h"
+
+namespace flit {
+
+    // runs fn and turns the error that stopped it into a diagnostic
+    template<typename T, typename Fn>
+    static Result<T> guarded(Fn fn) {
+        Result<T> result;
+        try {
+            result.value.emplace(fn());
+        } catch (const CompileError &error) {
+            result.diagnostics.push_back(error.diagnostic);
+        }
+        return result;
+    }
+
+    static std::vector<Token> lex(std::string_view source, const Options &options) {
+        Tokenizer tokenizer{std::string(source)};
+        return tokenizer.tokenize(options.lex_threads.value_or(options.threads));
+    }
+
+    // scripts are usually small, the arena grows in blocks of this size when they aren't
+    static constexpr size_t arena_block = 1024 * 64;
+
+    static Ast parse_tokens(const std::vector<Token> &tokens, std::string source_name) {
+        Ast ast{.prog = {}, .arena = std::make_unique<ArenaAllocator>(arena_block),
+                .source_name = std::move(source_name)};
+        Parser parser({.front = tokens}, 0, *ast.arena);
+        ast.prog = parser.parse_prog().value();
+        return ast;
+    }
+
+    static std::unique_ptr<PassManager> make_pass_manager(const Options &options) {
+        auto pass_manager = std::make_unique<PassManager>(PassManager::Options{
+                .level = options.opt_level, .eval_steps = options.eval_steps, .eval_memory = options.eval_memory});
+        for (const auto &[name, enabled]: options.passes) {
+            if (!pass_manager->set_enabled(name, enabled)) {
+                std::string message = "Unknown pass `" + name + "`, available passes are:";
+                for (const std::string &pass_name: pass_manager->pass_names()) {
+                    message += " " + pass_name;
+                }
+                throw CompileError({.stage = Diagnostic::Stage::system, .message = message});
+            }
+        }
+        return pass_manager;
+    }
+
+    // runs the passes the options ask for on the program. The nodes they create belong to the returned pass manager,
+    // which has to outlive the program
+    static std::unique_ptr<PassManager> run_passes(Ast &ast, const Options &options) {
+        std::unique_ptr<PassManager> pass_manager = make_pass_manager(options);
+        pass_manager->run(ast.prog);
+        if (options.pass_report != nullptr) {
+            pass_manager->report(*options.pass_report);
+        }
+        return pass_manager;
+    }
+
+    static GenOptions gen_options(const Options &options, const std::string &source_name) {
+        GenOptions gen_options{.threads = options.threads, .vectorize = options.opt_level >= 1, .avx2 = options.avx2,
+                               .inline_calls = options.opt_level >= 1};
+        if (options.debug_info) {
+            gen_options.debug_source = source_name;
+        }
+        gen_options.instrument = options.instrument;
+        if (!options.profiles.empty()) {
+            gen_options.profile = profile::read(options.profiles);
+        }
+        return gen_options;
+    }
+
+    Image::Image(int fd) : m_fd(fd) {
+    }
+
+    Image::Image(Image &&other) noexcept: m_fd(other.m_fd) {
+        other.m_fd = -1;
+    }
+
+    Image::~Image() {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    std::string Image::bytes() const {
+        std::string bytes(lseek(m_fd, 0, SEEK_END), '\0');
+        if (pread(m_fd, bytes.data(), bytes.size(), 0) != static_cast<ssize_t>(bytes.size())) {
+            bytes.clear();
+        }
+        return bytes;
+    }
+
+    Result<std::string> Image::save(const std::string &path) const {
+        return guarded<std::string>([&]() {
+            // a new file rather than the old one rewritten, which may still be running
+            unlink(path.c_str());
+            const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0777);
+            if (fd < 0) {
+                throw CompileError({.stage = Diagnostic::Stage::link,
+                                    .message = "Failed to write " + path + ": " + strerror(errno)});
+            }
+            toolchain::FdStreamBuf buffer(fd);
+            const std::string contents = bytes();
+            const bool written = buffer.sputn(contents.data(), static_cast<std::streamsize>(contents.size())) ==
+                                         static_cast<std::streamsize>(contents.size()) && buffer.pubsync() == 0;
+            close(fd);
+            if (!written) {
+                throw CompileError({.stage = Diagnostic::Stage::link, .message = "Failed to write " + path});
+            }
+            return std::filesystem::absolute(path).string();
+        });
+    }
+
+    Result<int> Image::run(int stdout_fd) const {
+        return guarded<int>([&]() {
+            // the file is close-on-exec, but the child opens it through its /proc/self/fd before exec closes it, the
+            // way fexecve does, so the program doesn't inherit it
+            const std::string path = "/proc/self/fd/" + std::to_string(m_fd);
+            return toolchain::wait(toolchain::spawn({path}, Diagnostic::Stage::run, stdout_fd));
+        });
+    }
+
+    Document::Document(std::string_view source) : m_source(source) {
+        reparse();
+    }
+
+    Document::Document(Document &&other) noexcept = default;
+
+    Document::~Document() = default;
+
+    void Document::reparse() {
+        try {
+            m_frontend = std::make_unique<IncrementalFrontend>(m_source);
+            m_source.clear();
+        } catch (const CompileError &error) {
+            m_diagnostics = {error.diagnostic};
+        }
+    }
+
+    bool Document::edit(size_t offset, size_t removed, std::string_view inserted) {
+        const size_t length = source().length();
+        if (offset > length || removed > length - offset) {
+            m_diagnostics = {{.stage = Diagnostic::Stage::system,
+                              .message = "Edit out of range: " + std::to_string(offset) + "+" +
+                                         std::to_string(removed) + " in " + std::to_string(length) + " bytes"}};
+            return false;
+        }
+        m_diagnostics.clear();
+        if (!m_frontend) {
+            m_source.replace(offset, removed, inserted);
+            reparse();
+            return m_diagnostics.empty();
+        }
+        try {
+            m_frontend->edit(offset, removed, inserted);
+        } catch (const CompileError &error) {
+            // the frontend is left half updated, only its source is kept
+            m_diagnostics = {error.diagnostic};
+            m_source = m_frontend->source();
+            m_frontend.reset();
+        }
+        return m_diagnostics.empty();
+    }
+
+    const std::string &Document::source() const {
+        return m_frontend ? m_frontend->source() : m_source;
+    }
+
+    const std::vector<Diagnostic> &Document::diagnostics() const {
+        return m_diagnostics;
+    }
+
+    std::vector<Token> Document::tokens() const {
+        return m_frontend ? m_frontend->tokens() : std::vector<Token>();
+    }
+
+    std::optional<NodeProg> Document::program() const {
+        if (!m_frontend) {
+            return {};
+        }
+        return m_frontend->program();
+    }
+
+    Result<std::vector<Token>> tokenize(std::string_view source, const Options &options) {
+        return guarded<std::vector<Token>>([&]() {
+            return lex(source, options);
+        });
+    }
+
+    Result<Ast> parse(std::string_view source, const Options &options) {
+        return guarded<Ast>([&]() {
+            return parse_tokens(lex(source, options), options.source_name);
+        });
+    }
+
+    Result<Ast> parse_file(const std::string &path, const Options &options) {
+        return guarded<Ast>([&]() {
+            if (ast_file::is_ast_file(path)) {
+                Ast ast{.prog = {}, .arena = std::make_unique<ArenaAllocator>(arena_block)};
+                ast_file::Loaded loaded = ast_file::load(path, *ast.arena);
+                ast.prog = std::move(loaded.prog);
+                ast.source_name = std::move(loaded.source_name);
+                return ast;
+            }
+            std::ifstream file(path);
+            if (!file) {
+                throw CompileError({.stage = Diagnostic::Stage::system,
+                                    .message = "Failed to read " + path + ": " + strerror(errno)});
+            }
+            std::stringstream contents;
+            contents << file.rdbuf();
+            return parse_tokens(lex(contents.str(), options), std::filesystem::absolute(path).string());
+        });
+    }
+
+    Result<std::string> write_ast(const Ast &ast) {
+        return guarded<std::string>([&]() {
+            std::ostringstream out;
+            ast_file::Writer().write(ast.prog, ast.source_name, out);
+            return out.str();
+        });
+    }
+
+    Result<std::string> compile_to_asm(std::string_view source, const Options &options) {
+        Result<Ast> ast = parse(source, options);
+        if (!ast.ok()) {
+            return {.diagnostics = std::move(ast.diagnostics)};
+        }
+        return compile_to_asm(std::move(ast.value.value()), options);
+    }
+
+    Result<std::string> compile_to_asm(Ast ast, const Options &options) {
+        return guarded<std::string>([&]() {
+            std::unique_ptr<PassManager> pass_manager = run_passes(ast, options);
+            Generator generator(ast.prog, gen_options(options, ast.source_name));
+            return generator.gen_prog();
+        });
+    }
+
+    Result<Image> compile_to_image(std::string_view source, const Options &options) {
+        Result<Ast> ast = parse(source, options);
+        if (!ast.ok()) {
+            return {.diagnostics = std::move(ast.diagnostics)};
+        }
+        return compile_to_image(std::move(ast.value.value()), options);
+    }
+
+    Result<Image> compile_to_image(Ast ast, const Options &options) {
+        return guarded<Image>([&]() {
+            std::unique_ptr<PassManager> pass_manager = run_passes(ast, options);
+            Generator generator(ast.prog, gen_options(options, ast.source_name));
+
+            toolchain::MemFile asm_file("flit-asm");
+            {
+                toolchain::FdStreamBuf asm_buf(asm_file.fd);
+                std::ostream asm_stream(&asm_buf);
+                generator.gen_prog(asm_stream);
+            }
+            // what nasm and ld print ends up in the diagnostic if they fail
+            toolchain::MemFile errors("flit-toolchain-errors");
+            toolchain::MemFile image_file("flit-image");
+            toolchain::assemble_and_link(asm_file, image_file, options.debug_info, &errors);
+
+            Image image(image_file.fd);
+            image_file.fd = -1;
+            return image;
+        });
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+// libflit: the compiler as a library, the command line is built on it. The source comes from memory and the tokens,
+// the syntax tree, the assembly or a runnable executable come back in memory, only parse_file(), Image::save() and
+// the profile options touch the disk. Errors come back as diagnostics instead of ending the process. Calls don't
+// share any state, so they can run on several threads at once.
+
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "diagnostics.h"
+#include "structures/ast_nodes.h"
+
+class IncrementalFrontend;
+
+namespace flit {
+
+    // the command line options that make sense for a library, with the same defaults
+    struct Options {
+        int opt_level = 0; // -O0, -O1 or -O2
+        std::vector<std::pair<std::string, bool>> passes{}; // passes turned on (true) or off regardless of the level
+        size_t eval_steps = 1'000'000; // --eval-steps
+        size_t eval_memory = 16 * 1024 * 1024; // --eval-memory
+        bool debug_info = false; // -g, the line info refers to source_name
+        bool avx2 = true; // false is --no-avx2
+        std::string source_name = "input.flt"; // parse_file() names the program after its file instead
+        unsigned threads = 1; // threads that generate code, 0 picks by program size like the command line
+        std::optional<unsigned> lex_threads{}; // threads that tokenize, 0 picks by input size, unset uses threads
+        std::optional<std::string> instrument{}; // --instrument, the executable writes its branch counts to this file
+        std::vector<std::string> profiles{}; // --profile-use, the counts of these profiles lay out the branches
+        std::ostream *pass_report = nullptr; // --time-passes, the time and changes of every pass are written here
+    };
+
+    // value is set when the stage succeeded, otherwise diagnostics say why it didn't
+    template<typename T>
+    struct Result {
+        std::optional<T> value{};
+        std::vector<Diagnostic> diagnostics{};
+
+        [[nodiscard]] bool ok() const {
+            return value.has_value();
+        }
+    };
+
+    // syntax tree of a program, its nodes live in the arena that comes with it
+    struct Ast {
+        NodeProg prog;
+        std::unique_ptr<ArenaAllocator> arena;
+        std::string source_name{}; // the line info of -g refers to it
+    };
+
+    // executable that only exists in memory
+    class Image {
+    private:
+        int m_fd;
+
+    public:
+        // takes over the in-memory file holding the executable
+        explicit Image(int fd);
+
+        Image(const Image &other) = delete;
+
+        Image &operator=(const Image &other) = delete;
+
+        Image(Image &&other) noexcept;
+
+        ~Image();
+
+        // the ELF file
+        [[nodiscard]] std::string bytes() const;
+
+        // writes the executable to path, replacing what is there, and returns its absolute path
+        [[nodiscard]] Result<std::string> save(const std::string &path) const;
+
+        // runs the executable and waits for it, returns its exit code. Its output goes to stdout_fd, -1 keeps ours
+        [[nodiscard]] Result<int> run(int stdout_fd = -1) const;
+    };
+
+    // source that is edited again and again, e.g. by an editor on every keystroke. An edit only tokenizes and parses
+    // the text around it again. While the source doesn't tokenize or parse it is only kept as text, and the next edit
+    // parses all of it
+    class Document {
+    private:
+        std::string m_source; // the source while it has errors
+        std::unique_ptr<IncrementalFrontend> m_frontend; // empty while the source has errors
+        std::vector<Diagnostic> m_diagnostics;
+
+        void reparse();
+
+    public:
+        explicit Document(std::string_view source);
+
+        Document(const Document &other) = delete;
+
+        Document &operator=(const Document &other) = delete;
+
+        Document(Document &&other) noexcept;
+
+        ~Document();
+
+        // replaces `removed` bytes at offset with inserted, returns whether the source tokenizes and parses after it
+        bool edit(size_t offset, size_t removed, std::string_view inserted);
+
+        [[nodiscard]] const std::string &source() const;
+
+        // why the source doesn't tokenize or parse, empty when it does
+        [[nodiscard]] const std::vector<Diagnostic> &diagnostics() const;
+
+        // tokens of the source, empty while it has errors. They are copied out of the document on every call
+        [[nodiscard]] std::vector<Token> tokens() const;
+
+        // the parsed program, empty while the source has errors. Its nodes are only valid until the next edit and
+        // belong to the document, so passes mustn't run on them
+        [[nodiscard]] std::optional<NodeProg> program() const;
+    };
+
+    Result<std::vector<Token>> tokenize(std::string_view source, const Options &options = {});
+
+    Result<Ast> parse(std::string_view source, const Options &options = {});
+
+    // parses the source file at path, or maps it without tokenizing or parsing when it holds a program written by
+    // write_ast(). The program is named after the file, or after the source the AST was written from
+    Result<Ast> parse_file(const std::string &path, const Options &options = {});
+
+    // the program in the binary format of --emit-ast, which parse_file() reads back
+    Result<std::string> write_ast(const Ast &ast);
+
+    // runs the optimization passes the options ask for and generates the assembly
+    Result<std::string> compile_to_asm(std::string_view source, const Options &options = {});
+
+    Result<std::string> compile_to_asm(Ast ast, const Options &options = {});
+
+    // compiles, assembles and links with nasm and ld into an in-memory executable
+    Result<Image> compile_to_image(std::string_view source, const Options &options = {});
+
+    Result<Image> compile_to_image(Ast ast, const Options &options = {});
+}
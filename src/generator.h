@@ -1,32 +1,122 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include "ranges"
 #include "parser.h"
+#include "passes/pass.h"
+#include "profile.h"
 #include "utils.h"
 
+struct GenOptions {
+    // path of the source file, when set the output carries `%line` directives and labels carry source lines
+    // so that the assembler can emit DWARF line info for profilers and debuggers
+    std::optional<std::string> debug_source{};
+    // threads generating top-level statements, 0 picks by program size
+    unsigned threads = 0;
+    // when set, if and while statements and the scopes they branch to count how often they run and the program
+    // writes the counts to this file when it exits
+    std::optional<std::string> instrument{};
+    // counts of an instrumented run of the same program, used to move rarely taken arms out of line and align hot loops
+    std::optional<profile::Profile> profile{};
+    // loops over arrays run several iterations at once with SSE2 or AVX2, whichever the machine running it has
+    bool vectorize = false;
+    // false keeps vectorized loops on SSE2 even when the machine running them has AVX2
+    bool avx2 = true;
+    // calls of small functions and of functions called once are replaced with the body
+    bool inline_calls = false;
+};
+
 class Generator {
 private:
     const NodeProg m_prog;
+    const GenOptions m_options;
     std::stringstream m_output;
-    size_t m_stack_size = 0;
+    std::stringstream m_data; // initialized data, emitted after the code
+    std::stringstream m_rodata; // constants the code only reads (jump tables), emitted after the code read-only
+    std::stringstream m_cold; // blocks the profile says rarely run, emitted after the code
+    bool m_in_cold = false; // generating into m_cold
+    std::shared_ptr<const profile::Sites> m_sites{}; // counter sites when instrumenting or using a profile
     int m_label_count = 0;
+    int m_line = 0; // source line of the statement being generated
+    int m_marked_line = 0; // source line the assembler currently attributes the output to
 
     struct Var {
         std::string name;
-        size_t stack_loc;
+        size_t slot; // of the frame, see allocate
+        std::optional<size_t> length{}; // arrays take a slot per element, element 0 is at the lowest address
+        bool dead = false; // no statement after the current one mentions it, its slots were given back
     };
     std::vector<Var> m_vars{};
     std::vector<size_t> m_scopes{};
 
+    // the program, every function routine and every parallel body has a frame that is allocated once when it starts
+    // and holds its variables at fixed offsets below rbp, slot k is at rbp - (k + 1) * 8. Scopes don't move rsp,
+    // which only holds the values expressions are working on
+    std::vector<std::pair<size_t, size_t>> m_live{}; // slots [first, second) of the live variables, ordered
+    size_t m_frame_base = 0; // slot at rbp - 8, the slots below it belong to the frame a parallel body was started from
+    size_t m_frame_size = 0; // the most slots that were live at once, what the frame allocates
+
+    // the statements being generated at the top level and in each scope, innermost last. A variable gives its slots
+    // back after the last statement of its list that mentions it, so variables declared after that can reuse them
+    struct StmtList {
+        std::shared_ptr<const std::unordered_map<std::string, size_t>> last_uses; // last statement mentioning a name
+        size_t depth; // of m_scopes when the list started, the variables it declares are in the scope at that depth
+        size_t index = 0; // of the statement being generated
+        std::vector<std::pair<size_t, size_t>> releases{}; // min-heap of statement index and variable freed after it
+    };
+    std::vector<StmtList> m_lists{};
+
+    // a shard generates a range of top-level statements on its own thread. It can't know how many labels the shards
+    // before it create or which line the assembler is at when it starts, so it writes label numbers and its first
+    // `%line` directive with marker bytes that are resolved when the shards are joined in order
+    static constexpr char label_begin = '\x01';
+    static constexpr char label_end = '\x02';
+    static constexpr char first_mark = '\x03';
+    bool m_shard = false;
+    int m_first_line = -1; // line of the first `%line` directive of a shard
+    std::optional<Diagnostic> m_error{}; // first error of a shard, reported once the shards before it are written
+    bool m_index_checks = false; // the runtime error for an index out of bounds is needed
+    bool m_vectorized = false; // the CPU feature check is needed
+    bool m_parallel = false; // the thread runtime is needed
+    // while generating the body of a parallel loop, which runs on every thread: the slots below this belong to the
+    // thread that started the loop and are reached through r15, which holds its rbp
+    std::optional<size_t> m_parallel_frame{};
+    std::optional<size_t> m_parallel_counter{}; // slot of the private copy of the loop counter
+    const NodeStmtAssign *m_parallel_increment = nullptr; // the `i = i + 1` ending the body, the only one assigning it
+
+    // what is known about a function before any code is generated, see analyze_functions
+    struct Function {
+        const NodeStmtFn *fn;
+        size_t size = 0; // statements and expression nodes of the body
+        std::vector<std::string> callees; // once per call in the body
+        size_t calls = 0; // in the whole program
+        bool recursive = false; // calls itself, directly or through the functions it calls
+        bool effects = false; // prints, exits or runs a parallel loop, directly or through the functions it calls
+        bool inlined = false; // every call is replaced with the body and there is no routine
+    };
+    std::shared_ptr<const std::unordered_map<std::string, Function>> m_functions{};
+    // the function whose body is being generated, either as its routine or inlined at a call
+    struct FunctionFrame {
+        const NodeStmtFn *fn;
+        bool parallel; // inlined in the body of a parallel loop
+        std::optional<std::string> end_label{}; // inlined: where a return jumps to with the result in rax
+        std::string body_label{}; // routine: right after the parameters, where a self tail call jumps to
+    };
+    std::optional<FunctionFrame> m_function{};
+
     void push(const std::string &reg) {
         m_output << "    push " << reg << "\n";
-        m_stack_size++;
     }
 
     void pop(const std::string &reg) {
         m_output << "    pop " << reg << "\n";
-        m_stack_size--;
     }
 
     void begin_scope(const std::string scopeLabel) {
@@ -36,28 +126,1363 @@ private:
     }
 
     void end_scope() {
-        // find out how many elements to pop whose scope has expired
-        int pop_count = m_vars.size() - m_scopes.back();
+        // the variables whose scope has expired give their slots back, nothing is popped
         m_output << "    ; scope ended\n";
-
-        // increment the location of stack pointer to previous scope location
-        m_output << "    add rsp, " << pop_count * 8 << "\n";
-        m_stack_size -= pop_count; // decrease the stack size,
-        for (int i = 0; i < pop_count; i++) {
-            m_vars.pop_back(); // pop all the variables which are expired
+        while (m_vars.size() > m_scopes.back()) {
+            release(m_vars.back());
+            m_vars.pop_back();
         }
         m_scopes.pop_back();
     }
 
+    // the lowest slots that aren't live and fit length
+    size_t allocate(size_t length) {
+        size_t slot = m_frame_base;
+        auto it = m_live.begin();
+        for (; it != m_live.end() && it->first < slot + length; ++it) {
+            slot = std::max(slot, it->second);
+        }
+        m_live.insert(it, {slot, slot + length});
+        m_frame_size = std::max(m_frame_size, slot + length);
+        return slot;
+    }
+
+    void release(Var &var) {
+        if (var.dead) {
+            return;
+        }
+        var.dead = true;
+        std::erase_if(m_live, [&](const auto &live) {
+            return live.first == var.slot;
+        });
+    }
+
+    // a variable of the innermost scope, which is freed after the last statement of its list that mentions it
+    Var &declare(const std::string &name, std::optional<size_t> length = {}) {
+        m_vars.push_back({.name = name, .slot = allocate(length.value_or(1)), .length = length});
+        if (!m_lists.empty() && m_lists.back().depth == m_scopes.size()) {
+            StmtList &list = m_lists.back();
+            auto it = list.last_uses->find(name);
+            const size_t last = it != list.last_uses->end() ? std::max(it->second, list.index) : list.index;
+            list.releases.emplace_back(last, m_vars.size() - 1);
+            std::ranges::push_heap(list.releases, std::greater{});
+        }
+        return m_vars.back();
+    }
+
+    // frees the variables of the innermost list that no statement after the current one mentions
+    void release_dead() {
+        StmtList &list = m_lists.back();
+        while (!list.releases.empty() && list.releases.front().first <= list.index) {
+            std::ranges::pop_heap(list.releases, std::greater{});
+            release(m_vars[list.releases.back().second]);
+            list.releases.pop_back();
+        }
+    }
+
     std::string create_label(const std::string labelName) {
         std::stringstream ss;
-        ss << labelName << m_label_count++;
+        if (m_shard) {
+            ss << labelName << label_begin << m_label_count++ << label_end;
+        } else {
+            ss << labelName << m_label_count++;
+        }
+        if (m_options.debug_source.has_value() && m_line > 0) {
+            ss << "_line" << m_line; // shows up in the symbol table, so profiles name the source line of the block
+        }
         return ss.str();
     }
 
+    // attributes the following instructions to the given source line
+    void mark_line(int line) {
+        if (!m_options.debug_source.has_value() || line <= 0 || line == m_marked_line) {
+            return;
+        }
+        if (m_marked_line < 0) {
+            m_output << first_mark; // a shard doesn't know the line before it yet
+            m_first_line = line;
+        }
+        m_output << "%line " << line << "+0 " << m_options.debug_source.value() << "\n";
+        m_marked_line = line;
+    }
+
+    // counts that node ran when instrumenting
+    void count(const void *node) {
+        if (!m_options.instrument.has_value()) {
+            return;
+        }
+        if (auto it = m_sites->ids.find(node); it != m_sites->ids.end()) {
+            // the body of a parallel loop runs on several threads at once
+            m_output << (m_parallel_frame.has_value() ? "    lock inc" : "    inc") << " qword [flitCounters + "
+                     << it->second * 8 << "]\n";
+        }
+    }
+
+    // how often the profile says node ran
+    [[nodiscard]] uint64_t profiled(const void *node) const {
+        if (!m_options.profile.has_value()) {
+            return 0;
+        }
+        auto it = m_sites->ids.find(node);
+        return it != m_sites->ids.end() ? m_options.profile->counts[it->second] : 0;
+    }
+
+    // an arm that ran in less than 1 of 16 executions of its statement goes out of line. Code that is already out of
+    // line stays together
+    [[nodiscard]] bool is_cold(const NodeScope *arm, const void *stmt) const {
+        const uint64_t runs = profiled(stmt);
+        return !m_in_cold && runs > 0 && profiled(arm) * 16 < runs;
+    }
+
+    // generates a block out of line, after the code of the program, where it doesn't take space in the hot path
+    void gen_cold(const std::function<void()> &gen_block) {
+        const int marked_line = m_marked_line;
+        std::swap(m_output, m_cold);
+        m_in_cold = true;
+        m_marked_line = 0; // the assembler is at whatever line the last cold block ended on
+        mark_line(m_line);
+        gen_block();
+        m_in_cold = false;
+        std::swap(m_output, m_cold);
+        m_marked_line = marked_line;
+    }
+
+    static const NodeExpr *skip_parens(const NodeExpr *expr) {
+        while (true) {
+            auto term = std::get_if<NodeTerm *>(&expr->var);
+            if (term == nullptr || !std::holds_alternative<NodeTermParen *>((*term)->var)) {
+                return expr;
+            }
+            expr = std::get<NodeTermParen *>((*term)->var)->expr;
+        }
+    }
+
+    static std::optional<uint64_t> literal_value(const NodeExpr *expr) {
+        auto term = std::get_if<NodeTerm *>(&skip_parens(expr)->var);
+        if (term == nullptr || !std::holds_alternative<NodeTermIntLit *>((*term)->var)) {
+            return {};
+        }
+        const std::string &lit = std::get<NodeTermIntLit *>((*term)->var)->int_lit.value.value();
+        uint64_t value;
+        if (std::from_chars(lit.data(), lit.data() + lit.size(), value).ec != std::errc()) {
+            return {};
+        }
+        return value;
+    }
+
+    struct Arm {
+        const NodeExpr *expr; // nullptr for else
+        const NodeScope *scope;
+        int line;
+        const char *scope_label;
+    };
+
+    // the arms of an if statement in source order
+    [[nodiscard]] std::vector<Arm> if_arms(const NodeStmtIf *stmt_if) const {
+        std::vector<Arm> arms{{stmt_if->expr, stmt_if->scope, m_line, "scopeLabel"}};
+        for (std::optional<NodeIfPred *> pred = stmt_if->pred; pred.has_value();) {
+            if (auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                arms.push_back({(*elif)->expr, (*elif)->scope, (*elif)->line, "scopeElif"});
+                pred = (*elif)->pred;
+            } else {
+                arms.push_back({nullptr, std::get<NodeIfPredElse *>(pred.value()->var)->scope, m_line, "scopeElse"});
+                pred = {};
+            }
+        }
+        return arms;
+    }
+
+    // the variable and the constant of a `variable == constant` test (either way around), which can't fault
+    static std::optional<std::pair<const NodeExpr *, uint64_t>> constant_test(const NodeExpr *expr) {
+        auto bin_expr = std::get_if<NodeBinExpr *>(&skip_parens(expr)->var);
+        if (bin_expr == nullptr || !std::holds_alternative<NodeBinExprEq *>((*bin_expr)->var)) {
+            return {};
+        }
+        const NodeBinExprEq *eq = std::get<NodeBinExprEq *>((*bin_expr)->var);
+        for (auto [ident_side, literal_side]: {std::pair{eq->lhs, eq->rhs}, std::pair{eq->rhs, eq->lhs}}) {
+            auto term = std::get_if<NodeTerm *>(&skip_parens(ident_side)->var);
+            auto value = literal_value(literal_side);
+            if (term != nullptr && std::holds_alternative<NodeTermIdent *>((*term)->var) && value.has_value()) {
+                return std::pair{skip_parens(ident_side), value.value()};
+            }
+        }
+        return {};
+    }
+
+    static const std::string &ident_name(const NodeExpr *var) {
+        return std::get<NodeTermIdent *>(std::get<NodeTerm *>(var->var)->var)->ident.value.value();
+    }
+
+    // the tests of an if/elif chain that compare the same variable with different constants. They can't fault and at
+    // most one of them passes, so they can be checked in any order
+    struct ConstantChain {
+        const NodeExpr *var;
+        std::vector<uint64_t> constants; // of every arm but the else
+    };
+
+    static std::optional<ConstantChain> constant_chain(const std::vector<Arm> &arms) {
+        ConstantChain chain{};
+        for (const Arm &arm: arms) {
+            if (arm.expr == nullptr) {
+                break;
+            }
+            auto test = constant_test(arm.expr);
+            if (!test.has_value() || (chain.var != nullptr && ident_name(chain.var) != ident_name(test->first)) ||
+                std::ranges::find(chain.constants, test->second) != chain.constants.end()) {
+                return {};
+            }
+            chain.var = test->first;
+            chain.constants.push_back(test->second);
+        }
+        return chain;
+    }
+
+    // cmp of rax with a constant, which only fits the instruction as a 32 bit immediate
+    void gen_compare_constant(uint64_t value) {
+        if (value > 0x7fffffff) {
+            m_output << "    mov rbx, " << value << "\n";
+            m_output << "    cmp rax, rbx\n";
+        } else {
+            m_output << "    cmp rax, " << value << "\n";
+        }
+    }
+
+    // a chain of at least this many constant tests is dispatched with a jump table or a compare tree
+    static constexpr size_t switch_min_tests = 4;
+
+    // dispatches a constant chain in one step with a jump table when the constants are dense (the table has less
+    // than 3 entries per arm), otherwise with a balanced tree of compares, instead of testing the arms in turn
+    void gen_switch(const std::vector<Arm> &arms, const ConstantChain &chain) {
+        const int outer_line = m_line;
+        const std::string end_label = create_label("ifEndLabel");
+        std::vector<std::string> labels;
+        for (const Arm &arm: arms) {
+            labels.push_back(create_label(arm.scope_label));
+        }
+        const std::string &default_label = arms.back().expr == nullptr ? labels.back() : end_label;
+
+        std::vector<std::pair<uint64_t, size_t>> cases; // constant and arm, by constant
+        for (size_t i = 0; i < chain.constants.size(); i++) {
+            cases.emplace_back(chain.constants[i], i);
+        }
+        std::ranges::sort(cases);
+
+        gen_expr(chain.var);
+        pop("rax");
+        const uint64_t low = cases.front().first;
+        const uint64_t span = cases.back().first - low;
+        if (span < cases.size() * 3) {
+            const std::string table_label = create_label("switchTable");
+            if (low > 0x7fffffff) {
+                m_output << "    mov rbx, " << low << "\n";
+                m_output << "    sub rax, rbx\n";
+            } else if (low != 0) {
+                m_output << "    sub rax, " << low << "\n";
+            }
+            m_output << "    cmp rax, " << span << "\n";
+            m_output << "    ja " << default_label << "\n";
+            m_output << "    jmp qword [" << table_label << " + rax*8]\n";
+
+            // read-only, so that no stray store can redirect the jump
+            m_rodata << "    align 8\n";
+            m_rodata << table_label << ":";
+            auto next_case = cases.begin();
+            for (uint64_t offset = 0; offset <= span; offset++) {
+                const bool is_case = next_case->first - low == offset;
+                m_rodata << (offset % 4 == 0 ? "\n    dq " : ", ");
+                m_rodata << (is_case ? labels[next_case->second] : default_label);
+                next_case += is_case;
+            }
+            m_rodata << "\n";
+        } else {
+            // binary search, every range ends up at the arm of its constant or at the default
+            struct Range {
+                size_t begin;
+                size_t end;
+                std::string label;
+            };
+            std::vector<Range> ranges{{0, cases.size(), ""}};
+            while (!ranges.empty()) {
+                const Range range = std::move(ranges.back());
+                ranges.pop_back();
+                if (!range.label.empty()) {
+                    m_output << range.label << ":\n";
+                }
+                if (range.end - range.begin <= 3) {
+                    for (size_t i = range.begin; i < range.end; i++) {
+                        gen_compare_constant(cases[i].first);
+                        m_output << "    je " << labels[cases[i].second] << "\n";
+                    }
+                    m_output << "    jmp " << default_label << "\n";
+                    continue;
+                }
+                const size_t mid = range.begin + (range.end - range.begin) / 2;
+                const std::string above_label = create_label("switchAbove");
+                gen_compare_constant(cases[mid].first);
+                m_output << "    je " << labels[cases[mid].second] << "\n";
+                m_output << "    ja " << above_label << "\n";
+                ranges.push_back({mid + 1, range.end, above_label});
+                ranges.push_back({range.begin, mid, ""});
+            }
+        }
+
+        for (size_t i = 0; i < arms.size(); i++) {
+            m_line = arms[i].line;
+            mark_line(m_line);
+            gen_scope(arms[i].scope, labels[i]);
+            if (i + 1 < arms.size()) {
+                m_output << "    jmp " << end_label << "\n";
+            }
+        }
+        m_line = outer_line;
+        m_output << end_label << ":\n";
+    }
+
+    // the if/elif/else chain laid out by the profile: an arm that is cold is entered with a jump out of line
+    // when its test passes, so the hot arms are reached by falling through
+    void gen_if_by_profile(std::vector<Arm> arms, const NodeStmtIf *stmt_if) {
+        // the arms of a constant chain that ran the most are tested first
+        if (auto chain = constant_chain(arms)) {
+            const auto tests = static_cast<std::ptrdiff_t>(chain->constants.size());
+            std::stable_sort(arms.begin(), arms.begin() + tests, [&](const Arm &a, const Arm &b) {
+                return profiled(a.scope) > profiled(b.scope);
+            });
+        }
+
+        const int outer_line = m_line;
+        const std::string end_label = create_label("ifEndLabel");
+        std::vector<std::string> cold_labels(arms.size());
+        for (size_t i = 0; i < arms.size(); i++) {
+            if (is_cold(arms[i].scope, stmt_if)) {
+                cold_labels[i] = create_label("coldArm");
+            }
+        }
+        // a cold else is jumped to directly by the failed test before it
+        const bool cold_else = arms.back().expr == nullptr && !cold_labels.back().empty();
+
+        for (size_t i = 0; i < arms.size(); i++) {
+            const Arm &arm = arms[i];
+            m_line = arm.line;
+            mark_line(m_line);
+            const bool last_in_line = i + 1 == arms.size() || (i + 2 == arms.size() && cold_else);
+            if (!cold_labels[i].empty()) {
+                if (arm.expr != nullptr) {
+                    gen_branch(arm.expr, cold_labels[i], true);
+                } else if (i == 0 || !cold_labels[i - 1].empty()) {
+                    m_output << "    jmp " << cold_labels[i] << "\n";
+                }
+                gen_cold([&]() {
+                    m_output << cold_labels[i] << ":\n";
+                    gen_scope(arm.scope, create_label(arm.scope_label));
+                    m_output << "    jmp " << end_label << "\n";
+                });
+                continue;
+            }
+
+            if (arm.expr == nullptr) {
+                gen_scope(arm.scope, create_label(arm.scope_label));
+                continue;
+            }
+            const std::string next_label = last_in_line && cold_else ? cold_labels.back() : create_label("ifNextLabel");
+            gen_branch(arm.expr, next_label, false);
+            gen_scope(arm.scope, create_label(arm.scope_label));
+            if (!last_in_line) {
+                m_output << "    jmp " << end_label << "\n";
+                m_output << next_label << ":\n";
+            } else if (!cold_else) {
+                m_output << next_label << ":\n";
+            }
+        }
+        m_line = outer_line;
+        m_output << end_label << ":\n";
+    }
+
+    // arrays live on the stack, which is 8mb by default
+    static constexpr size_t max_array_length = 1 << 19;
+
+    static std::optional<size_t> array_length(const NodeStmtLetArray *stmt_let_array) {
+        const std::string &size = stmt_let_array->size.value.value();
+        size_t length;
+        if (std::from_chars(size.data(), size.data() + size.size(), length).ec != std::errc() || length == 0 ||
+            length > max_array_length) {
+            return {};
+        }
+        return length;
+    }
+
+    // the variable or array with the given name, nullptr when it isn't declared. The body of a parallel loop has
+    // private copies of some variables of the thread that started it, which are found first
+    [[nodiscard]] const Var *find_var(const std::string &name) const {
+        auto it = std::ranges::find_if(m_vars.crbegin(), m_vars.crend(), [&](const Var &var) {
+            return var.name == name;
+        });
+        return it != m_vars.crend() ? &*it : nullptr;
+    }
+
+    [[nodiscard]] bool is_shared(const Var &var) const {
+        return m_parallel_frame.has_value() && var.slot < m_parallel_frame.value();
+    }
+
+    // memory operand of a variable, or of an array element offset bytes after element 0 plus index*8
+    [[nodiscard]] std::string address(const Var &var, size_t offset = 0, const std::string &index = "") const {
+        const size_t base = is_shared(var) ? 0 : m_frame_base;
+        const size_t below = (var.slot - base + var.length.value_or(1)) * 8 - offset;
+        std::string addr = (is_shared(var) ? "[r15 - " : "[rbp - ") + std::to_string(below);
+        if (!index.empty()) {
+            addr += " + " + index + "*8";
+        }
+        return addr + "]";
+    }
+
+    // the array named by ident, or nullptr after reporting why there is none
+    const Var *find_array(const Token &ident) {
+        const Var *array = find_var(ident.value.value());
+        if (array == nullptr) {
+            error("Undeclared Identifier " + ident.value.value());
+        } else if (!array->length.has_value()) {
+            error("Not an array: " + ident.value.value());
+            return nullptr;
+        }
+        return array;
+    }
+
+    // the index is in rax, the program stops with an error when it is outside the array
+    void gen_bounds_check(const Var &array) {
+        m_output << "    cmp rax, " << array.length.value() << "\n";
+        m_output << "    jae _flitIndexError\n";
+        m_index_checks = true;
+    }
+
+    // a constant index that is inside the array doesn't need a check
+    static std::optional<uint64_t> checked_index(const NodeExpr *index, const Var &array) {
+        auto value = literal_value(index);
+        if (!value.has_value() || value.value() >= array.length.value()) {
+            return {};
+        }
+        return value;
+    }
+
+    // `while (i < n) { ...; i = i + 1; }` where every other statement is `a[i] = e;` or `s = s + e;`, and e only uses
+    // elements at i, literals and variables the loop doesn't assign, with `+`, `-` and `*`. Every iteration only
+    // touches element i, so the statements can run on several elements at once one after another
+    struct VectorLoop {
+        const Var *counter;
+        const NodeExpr *bound; // literal, variable or length
+        struct Step {
+            const Var *target; // array stored to, or variable summed into
+            const NodeExpr *expr;
+            bool reduction;
+        };
+        std::vector<Step> steps;
+        size_t length; // of the shortest array the loop uses, the vector loop stops there
+        size_t slots = 0; // vector registers the expressions need at most
+    };
+
+    // vector registers: 0 and 1 are scratch, expressions are evaluated from 2 up and reductions sum into 15 down
+    static constexpr size_t vector_first_slot = 2;
+    static constexpr size_t vector_registers = 16;
+
+    [[nodiscard]] const Var *scalar_var(const NodeExpr *expr) const {
+        auto term = std::get_if<NodeTerm *>(&skip_parens(expr)->var);
+        if (term == nullptr || !std::holds_alternative<NodeTermIdent *>((*term)->var)) {
+            return nullptr;
+        }
+        const Var *var = find_var(std::get<NodeTermIdent *>((*term)->var)->ident.value.value());
+        return var != nullptr && !var->length.has_value() ? var : nullptr;
+    }
+
+    // the other operand of `var + expr` or `expr + var`
+    [[nodiscard]] const NodeExpr *added_to(const NodeExpr *expr, const Var *var) const {
+        auto bin_expr = std::get_if<NodeBinExpr *>(&skip_parens(expr)->var);
+        if (bin_expr == nullptr || !std::holds_alternative<NodeBinExprAdd *>((*bin_expr)->var)) {
+            return nullptr;
+        }
+        const NodeBinExprAdd *add = std::get<NodeBinExprAdd *>((*bin_expr)->var);
+        if (scalar_var(add->lhs) == var) {
+            return add->rhs;
+        }
+        return scalar_var(add->rhs) == var ? add->lhs : nullptr;
+    }
+
+    // whether expr can be evaluated on vectors, the shortest array it reads and the registers it needs go into loop
+    bool vectorizable(const NodeExpr *expr, const std::vector<const Var *> &assigned, VectorLoop &loop) const {
+        std::vector<std::pair<const NodeExpr *, size_t>> pending{{expr, 0}};
+        while (!pending.empty()) {
+            const auto [curr, slot] = pending.back();
+            pending.pop_back();
+            loop.slots = std::max(loop.slots, slot + 1);
+
+            if (auto bin_expr = std::get_if<NodeBinExpr *>(&curr->var)) {
+                if (!std::holds_alternative<NodeBinExprAdd *>((*bin_expr)->var) &&
+                    !std::holds_alternative<NodeBinExprMinus *>((*bin_expr)->var) &&
+                    !std::holds_alternative<NodeBinExprMulti *>((*bin_expr)->var)) {
+                    return false;
+                }
+                std::visit([&](const auto *bin) {
+                    pending.emplace_back(bin->rhs, slot + 1);
+                    pending.emplace_back(bin->lhs, slot);
+                }, (*bin_expr)->var);
+                continue;
+            }
+            const NodeTerm *term = std::get<NodeTerm *>(curr->var);
+            if (auto term_paren = std::get_if<NodeTermParen *>(&term->var)) {
+                pending.emplace_back((*term_paren)->expr, slot);
+            } else if (std::holds_alternative<NodeTermIntLit *>(term->var)) {
+                if (!literal_value(curr).has_value()) {
+                    return false;
+                }
+            } else if (std::holds_alternative<NodeTermIdent *>(term->var)) {
+                const Var *var = scalar_var(curr);
+                if (var == nullptr || std::ranges::find(assigned, var) != assigned.end()) {
+                    return false;
+                }
+            } else if (auto term_index = std::get_if<NodeTermIndex *>(&term->var)) {
+                const Var *array = find_var((*term_index)->ident.value.value());
+                if (array == nullptr || !array->length.has_value() || scalar_var((*term_index)->index) != loop.counter) {
+                    return false;
+                }
+                loop.length = std::min(loop.length, array->length.value());
+            } else if (auto term_len = std::get_if<NodeTermLen *>(&term->var)) {
+                const Var *array = find_var((*term_len)->ident.value.value());
+                if (array == nullptr || !array->length.has_value()) {
+                    return false;
+                }
+            } else {
+                return false; // calls
+            }
+        }
+        return true;
+    }
+
+    [[nodiscard]] std::optional<VectorLoop> vector_loop(const NodeStmtWhile *stmt_while) const {
+        auto cond = std::get_if<NodeBinExpr *>(&skip_parens(stmt_while->expr)->var);
+        if (cond == nullptr || !std::holds_alternative<NodeBinExprLess *>((*cond)->var)) {
+            return {};
+        }
+        const NodeBinExprLess *less = std::get<NodeBinExprLess *>((*cond)->var);
+        VectorLoop loop{.counter = scalar_var(less->lhs), .bound = less->rhs, .steps = {}, .length = max_array_length};
+        const std::vector<NodeStmt *> &stmts = stmt_while->scope->stmts;
+        if (loop.counter == nullptr || stmts.size() < 2) {
+            return {};
+        }
+
+        auto increment = std::get_if<NodeStmtAssign *>(&stmts.back()->var);
+        if (increment == nullptr || find_var((*increment)->ident.value.value()) != loop.counter) {
+            return {};
+        }
+        const NodeExpr *step = added_to((*increment)->expr, loop.counter);
+        if (step == nullptr || literal_value(step) != 1u) {
+            return {};
+        }
+
+        std::vector<const Var *> assigned{loop.counter};
+        for (size_t i = 0; i + 1 < stmts.size(); i++) {
+            if (auto assign_index = std::get_if<NodeStmtAssignIndex *>(&stmts[i]->var)) {
+                const Var *array = find_var((*assign_index)->ident.value.value());
+                if (array == nullptr || !array->length.has_value() ||
+                    scalar_var((*assign_index)->index) != loop.counter) {
+                    return {};
+                }
+                loop.length = std::min(loop.length, array->length.value());
+                loop.steps.push_back({array, (*assign_index)->expr, false});
+            } else if (auto stmt_assign = std::get_if<NodeStmtAssign *>(&stmts[i]->var)) {
+                const Var *sum = find_var((*stmt_assign)->ident.value.value());
+                const NodeExpr *expr = sum != nullptr ? added_to((*stmt_assign)->expr, sum) : nullptr;
+                if (expr == nullptr || sum == loop.counter) {
+                    return {};
+                }
+                assigned.push_back(sum);
+                loop.steps.push_back({sum, expr, true});
+            } else {
+                return {};
+            }
+        }
+
+        // the bound is checked every iteration, so it has to stay the same
+        auto bound_term = std::get_if<NodeTerm *>(&skip_parens(loop.bound)->var);
+        const Var *bound_var = scalar_var(loop.bound);
+        auto bound_len = bound_term != nullptr ? std::get_if<NodeTermLen *>(&(*bound_term)->var) : nullptr;
+        const Var *bound_array = bound_len != nullptr ? find_var((*bound_len)->ident.value.value()) : nullptr;
+        if (!literal_value(loop.bound).has_value() &&
+            (bound_var == nullptr || std::ranges::find(assigned, bound_var) != assigned.end()) &&
+            (bound_array == nullptr || !bound_array->length.has_value())) {
+            return {};
+        }
+        for (const VectorLoop::Step &loop_step: loop.steps) {
+            if (!vectorizable(loop_step.expr, assigned, loop)) {
+                return {};
+            }
+        }
+        const size_t reductions = std::ranges::count_if(loop.steps, [](const VectorLoop::Step &loop_step) {
+            return loop_step.reduction;
+        });
+        if (vector_first_slot + loop.slots + reductions > vector_registers) {
+            return {};
+        }
+        return loop;
+    }
+
+    // SSE2 is part of x86-64, AVX2 has to be checked for when the program runs
+    struct VectorIsa {
+        size_t lanes;
+        bool avx2;
+
+        [[nodiscard]] std::string reg(size_t index) const {
+            return (avx2 ? "ymm" : "xmm") + std::to_string(index);
+        }
+    };
+
+    // loads a literal, variable or length into a general purpose register
+    void gen_scalar_load(const std::string &reg, const NodeExpr *expr) {
+        const NodeTerm *term = std::get<NodeTerm *>(skip_parens(expr)->var);
+        if (auto term_len = std::get_if<NodeTermLen *>(&term->var)) {
+            m_output << "    mov " << reg << ", " << find_var((*term_len)->ident.value.value())->length.value() << "\n";
+        } else if (const Var *var = scalar_var(expr)) {
+            m_output << "    mov " << reg << ", " << address(*var) << "\n";
+        } else {
+            m_output << "    mov " << reg << ", " << literal_value(expr).value() << "\n";
+        }
+    }
+
+    // evaluates expr for the elements at r8 and the ones after it into register slot, the same way vectorizable walked it
+    void gen_vector_expr(const NodeExpr *expr, const VectorIsa &isa) {
+        // the state of a frame is the register slot its value goes to
+        passes::walk_post_order(expr, vector_first_slot, [&](const auto &frame, auto &frames) {
+            const std::string dst = isa.reg(frame.state);
+
+            if (auto term = std::get_if<NodeTerm *>(&frame.expr->var)) {
+                if (auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+                    frames.push_back({(*term_paren)->expr, false, frame.state});
+                } else if (auto term_index = std::get_if<NodeTermIndex *>(&(*term)->var)) {
+                    const Var *array = find_var((*term_index)->ident.value.value());
+                    m_output << "    " << (isa.avx2 ? "vmovdqu " : "movdqu ") << dst << ", " << address(*array, 0, "r8") << "\n";
+                } else {
+                    // the same value in every lane
+                    gen_scalar_load("rax", frame.expr);
+                    const std::string low = "xmm" + std::to_string(frame.state);
+                    if (isa.avx2) {
+                        m_output << "    vmovq " << low << ", rax\n";
+                        m_output << "    vpbroadcastq " << dst << ", " << low << "\n";
+                    } else {
+                        m_output << "    movq " << dst << ", rax\n";
+                        m_output << "    punpcklqdq " << dst << ", " << dst << "\n";
+                    }
+                }
+                return;
+            }
+
+            const NodeBinExpr *bin_expr = std::get<NodeBinExpr *>(frame.expr->var);
+            if (!frame.operands_done) {
+                frames.push_back({frame.expr, true, frame.state});
+                std::visit([&](const auto *bin) {
+                    frames.push_back({bin->rhs, false, frame.state + 1});
+                    frames.push_back({bin->lhs, false, frame.state});
+                }, bin_expr->var);
+                return;
+            }
+
+            const std::string rhs = isa.reg(frame.state + 1);
+            if (!std::holds_alternative<NodeBinExprMulti *>(bin_expr->var)) {
+                const char *op = std::holds_alternative<NodeBinExprAdd *>(bin_expr->var) ? "paddq" : "psubq";
+                if (isa.avx2) {
+                    m_output << "    v" << op << " " << dst << ", " << dst << ", " << rhs << "\n";
+                } else {
+                    m_output << "    " << op << " " << dst << ", " << rhs << "\n";
+                }
+                return;
+            }
+            // there is no 64 bit multiply before AVX-512, so it is put together from 32 bit halves:
+            // lo(a) * lo(b) + ((hi(a) * lo(b) + lo(a) * hi(b)) << 32)
+            const std::string t0 = isa.reg(0);
+            const std::string t1 = isa.reg(1);
+            if (isa.avx2) {
+                m_output << "    vpmuludq " << t0 << ", " << dst << ", " << rhs << "\n";
+                m_output << "    vpsrlq " << t1 << ", " << dst << ", 32\n";
+                m_output << "    vpmuludq " << t1 << ", " << t1 << ", " << rhs << "\n";
+                m_output << "    vpsrlq " << rhs << ", " << rhs << ", 32\n";
+                m_output << "    vpmuludq " << rhs << ", " << rhs << ", " << dst << "\n";
+                m_output << "    vpaddq " << rhs << ", " << rhs << ", " << t1 << "\n";
+                m_output << "    vpsllq " << rhs << ", " << rhs << ", 32\n";
+                m_output << "    vpaddq " << dst << ", " << rhs << ", " << t0 << "\n";
+            } else {
+                m_output << "    movdqa " << t0 << ", " << dst << "\n";
+                m_output << "    pmuludq " << t0 << ", " << rhs << "\n";
+                m_output << "    movdqa " << t1 << ", " << dst << "\n";
+                m_output << "    psrlq " << t1 << ", 32\n";
+                m_output << "    pmuludq " << t1 << ", " << rhs << "\n";
+                m_output << "    psrlq " << rhs << ", 32\n";
+                m_output << "    pmuludq " << rhs << ", " << dst << "\n";
+                m_output << "    paddq " << rhs << ", " << t1 << "\n";
+                m_output << "    psllq " << rhs << ", 32\n";
+                m_output << "    paddq " << rhs << ", " << t0 << "\n";
+                m_output << "    movdqa " << dst << ", " << rhs << "\n";
+            }
+        });
+    }
+
+    // runs the loop isa.lanes iterations at a time while that many are left before r9, the counter is in r8
+    void gen_vector_body(const VectorLoop &loop, const VectorIsa &isa) {
+        const std::string body_label = create_label("vectorBody");
+        const std::string test_label = create_label("vectorTest");
+        const std::string done_label = create_label("vectorDone");
+        const char *v = isa.avx2 ? "v" : "";
+
+        std::vector<std::pair<const Var *, std::string>> sums;
+        for (const VectorLoop::Step &step: loop.steps) {
+            if (step.reduction) {
+                const std::string acc = isa.reg(vector_registers - 1 - sums.size());
+                sums.emplace_back(step.target, acc);
+                m_output << "    " << v << "pxor " << acc << ", " << acc << (isa.avx2 ? ", " + acc : "") << "\n";
+            }
+        }
+        m_output << "    cmp r9, " << isa.lanes << "\n";
+        m_output << "    jb " << done_label << "\n";
+        m_output << "    lea r10, [r9 - " << isa.lanes << "]\n"; // the last counter a whole vector starts at
+        m_output << "    jmp " << test_label << "\n";
+        m_output << "    align 16\n";
+        m_output << body_label << ":\n";
+
+        size_t sum = 0;
+        for (const VectorLoop::Step &step: loop.steps) {
+            gen_vector_expr(step.expr, isa);
+            const std::string value = isa.reg(vector_first_slot);
+            if (!step.reduction) {
+                m_output << "    " << v << "movdqu " << address(*step.target, 0, "r8") << ", " << value << "\n";
+                continue;
+            }
+            const std::string &acc = sums[sum++].second;
+            m_output << "    " << v << "paddq " << acc << ", " << (isa.avx2 ? acc + ", " : "") << value << "\n";
+        }
+        m_output << "    add r8, " << isa.lanes << "\n";
+        m_output << test_label << ":\n";
+        m_output << "    cmp r8, r10\n";
+        m_output << "    jbe " << body_label << "\n";
+        m_output << done_label << ":\n";
+
+        // the lanes of every sum are added up and then to the variable
+        for (const auto &[var, acc]: sums) {
+            const std::string low = "xmm" + acc.substr(3);
+            if (isa.avx2) {
+                m_output << "    vextracti128 xmm0, " << acc << ", 1\n";
+                m_output << "    vpaddq xmm0, xmm0, " << low << "\n";
+                m_output << "    vpshufd xmm1, xmm0, 0x4e\n";
+                m_output << "    vpaddq xmm0, xmm0, xmm1\n";
+                m_output << "    vmovq rax, xmm0\n";
+            } else {
+                m_output << "    pshufd xmm0, " << acc << ", 0x4e\n";
+                m_output << "    paddq xmm0, " << acc << "\n";
+                m_output << "    movq rax, xmm0\n";
+            }
+            m_output << "    add " << address(*var) << ", rax\n";
+        }
+        if (isa.avx2) {
+            m_output << "    vzeroupper\n"; // SSE code after it would be slow with the upper halves in use
+        }
+    }
+
+    // runs as much of the loop as it can with vector instructions, the loop generated after it does the rest
+    void gen_vector_loop(const VectorLoop &loop) {
+        m_vectorized = true;
+        const std::string known_label = create_label("cpuKnown");
+        const std::string sse_label = create_label("vectorSse");
+        const std::string end_label = create_label("vectorEnd");
+
+        m_output << "    ; vectorized loop, the scalar loop after it runs the iterations that are left\n";
+        m_output << "    mov r8, " << address(*loop.counter) << "\n";
+        gen_scalar_load("r9", loop.bound);
+        // elements past the shortest array are left to the scalar loop, which reports the index out of bounds
+        m_output << "    mov rax, " << loop.length << "\n";
+        m_output << "    cmp r9, rax\n";
+        m_output << "    cmova r9, rax\n";
+
+        m_output << "    movzx eax, byte [flitCpuLevel]\n";
+        m_output << "    test eax, eax\n";
+        m_output << "    jnz " << known_label << "\n";
+        m_output << "    call _flitDetectCpu\n";
+        m_output << known_label << ":\n";
+        m_output << "    cmp eax, 2\n";
+        m_output << "    jb " << sse_label << "\n";
+        gen_vector_body(loop, {.lanes = 4, .avx2 = true});
+        m_output << "    jmp " << end_label << "\n";
+        m_output << sse_label << ":\n";
+        gen_vector_body(loop, {.lanes = 2, .avx2 = false});
+        m_output << end_label << ":\n";
+        m_output << "    mov " << address(*loop.counter) << ", r8\n";
+    }
+
+    // the name of the private end of the chunk a thread is running, it isn't an identifier so programs can't use it
+    static constexpr const char *chunk_end_name = "chunk end";
+
+    // `parallel while (i < n) { ...; i = i + 1; }`: the range [i, n) is split into chunks the threads claim one after
+    // another until none are left, see genParallel. The body is a routine every thread calls. The variables it doesn't
+    // declare stay in the frame of the thread that started the loop and are reached through r15, except the counter
+    // and the reduction variables, which get a private copy per thread that starts out as the identity of the reduction
+    void gen_parallel(const NodeStmtParallel *stmt_parallel) {
+        if (m_parallel_frame.has_value()) {
+            error("Parallel loops can't be nested");
+            return;
+        }
+        const std::string shape = "A parallel loop has to be `while (i < n) { ...; i = i + 1; }` with n not assigned in it";
+        const NodeStmtWhile *loop = stmt_parallel->loop;
+        auto cond = std::get_if<NodeBinExpr *>(&skip_parens(loop->expr)->var);
+        if (cond == nullptr || !std::holds_alternative<NodeBinExprLess *>((*cond)->var)) {
+            error(shape);
+            return;
+        }
+        const NodeBinExprLess *less = std::get<NodeBinExprLess *>((*cond)->var);
+        const Var *counter_var = scalar_var(less->lhs);
+        const std::vector<NodeStmt *> &stmts = loop->scope->stmts;
+        auto increment = stmts.empty() ? nullptr : std::get_if<NodeStmtAssign *>(&stmts.back()->var);
+        if (counter_var == nullptr || increment == nullptr || find_var((*increment)->ident.value.value()) != counter_var) {
+            error(shape);
+            return;
+        }
+        const NodeExpr *step = added_to((*increment)->expr, counter_var);
+        if (step == nullptr || literal_value(step) != 1u) {
+            error(shape);
+            return;
+        }
+        const Var counter = *counter_var;
+
+        std::vector<std::pair<NodeReduction::Op, Var>> reductions;
+        const auto assigned = [&](const Var *var) {
+            return var->slot == counter.slot || std::ranges::any_of(reductions, [&](const auto &reduction) {
+                return reduction.second.slot == var->slot;
+            });
+        };
+        for (const NodeReduction &reduction: stmt_parallel->reductions) {
+            const std::string &name = reduction.ident.value.value();
+            const Var *var = find_var(name);
+            if (var == nullptr) {
+                error("Undeclared Identifier: " + name);
+                return;
+            }
+            if (var->length.has_value()) {
+                error("Array used as a value: " + name);
+                return;
+            }
+            if (assigned(var)) {
+                error("Reduced twice or the loop counter: " + name);
+                return;
+            }
+            reductions.emplace_back(reduction.op, *var);
+        }
+
+        // the bound is evaluated once, so it can't read anything the loop assigns
+        std::vector<const NodeExpr *> pending{less->rhs};
+        while (!pending.empty()) {
+            const NodeExpr *curr = pending.back();
+            pending.pop_back();
+            if (auto bin_expr = std::get_if<NodeBinExpr *>(&curr->var)) {
+                std::visit([&](const auto *bin) {
+                    pending.push_back(bin->lhs);
+                    pending.push_back(bin->rhs);
+                }, (*bin_expr)->var);
+                continue;
+            }
+            const NodeTerm *term = std::get<NodeTerm *>(curr->var);
+            if (auto term_paren = std::get_if<NodeTermParen *>(&term->var)) {
+                pending.push_back((*term_paren)->expr);
+            } else if (std::holds_alternative<NodeTermIndex *>(term->var)) {
+                error(shape);
+                return;
+            } else if (auto term_ident = std::get_if<NodeTermIdent *>(&term->var)) {
+                const Var *var = find_var((*term_ident)->ident.value.value());
+                if (var != nullptr && assigned(var)) {
+                    error(shape);
+                    return;
+                }
+            } else if (auto term_call = std::get_if<NodeTermCall *>(&term->var)) {
+                pending.insert(pending.end(), (*term_call)->args.begin(), (*term_call)->args.end());
+            }
+        }
+
+        m_parallel = true;
+        const std::string body_label = create_label("parallelBody");
+        const std::string end_label = create_label("parallelEnd");
+        m_output << "    ; parallel loop, the counter ends up at the bound like after the sequential loop\n";
+        gen_expr(less->rhs);
+        pop("rax");
+        m_output << "    mov rbx, " << address(counter) << "\n";
+        m_output << "    cmp rbx, rax\n";
+        m_output << "    jae " << end_label << "\n";
+        m_output << "    mov [flitParStart], rbx\n";
+        m_output << "    mov [flitParEnd], rax\n";
+        m_output << "    mov " << address(counter) << ", rax\n";
+        m_output << "    mov r15, rbp\n";
+        m_output << "    mov rdi, " << body_label << "\n";
+        m_output << "    call _flitParallel\n";
+        m_output << "    jmp " << end_label << "\n";
+
+        // the body has a frame of its own on the stack of every thread, numbered after the slots of the starting thread
+        m_parallel_frame = m_frame_size;
+        std::vector<std::pair<size_t, size_t>> live = std::move(m_live);
+        const size_t frame_base = m_frame_base;
+        const size_t frame_size = m_frame_size;
+        m_live.clear();
+        m_frame_base = m_parallel_frame.value();
+        begin_scope(body_label);
+        const std::string frame_label = begin_frame();
+        for (const auto &[op, var]: reductions) {
+            m_output << "    mov qword " << address(declare(var.name)) << ", "
+                     << (op == NodeReduction::Op::min ? "-1" : "0") << "\n";
+        }
+        m_parallel_counter = declare(counter.name).slot;
+        declare(chunk_end_name);
+
+        const std::string claim_label = create_label("parallelClaim");
+        const std::string done_label = create_label("parallelDone");
+        m_output << claim_label << ":\n";
+        m_output << "    call _flitParallelClaim\n";
+        m_output << "    cmp rax, rdx\n";
+        m_output << "    jae " << done_label << "\n";
+        m_output << "    mov " << address(*find_var(counter.name)) << ", rax\n";
+        m_output << "    mov " << address(*find_var(chunk_end_name)) << ", rdx\n";
+
+        // the chunk is an ordinary loop up to its end, which can be vectorized like any other
+        NodeTermIdent chunk_end_ident{.ident = {.type = TokenType::ident, .line = 0, .value = chunk_end_name}};
+        NodeTerm chunk_end_term{.var = &chunk_end_ident};
+        NodeExpr chunk_end{.var = &chunk_end_term};
+        NodeBinExprLess chunk_less{.lhs = less->lhs, .rhs = &chunk_end};
+        NodeBinExpr chunk_bin{.var = &chunk_less};
+        NodeExpr chunk_cond{.var = &chunk_bin};
+        NodeStmtWhile chunk_loop{.expr = &chunk_cond, .scope = loop->scope};
+        NodeStmt chunk_stmt{.line = 0, .var = &chunk_loop};
+        m_parallel_increment = *increment;
+        gen_stmt(&chunk_stmt);
+        m_output << "    jmp " << claim_label << "\n";
+
+        m_output << done_label << ":\n";
+        m_output << "    ; adding what this thread reduced to the variables of the starting thread\n";
+        for (const auto &[op, var]: reductions) {
+            m_output << "    mov rbx, " << address(*find_var(var.name)) << "\n";
+            if (op == NodeReduction::Op::sum) {
+                m_output << "    lock add " << address(var) << ", rbx\n";
+                continue;
+            }
+            const std::string retry_label = create_label("reduceRetry");
+            const std::string reduced_label = create_label("reduced");
+            m_output << "    mov rax, " << address(var) << "\n";
+            m_output << retry_label << ":\n";
+            m_output << "    cmp rax, rbx\n";
+            m_output << "    " << (op == NodeReduction::Op::min ? "jbe " : "jae ") << reduced_label << "\n";
+            m_output << "    lock cmpxchg " << address(var) << ", rbx\n"; // rax is reloaded when another thread won
+            m_output << "    jne " << retry_label << "\n";
+            m_output << reduced_label << ":\n";
+        }
+        end_scope();
+        end_frame(frame_label);
+        m_live = std::move(live);
+        m_frame_base = frame_base;
+        m_frame_size = frame_size;
+        m_parallel_frame.reset();
+        m_parallel_counter.reset();
+        m_parallel_increment = nullptr;
+        m_output << end_label << ":\n";
+    }
+
+    // sets up a frame for the slots from m_frame_base up. How many are needed is only known once the code using them
+    // is generated, so its size is a symbol that end_frame defines
+    std::string begin_frame() {
+        const std::string frame_label = create_label("frameSize");
+        m_output << "    push rbp\n";
+        m_output << "    mov rbp, rsp\n";
+        m_output << "    sub rsp, " << frame_label << "\n";
+        return frame_label;
+    }
+
+    // returns from the routine whose frame begin_frame set up
+    void end_frame(const std::string &frame_label) {
+        m_output << "    leave\n";
+        m_output << "    ret\n";
+        m_output << frame_label << " equ " << (m_frame_size - m_frame_base) * 8 << "\n";
+    }
+
+    // the size, the calls and the effects of code, see Function, and the variables it mentions
+    struct Scan {
+        size_t size = 0;
+        std::vector<std::string> callees;
+        bool effects = false;
+        std::vector<std::string> names;
+    };
+
+    static void scan_expr(const NodeExpr *expr, Scan &scan) {
+        std::vector<const NodeExpr *> pending{expr};
+        while (!pending.empty()) {
+            const NodeExpr *curr = pending.back();
+            pending.pop_back();
+            scan.size++;
+            if (auto bin_expr = std::get_if<NodeBinExpr *>(&curr->var)) {
+                std::visit([&](const auto *bin) {
+                    pending.push_back(bin->lhs);
+                    pending.push_back(bin->rhs);
+                }, (*bin_expr)->var);
+                continue;
+            }
+            const NodeTerm *term = std::get<NodeTerm *>(curr->var);
+            if (auto term_paren = std::get_if<NodeTermParen *>(&term->var)) {
+                pending.push_back((*term_paren)->expr);
+            } else if (auto term_ident = std::get_if<NodeTermIdent *>(&term->var)) {
+                scan.names.push_back((*term_ident)->ident.value.value());
+            } else if (auto term_index = std::get_if<NodeTermIndex *>(&term->var)) {
+                scan.names.push_back((*term_index)->ident.value.value());
+                pending.push_back((*term_index)->index);
+            } else if (auto term_len = std::get_if<NodeTermLen *>(&term->var)) {
+                scan.names.push_back((*term_len)->ident.value.value());
+            } else if (auto term_call = std::get_if<NodeTermCall *>(&term->var)) {
+                scan.callees.push_back((*term_call)->ident.value.value());
+                pending.insert(pending.end(), (*term_call)->args.begin(), (*term_call)->args.end());
+            }
+        }
+    }
+
+    static void scan_stmt(const NodeStmt *stmt, Scan &scan) {
+        struct StmtVisitor {
+            Scan &scan;
+
+            void operator()(const NodeStmtExit *stmt_exit) const {
+                scan.effects = true;
+                scan_expr(stmt_exit->expr, scan);
+            }
+
+            void operator()(const NodeStmtLet *stmt_let) const {
+                scan.names.push_back(stmt_let->ident.value.value());
+                scan_expr(stmt_let->expr, scan);
+            }
+
+            void operator()(const NodeStmtPrint *stmt_print) const {
+                scan.effects = true;
+                scan_expr(stmt_print->expr, scan);
+            }
+
+            void operator()(const NodeScope *scope) const {
+                for (const NodeStmt *inner: scope->stmts) {
+                    scan_stmt(inner, scan);
+                }
+            }
+
+            void operator()(const NodeStmtIf *stmt_if) const {
+                scan_expr(stmt_if->expr, scan);
+                (*this)(stmt_if->scope);
+                for (std::optional<NodeIfPred *> pred = stmt_if->pred; pred.has_value();) {
+                    if (auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        scan_expr((*elif)->expr, scan);
+                        (*this)((*elif)->scope);
+                        pred = (*elif)->pred;
+                    } else {
+                        (*this)(std::get<NodeIfPredElse *>(pred.value()->var)->scope);
+                        pred = {};
+                    }
+                }
+            }
+
+            void operator()(const NodeStmtAssign *stmt_assign) const {
+                scan.names.push_back(stmt_assign->ident.value.value());
+                scan_expr(stmt_assign->expr, scan);
+            }
+
+            void operator()(const NodeStmtWhile *stmt_while) const {
+                scan_expr(stmt_while->expr, scan);
+                (*this)(stmt_while->scope);
+            }
+
+            void operator()(const NodeStmtWrite *) const {
+                scan.effects = true;
+            }
+
+            void operator()(const NodeStmtLetArray *stmt_let_array) const {
+                scan.names.push_back(stmt_let_array->ident.value.value());
+            }
+
+            void operator()(const NodeStmtAssignIndex *assign_index) const {
+                scan.names.push_back(assign_index->ident.value.value());
+                scan_expr(assign_index->index, scan);
+                scan_expr(assign_index->expr, scan);
+            }
+
+            void operator()(const NodeStmtParallel *stmt_parallel) const {
+                scan.effects = true;
+                for (const NodeReduction &reduction: stmt_parallel->reductions) {
+                    scan.names.push_back(reduction.ident.value.value());
+                }
+                (*this)(stmt_parallel->loop);
+            }
+
+            void operator()(const NodeStmtFn *) const {
+                // only allowed at the top level, which is reported where it is declared
+            }
+
+            void operator()(const NodeStmtReturn *stmt_return) const {
+                scan_expr(stmt_return->expr, scan);
+            }
+        };
+
+        scan.size++;
+        StmtVisitor visitor{.scan = scan};
+        std::visit(visitor, stmt->var);
+    }
+
+    // the index of the last of the statements that mentions each name, see StmtList
+    static std::unordered_map<std::string, size_t> last_uses(const std::vector<NodeStmt *> &stmts) {
+        std::unordered_map<std::string, size_t> last;
+        for (size_t i = 0; i < stmts.size(); i++) {
+            Scan scan;
+            scan_stmt(stmts[i], scan);
+            for (std::string &name: scan.names) {
+                last[std::move(name)] = i;
+            }
+        }
+        return last;
+    }
+
+    // bodies larger than this are only inlined when the function is called once
+    static constexpr size_t inline_max_size = 32;
+
+    // the functions declared at the top level. A function that isn't recursive has its calls inlined when it is
+    // called once or its body is small, the others get a routine
+    void analyze_functions() {
+        auto functions = std::make_shared<std::unordered_map<std::string, Function>>();
+        Scan program;
+        for (const NodeStmt *stmt: m_prog.stmts) {
+            auto stmt_fn = std::get_if<NodeStmtFn *>(&stmt->var);
+            if (stmt_fn == nullptr) {
+                scan_stmt(stmt, program);
+                continue;
+            }
+            Scan body;
+            for (const NodeStmt *inner: (*stmt_fn)->scope->stmts) {
+                scan_stmt(inner, body);
+            }
+            program.callees.insert(program.callees.end(), body.callees.begin(), body.callees.end());
+            // a second function with the same name is reported where it is declared
+            functions->try_emplace((*stmt_fn)->ident.value.value(), Function{.fn = *stmt_fn, .size = body.size,
+                                   .callees = std::move(body.callees), .effects = body.effects});
+        }
+        for (const std::string &callee: program.callees) {
+            if (auto it = functions->find(callee); it != functions->end()) {
+                it->second.calls++;
+            }
+        }
+
+        for (auto &[name, function]: *functions) {
+            std::unordered_set<const Function *> reached;
+            std::vector<const Function *> pending{&function};
+            while (!pending.empty()) {
+                const Function *curr = pending.back();
+                pending.pop_back();
+                for (const std::string &callee: curr->callees) {
+                    auto it = functions->find(callee);
+                    if (it != functions->end() && reached.insert(&it->second).second) {
+                        pending.push_back(&it->second);
+                    }
+                }
+            }
+            function.recursive = reached.contains(&function);
+            function.effects |= std::ranges::any_of(reached, [](const Function *callee) {
+                return callee->effects;
+            });
+            function.inlined = m_options.inline_calls && !function.recursive && function.calls > 0 &&
+                               (function.calls == 1 || function.size <= inline_max_size);
+        }
+        m_functions = std::move(functions);
+    }
+
+    static constexpr const char *arg_registers[max_params] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+    // the body of the function in m_function, whose parameters are declared. The result ends up in rax
+    void gen_function_body() {
+        const NodeStmtFn *fn = m_function->fn;
+        gen_scope(fn->scope, create_label("fnScope"));
+        if (!ends_with_return(fn)) {
+            m_output << "    xor eax, eax\n"; // running to the end returns 0
+        }
+    }
+
+    static bool ends_with_return(const NodeStmtFn *fn) {
+        return !fn->scope->stmts.empty() && std::holds_alternative<NodeStmtReturn *>(fn->scope->stmts.back()->var);
+    }
+
+    // the routine of a function that isn't inlined, which gets the arguments in rdi, rsi, rdx, rcx, r8 and r9 and
+    // returns the result in rax. It has a frame of its own and stores the arguments in the slots of the parameters
+    void gen_function(const NodeStmtFn *stmt_fn) {
+        const std::string &name = stmt_fn->ident.value.value();
+        if (m_function.has_value() || !m_scopes.empty()) {
+            error("Functions can only be declared at the top level: " + name);
+            return;
+        }
+        const Function &function = m_functions->at(name);
+        if (function.fn != stmt_fn) {
+            error("Function already declared: " + name);
+            return;
+        }
+        if (stmt_fn->params.size() > max_params) {
+            error("Functions can have at most " + std::to_string(max_params) + " parameters: " + name);
+            return;
+        }
+        for (size_t k = 0; k < stmt_fn->params.size(); k++) {
+            for (size_t j = 0; j < k; j++) {
+                if (stmt_fn->params[j].value == stmt_fn->params[k].value) {
+                    error("Identifier already used: " + stmt_fn->params[k].value.value());
+                    return;
+                }
+            }
+        }
+        if (function.inlined) {
+            return;
+        }
+
+        const std::string skip_label = create_label("fnSkip");
+        m_output << "    ; function " << name << ", the program continues after it\n";
+        m_output << "    jmp " << skip_label << "\n";
+        m_output << "_flitFn_" << name << ":\n";
+        std::vector<Var> vars = std::move(m_vars);
+        std::vector<StmtList> lists = std::move(m_lists);
+        std::vector<std::pair<size_t, size_t>> live = std::move(m_live);
+        const size_t frame_size = m_frame_size;
+        m_vars.clear();
+        m_lists.clear();
+        m_live.clear();
+        m_frame_size = 0;
+        const std::string frame_label = begin_frame();
+        for (size_t k = 0; k < stmt_fn->params.size(); k++) {
+            m_output << "    mov " << address(declare(stmt_fn->params[k].value.value())) << ", " << arg_registers[k]
+                     << "\n";
+        }
+        m_function = FunctionFrame{.fn = stmt_fn, .parallel = false, .body_label = create_label("fnBody")};
+        m_output << m_function->body_label << ":\n";
+        gen_function_body();
+        end_frame(frame_label);
+        m_function.reset();
+        m_vars = std::move(vars);
+        m_lists = std::move(lists);
+        m_live = std::move(live);
+        m_frame_size = frame_size;
+        m_output << skip_label << ":\n";
+    }
+
+    // `return f(...)` in the routine of f passes the arguments by overwriting the parameters and jumps back to the
+    // start of the body, so tail recursion runs in constant stack space
+    void gen_return(const NodeStmtReturn *stmt_return) {
+        if (!m_function.has_value()) {
+            error("Return outside of a function");
+            return;
+        }
+        if (m_parallel_frame.has_value() && !m_function->parallel) {
+            error("Return can't be used in a parallel loop");
+            return;
+        }
+        const NodeStmtFn *fn = m_function->fn;
+        auto term = std::get_if<NodeTerm *>(&skip_parens(stmt_return->expr)->var);
+        auto term_call = term != nullptr ? std::get_if<NodeTermCall *>(&(*term)->var) : nullptr;
+        if (term_call != nullptr && !m_function->end_label.has_value() && (*term_call)->ident.value == fn->ident.value &&
+            (*term_call)->args.size() == fn->params.size()) {
+            m_output << "    ; tail call, the arguments replace the parameters\n";
+            for (const NodeExpr *arg: (*term_call)->args) {
+                gen_expr(arg);
+            }
+            for (size_t k = fn->params.size(); k-- > 0;) {
+                pop("rax");
+                m_output << "    mov " << address(*find_var(fn->params[k].value.value())) << ", rax\n";
+            }
+            m_output << "    jmp " << m_function->body_label << "\n";
+            return;
+        }
+
+        m_output << "    ; return\n";
+        gen_expr(stmt_return->expr);
+        pop("rax");
+        auto last = std::get_if<NodeStmtReturn *>(&fn->scope->stmts.back()->var);
+        if (last != nullptr && *last == stmt_return) {
+            return; // the end of the body is next
+        }
+        if (m_function->end_label.has_value()) {
+            m_output << "    jmp " << m_function->end_label.value() << "\n";
+        } else {
+            m_output << "    leave\n";
+            m_output << "    ret\n";
+        }
+    }
+
+    // `f(a, b)` pushes the result. An inlined function has its body generated in place with its parameters and
+    // variables in the frame of the caller, the others are called with the arguments in registers
+    void gen_call(const NodeTermCall *term_call) {
+        const std::string &name = term_call->ident.value.value();
+        auto it = m_functions->find(name);
+        if (it == m_functions->end()) {
+            error("Undeclared function: " + name);
+            return;
+        }
+        const Function &function = it->second;
+        const std::vector<Token> &params = function.fn->params;
+        if (term_call->args.size() != params.size()) {
+            error("Wrong number of arguments for " + name + ", it takes " + std::to_string(params.size()));
+            return;
+        }
+        if (params.size() > max_params) {
+            error("Functions can have at most " + std::to_string(max_params) + " parameters: " + name);
+            return;
+        }
+        if (m_parallel_frame.has_value() && function.effects) {
+            error("Function that prints, exits or runs a parallel loop called in a parallel loop: " + name);
+            return;
+        }
+
+        for (const NodeExpr *arg: term_call->args) {
+            gen_expr(arg);
+        }
+        if (!function.inlined) {
+            for (size_t k = params.size(); k-- > 0;) {
+                pop(arg_registers[k]);
+            }
+            m_output << "    call _flitFn_" << name << "\n";
+            push("rax");
+            return;
+        }
+
+        // the body doesn't see the variables of the caller
+        m_output << "    ; inlined call of " << name << "\n";
+        std::vector<Var> vars = std::move(m_vars);
+        std::vector<size_t> scopes = std::move(m_scopes);
+        std::vector<StmtList> lists = std::move(m_lists);
+        std::optional<FunctionFrame> outer = std::move(m_function);
+        m_vars.clear();
+        m_scopes.clear();
+        m_lists.clear();
+        for (const Token &param: params) {
+            declare(param.value.value());
+        }
+        for (size_t k = params.size(); k-- > 0;) {
+            pop("rax");
+            m_output << "    mov " << address(m_vars[k]) << ", rax\n";
+        }
+        m_function = FunctionFrame{.fn = function.fn, .parallel = m_parallel_frame.has_value(),
+                                   .end_label = create_label("inlineEnd")};
+        gen_function_body();
+        m_output << m_function->end_label.value() << ":\n";
+        for (Var &param: m_vars) {
+            release(param);
+        }
+        m_function = std::move(outer);
+        m_vars = std::move(vars);
+        m_scopes = std::move(scopes);
+        m_lists = std::move(lists);
+        push("rax");
+    }
+
+    // semantic errors end the compilation, a shard keeps the first one and stops caring about its output
+    void error(const std::string &message) {
+        Diagnostic diagnostic{.stage = Diagnostic::Stage::generate, .message = message, .line = m_line};
+        if (!m_shard) {
+            throw CompileError(std::move(diagnostic));
+        }
+        if (!m_error.has_value()) {
+            m_error = std::move(diagnostic);
+        }
+    }
+
 public:
     // this constructor moves the given argument to private member root
-    explicit Generator(NodeProg prog) : m_prog(std::move(prog)) {
+    explicit Generator(NodeProg prog, GenOptions options = {}) : m_prog(std::move(prog)), m_options(std::move(options)) {
 
     }
 
@@ -74,101 +1499,327 @@ public:
             void operator()(const NodeTermIdent *term_ident) const {
 
                 // if the given identifier doesn't exist
-                auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var &var) {
-                    return var.name == term_ident->ident.value.value();
-                });
-                if (it == gen.m_vars.cend()) {
-                    std::cerr << "Undeclared Identifier " << term_ident->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+                const Var *it = gen.find_var(term_ident->ident.value.value());
+                if (it == nullptr) {
+                    gen.error("Undeclared Identifier " + term_ident->ident.value.value());
+                    return;
+                }
+                if (it->length.has_value()) {
+                    gen.error("Array used as a value: " + term_ident->ident.value.value());
+                    return;
                 }
 
                 gen.m_output << "    ; finding the identifier location\n";
-                std::stringstream offset;
                 // we will find the offset and then copy the variable to the top of the stack
-                // we are multiplying by 8 to convert the integer 64 bits to binary
-                offset << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]\n";
-                gen.push(offset.str());
+                gen.push("QWORD " + gen.address(*it));
             }
 
             void operator()(const NodeTermParen *term_paren) const {
                 gen.gen_expr(term_paren->expr);
             }
+
+            void operator()(const NodeTermIndex *term_index) const {
+                const Var *array = gen.find_array(term_index->ident);
+                if (array == nullptr) {
+                    return;
+                }
+                gen.m_output << "    ; reading an array element\n";
+                if (auto index = checked_index(term_index->index, *array)) {
+                    gen.push("QWORD " + gen.address(*array, index.value() * 8));
+                    return;
+                }
+                gen.gen_expr(term_index->index);
+                gen.pop("rax");
+                gen.gen_bounds_check(*array);
+                gen.push("QWORD " + gen.address(*array, 0, "rax"));
+            }
+
+            void operator()(const NodeTermLen *term_len) const {
+                const Var *array = gen.find_array(term_len->ident);
+                if (array == nullptr) {
+                    return;
+                }
+                gen.m_output << "    mov rax, " << array->length.value() << "\n";
+                gen.push("rax");
+            }
+
+            void operator()(const NodeTermCall *term_call) const {
+                gen.gen_call(term_call);
+            }
         };
 
         TermVisitor visitor({.gen = *this});
         std::visit(visitor, term->var);
     }
 
+    // emits the operation of a binary expression whose operands are already on the stack (lhs on top of rhs)
     void gen_bin_expr(const NodeBinExpr *bin_expr) {
         struct BinExprVisitor {
             Generator &gen;
 
-            void operator()(const NodeBinExprAdd *add) const {
-                gen.gen_expr(add->rhs);
-                gen.gen_expr(add->lhs);
+            void operator()(const NodeBinExprAdd *) const {
                 gen.pop("rax");
                 gen.pop("rbx");
                 gen.m_output << "    add rax, rbx\n";
                 gen.push("rax");
             }
 
-            void operator()(const NodeBinExprMinus *sub) const {
-                gen.gen_expr(sub->rhs);
-                gen.gen_expr(sub->lhs);
+            void operator()(const NodeBinExprMinus *) const {
                 gen.pop("rax");
                 gen.pop("rbx");
                 gen.m_output << "    sub rax, rbx\n";
                 gen.push("rax");
             }
 
-            void operator()(const NodeBinExprMulti *multi) const {
-                gen.gen_expr(multi->rhs);
-                gen.gen_expr(multi->lhs);
+            void operator()(const NodeBinExprMulti *) const {
                 gen.pop("rax");
                 gen.pop("rbx");
                 gen.m_output << "    mul rbx\n";
                 gen.push("rax");
             }
 
-            void operator()(const NodeBinExprDiv *div) const {
-                gen.gen_expr(div->rhs);
-                gen.gen_expr(div->lhs);
+            void operator()(const NodeBinExprDiv *) const {
                 gen.pop("rax");
                 gen.pop("rbx");
                 gen.m_output << "    mov rdx, 0\n"; // clearing the rdx register before division
                 gen.m_output << "    div rbx\n";
                 gen.push("rax");
             }
+
+            // comparisons that are stored rather than branched on
+            void operator()(const NodeBinExprEq *comparison) const {
+                gen.gen_set(comparison);
+            }
+
+            void operator()(const NodeBinExprNotEq *comparison) const {
+                gen.gen_set(comparison);
+            }
+
+            void operator()(const NodeBinExprLess *comparison) const {
+                gen.gen_set(comparison);
+            }
+
+            void operator()(const NodeBinExprLessEq *comparison) const {
+                gen.gen_set(comparison);
+            }
+
+            void operator()(const NodeBinExprGreater *comparison) const {
+                gen.gen_set(comparison);
+            }
+
+            void operator()(const NodeBinExprGreaterEq *comparison) const {
+                gen.gen_set(comparison);
+            }
+
+            void operator()(const NodeBinExprAnd *) const {
+                assert(false); // generated by gen_logical
+            }
+
+            void operator()(const NodeBinExprOr *) const {
+                assert(false); // generated by gen_logical
+            }
         };
         BinExprVisitor visitor{.gen = *this};
         std::visit(visitor, bin_expr->var);
     }
 
-    void gen_expr(const NodeExpr *expr) {
-        // this visitor will direct the input to whatever statement we need to generate
-        struct ExprVisitor {
-            Generator &gen;
+    // condition codes of the unsigned comparisons, nullptr for the other operators
+    static const char *condition_code(const void *) {
+        return nullptr;
+    }
 
-            void operator()(const NodeTerm *term) const {
-                gen.gen_term(term);
-            }
+    static const char *condition_code(const NodeBinExprEq *) {
+        return "e";
+    }
+
+    static const char *condition_code(const NodeBinExprNotEq *) {
+        return "ne";
+    }
+
+    static const char *condition_code(const NodeBinExprLess *) {
+        return "b";
+    }
 
-            void operator()(const NodeBinExpr *bin_expr) const {
-                gen.m_output << "    ; binary expression\n";
-                gen.gen_bin_expr(bin_expr);
+    static const char *condition_code(const NodeBinExprLessEq *) {
+        return "be";
+    }
+
+    static const char *condition_code(const NodeBinExprGreater *) {
+        return "a";
+    }
+
+    static const char *condition_code(const NodeBinExprGreaterEq *) {
+        return "ae";
+    }
+
+    // the condition code that holds exactly when the given one doesn't
+    static std::string negate(const std::string &code) {
+        static const std::pair<std::string, std::string> opposites[] = {{"e", "ne"}, {"b", "ae"}, {"be", "a"}};
+        for (const auto &[a, b]: opposites) {
+            if (code == a || code == b) {
+                return code == a ? b : a;
             }
+        }
+        assert(false);
+        return code;
+    }
+
+    // rhs of a comparison that fits the 32 bit immediate of `cmp`
+    static std::optional<uint64_t> compare_immediate(const NodeExpr *rhs) {
+        auto value = literal_value(rhs);
+        if (!value.has_value() || value.value() > 0x7fffffff) {
+            return {};
+        }
+        return value;
+    }
+
+    // pops the operands of a comparison, which gen_expr put on the stack, and compares them
+    template<typename Comparison>
+    void gen_compare_operands(const Comparison *comparison) {
+        pop("rax");
+        if (auto immediate = compare_immediate(comparison->rhs)) {
+            m_output << "    cmp rax, " << immediate.value() << "\n";
+            return;
+        }
+        pop("rbx");
+        m_output << "    cmp rax, rbx\n";
+    }
+
+    template<typename Comparison>
+    void gen_set(const Comparison *comparison) {
+        gen_compare_operands(comparison);
+        m_output << "    set" << condition_code(comparison) << " al\n";
+        m_output << "    movzx eax, al\n";
+        push("rax");
+    }
+
+    // jumps to label when cond is non-zero (or zero when jump_if is false) and falls through otherwise. A comparison
+    // becomes a `cmp` followed by the conditional jump and `&&`/`||` jump as soon as the outcome is known, so no
+    // boolean is ever materialized. Nested conditions are walked with an explicit stack like expressions are
+    void gen_branch(const NodeExpr *cond, const std::string &label, bool jump_if) {
+        struct Branch {
+            const NodeExpr *expr; // nullptr places the label instead
+            std::string label;
+            bool jump_if;
         };
+        std::vector<Branch> branches{{cond, label, jump_if}};
 
-        // construct visitor instance, it will call the suited method for the variable type
-        ExprVisitor visitor{.gen = *this};
-        std::visit(visitor, expr->var);
+        while (!branches.empty()) {
+            const Branch branch = std::move(branches.back());
+            branches.pop_back();
+            if (branch.expr == nullptr) {
+                m_output << branch.label << ":\n";
+                continue;
+            }
+
+            const NodeExpr *expr = skip_parens(branch.expr);
+            if (auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+                const auto [lhs, rhs] = std::visit([](const auto *bin) {
+                    return std::pair<const NodeExpr *, const NodeExpr *>{bin->lhs, bin->rhs};
+                }, (*bin_expr)->var);
+                const bool is_and = std::holds_alternative<NodeBinExprAnd *>((*bin_expr)->var);
+                if (is_and || std::holds_alternative<NodeBinExprOr *>((*bin_expr)->var)) {
+                    if (is_and != branch.jump_if) {
+                        // `a && b` is false as soon as either is, `a || b` true as soon as either is
+                        branches.push_back({rhs, branch.label, branch.jump_if});
+                        branches.push_back({lhs, branch.label, branch.jump_if});
+                    } else {
+                        // `a && b` is only true when b is checked too, so a failed lhs skips over that check
+                        const std::string skip_label = create_label("condSkip");
+                        branches.push_back({nullptr, skip_label, false});
+                        branches.push_back({rhs, branch.label, branch.jump_if});
+                        branches.push_back({lhs, skip_label, !branch.jump_if});
+                    }
+                    continue;
+                }
+                const char *code = std::visit([](const auto *bin) {
+                    return condition_code(bin);
+                }, (*bin_expr)->var);
+                if (code != nullptr) {
+                    if (!compare_immediate(rhs).has_value()) {
+                        gen_expr(rhs);
+                    }
+                    gen_expr(lhs);
+                    std::visit([&](const auto *bin) {
+                        gen_compare_operands(bin);
+                    }, (*bin_expr)->var);
+                    m_output << "    j" << (branch.jump_if ? std::string(code) : negate(code)) << " " << branch.label << "\n";
+                    continue;
+                }
+            }
+
+            gen_expr(expr);
+            pop("rax");
+            m_output << "    test rax, rax\n";
+            m_output << "    " << (branch.jump_if ? "jnz " : "jz ") << branch.label << "\n";
+        }
+    }
+
+    // `&&` and `||` whose result is stored, 1 or 0
+    void gen_logical(const NodeExpr *expr) {
+        const std::string false_label = create_label("condFalse");
+        const std::string end_label = create_label("condEnd");
+        gen_branch(expr, false_label, false);
+        m_output << "    mov eax, 1\n";
+        m_output << "    jmp " << end_label << "\n";
+        m_output << false_label << ":\n";
+        m_output << "    xor eax, eax\n";
+        m_output << end_label << ":\n";
+        push("rax");
+    }
+
+    void gen_expr(const NodeExpr *expr) {
+        passes::walk_post_order(expr, [&](const auto &frame, auto &frames) {
+            if (auto term = std::get_if<NodeTerm *>(&frame.expr->var)) {
+                // parenthesis only group the expression so we directly walk the inner expression
+                if (auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+                    frames.push_back({(*term_paren)->expr, false, {}});
+                } else {
+                    gen_term(*term);
+                }
+                return;
+            }
+
+            const NodeBinExpr *bin_expr = std::get<NodeBinExpr *>(frame.expr->var);
+            if (frame.operands_done) {
+                gen_bin_expr(bin_expr);
+                return;
+            }
+            if (std::holds_alternative<NodeBinExprAnd *>(bin_expr->var) ||
+                std::holds_alternative<NodeBinExprOr *>(bin_expr->var)) {
+                gen_logical(frame.expr);
+                return;
+            }
+
+            m_output << "    ; binary expression\n";
+            const auto [lhs, rhs] = std::visit([](const auto *bin) {
+                return std::pair<const NodeExpr *, const NodeExpr *>{bin->lhs, bin->rhs};
+            }, bin_expr->var);
+            const bool is_comparison = std::visit([](const auto *bin) {
+                return condition_code(bin) != nullptr;
+            }, bin_expr->var);
+
+            // rhs is generated first and lhs last so lhs ends up at the top of the stack
+            frames.push_back({frame.expr, true, {}});
+            frames.push_back({lhs, false, {}});
+            if (!is_comparison || !compare_immediate(rhs).has_value()) {
+                frames.push_back({rhs, false, {}});
+            }
+        });
     }
 
     void gen_scope(const NodeScope *scope, const std::string scopeLabel) {
         begin_scope(scopeLabel);
-        for (const NodeStmt *stmt: scope->stmts) {
-            gen_stmt(stmt);
+        count(scope);
+        m_lists.push_back({.last_uses = std::make_shared<const std::unordered_map<std::string, size_t>>(
+                last_uses(scope->stmts)), .depth = m_scopes.size()});
+        for (size_t i = 0; i < scope->stmts.size(); i++) {
+            m_lists.back().index = i;
+            gen_stmt(scope->stmts[i]);
+            release_dead();
         }
+        m_lists.pop_back();
+        mark_line(m_line);
         end_scope();
     }
 
@@ -178,15 +1829,17 @@ public:
             const std::string &end_label;
 
             void operator()(const NodeIfPredElif *elif) const {
-                gen.gen_expr(elif->expr);
-                gen.pop("rax");
+                const int outer_line = gen.m_line;
+                gen.m_line = elif->line;
+                gen.mark_line(gen.m_line);
                 std::string label = gen.create_label("elifPredLabel");
-                gen.m_output << "    test rax, rax\n";
-                gen.m_output << "    jz " << label << "\n";
+                gen.gen_branch(elif->expr, label, false);
                 gen.gen_scope(elif->scope, gen.create_label("scopeElif"));
                 gen.m_output << "    jmp " << end_label << "\n";
+                gen.m_line = outer_line;
+                // the failed test of the last elif falls through to the end of the if
+                gen.m_output << label << ":\n";
                 if (elif->pred.has_value()) {
-                    gen.m_output << label << ":\n";
                     gen.gen_if_pred(elif->pred.value(), end_label);
                 }
             }
@@ -206,9 +1859,16 @@ public:
             Generator &gen;
 
             void operator()(const NodeStmtExit *stmt_exit) const {
+                if (gen.m_parallel_frame.has_value()) {
+                    gen.error("Exit can't be used in a parallel loop");
+                    return;
+                }
                 gen.m_output << "    ; exit statement\n";
 
                 gen.gen_expr(stmt_exit->expr);
+                if (gen.m_options.instrument.has_value()) {
+                    gen.m_output << "    call _flitDumpProfile\n";
+                }
                 gen.m_output << "    mov rax, 60\n";
                 gen.pop("rdi");
                 gen.m_output << "    syscall\n";
@@ -219,17 +1879,22 @@ public:
                     return var.name == stmt_let->ident.value.value();
                 });
                 if (it != gen.m_vars.cend()) {
-                    std::cerr << "Identifier already used: " << stmt_let->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+                    gen.error("Identifier already used: " + stmt_let->ident.value.value());
+                    return;
                 }
 
                 gen.m_output << "    ; declaring identifier\n";
 
-                gen.m_vars.push_back({.name = stmt_let->ident.value.value(), .stack_loc = gen.m_stack_size});
                 gen.gen_expr(stmt_let->expr);
+                gen.pop("rax");
+                gen.m_output << "    mov " << gen.address(gen.declare(stmt_let->ident.value.value())) << ", rax\n";
             }
 
             void operator()(const NodeStmtPrint *stmt_print) const {
+                if (gen.m_parallel_frame.has_value()) {
+                    gen.error("Print can't be used in a parallel loop");
+                    return;
+                }
                 gen.m_output << "    ; print statement\n";
 
                 gen.gen_expr(stmt_print->expr);
@@ -242,11 +1907,18 @@ public:
             }
 
             void operator()(const NodeStmtIf *stmt_if) const {
-                gen.gen_expr(stmt_if->expr);
-                gen.pop("rax");
+                gen.count(stmt_if);
+                std::vector<Arm> arms = gen.if_arms(stmt_if);
+                if (auto chain = constant_chain(arms); chain.has_value() && chain->constants.size() >= switch_min_tests) {
+                    gen.gen_switch(arms, chain.value());
+                    return;
+                }
+                if (gen.m_options.profile.has_value()) {
+                    gen.gen_if_by_profile(std::move(arms), stmt_if);
+                    return;
+                }
                 std::string label = gen.create_label("ifStartLabel");
-                gen.m_output << "    test rax, rax ; if\n";
-                gen.m_output << "    jz " << label << "\n";
+                gen.gen_branch(stmt_if->expr, label, false);
                 gen.gen_scope(stmt_if->scope, gen.create_label("scopeLabel"));
                 if (stmt_if->pred.has_value()) {
                     const std::string end_label = gen.create_label("ifEndLabel");
@@ -260,58 +1932,378 @@ public:
             }
 
             void operator()(const NodeStmtAssign *stmt_assign) const {
-                auto it = std::ranges::find_if(gen.m_vars, [&](const Var &var) {
-                    return var.name == stmt_assign->ident.value.value();
-                });
-                if (it == gen.m_vars.cend()) {
-                    std::cerr << "Undeclared Identifier: " << stmt_assign->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+                const Var *it = gen.find_var(stmt_assign->ident.value.value());
+                if (it == nullptr) {
+                    gen.error("Undeclared Identifier: " + stmt_assign->ident.value.value());
+                    return;
+                }
+                if (it->length.has_value()) {
+                    gen.error("Array used as a value: " + stmt_assign->ident.value.value());
+                    return;
+                }
+                // the iterations of a parallel loop run at the same time, each one can only assign its own variables
+                if (gen.is_shared(*it)) {
+                    gen.error("Shared variable assigned in a parallel loop: " + stmt_assign->ident.value.value());
+                    return;
+                }
+                if (gen.m_parallel_counter == it->slot && stmt_assign != gen.m_parallel_increment) {
+                    gen.error("Loop counter assigned in a parallel loop: " + stmt_assign->ident.value.value());
+                    return;
                 }
 
                 gen.m_output << "    ; reassigning identifier\n";
                 gen.gen_expr(stmt_assign->expr);
                 gen.pop("rax");
-                gen.m_output << "    mov [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], rax\n";
+                gen.m_output << "    mov " << gen.address(*it) << ", rax\n";
             }
 
             void operator()(const NodeStmtWhile *stmtWhile) const {
+                gen.count(stmtWhile);
+                // counting runs of the body needs every iteration to run it
+                if (gen.m_options.vectorize && !gen.m_options.instrument.has_value() &&
+                    !gen.is_cold(stmtWhile->scope, stmtWhile)) {
+                    if (auto loop = gen.vector_loop(stmtWhile)) {
+                        gen.gen_vector_loop(loop.value());
+                    }
+                }
                 std::string whileLabel = gen.create_label("whileExpr");
-                gen.m_output << "    jmp " << whileLabel << "\n";
                 std::string scopeLabel = gen.create_label("whileScope");
-                gen.gen_scope(stmtWhile->scope, scopeLabel);
+                if (gen.is_cold(stmtWhile->scope, stmtWhile)) {
+                    // the body never or hardly ever runs, only the test stays in line
+                    gen.gen_cold([&]() {
+                        gen.gen_scope(stmtWhile->scope, scopeLabel);
+                        gen.m_output << "    jmp " << whileLabel << "\n";
+                    });
+                } else {
+                    gen.m_output << "    jmp " << whileLabel << "\n";
+                    if (gen.profiled(stmtWhile->scope) >= 1024) {
+                        gen.m_output << "    align 16\n"; // the body is the target of the backward jump of a hot loop
+                    }
+                    gen.gen_scope(stmtWhile->scope, scopeLabel);
+                }
+                gen.mark_line(gen.m_line);
                 gen.m_output << whileLabel << ": \n";
-                gen.gen_expr(stmtWhile->expr);
-                gen.pop("rax");
+                gen.gen_branch(stmtWhile->expr, scopeLabel, true);
+            }
+
+            void operator()(const NodeStmtWrite *stmt_write) const {
+                gen.m_output << "    ; precomputed output\n";
+                // stale digits left in the print buffer can show up in later prints, so restore them
+                for (size_t i = 8; i < stmt_write->digit_space.size(); i++) {
+                    if (stmt_write->digit_space[i] != '\0') {
+                        gen.m_output << "    mov byte [digitSpace + " << i << "], " << static_cast<int>(stmt_write->digit_space[i]) << "\n";
+                    }
+                }
+                if (stmt_write->text.empty()) {
+                    return;
+                }
+
+                const std::string data_label = gen.create_label("writeData");
+                gen.m_data << data_label << ":";
+                for (size_t i = 0; i < stmt_write->text.size(); i++) {
+                    gen.m_data << (i % 32 == 0 ? "\n    db " : ", ") << static_cast<int>(static_cast<unsigned char>(stmt_write->text[i]));
+                }
+                gen.m_data << "\n";
+
+                // write can be partial (e.g. into a pipe) so keep writing until everything is out
+                const std::string loop_label = gen.create_label("writeLoop");
+                const std::string end_label = gen.create_label("writeEnd");
+                gen.m_output << "    mov rsi, " << data_label << "\n";
+                gen.m_output << "    mov rdx, " << stmt_write->text.size() << "\n";
+                gen.m_output << loop_label << ":\n";
+                gen.m_output << "    mov rax, 1\n"; // syscall 1 for sys_write
+                gen.m_output << "    mov rdi, 1\n";
+                gen.m_output << "    syscall\n";
                 gen.m_output << "    cmp rax, 0\n";
-                gen.m_output << "    jne " << scopeLabel << "\n";
+                gen.m_output << "    jle " << end_label << "\n";
+                gen.m_output << "    add rsi, rax\n";
+                gen.m_output << "    sub rdx, rax\n";
+                gen.m_output << "    jnz " << loop_label << "\n";
+                gen.m_output << end_label << ":\n";
+            }
+
+            void operator()(const NodeStmtLetArray *stmt_let_array) const {
+                const std::string &name = stmt_let_array->ident.value.value();
+                if (gen.find_var(name) != nullptr) {
+                    gen.error("Identifier already used: " + name);
+                    return;
+                }
+                auto length = array_length(stmt_let_array);
+                if (!length.has_value()) {
+                    gen.error("Array size has to be between 1 and " + std::to_string(max_array_length) + ": " + name);
+                    return;
+                }
+
+                gen.m_output << "    ; declaring array, the elements start out as 0\n";
+                gen.m_output << "    lea rdi, " << gen.address(gen.declare(name, length)) << "\n";
+                gen.m_output << "    mov rcx, " << length.value() << "\n";
+                gen.m_output << "    xor eax, eax\n";
+                gen.m_output << "    rep stosq\n";
+            }
+
+            void operator()(const NodeStmtAssignIndex *assign_index) const {
+                const Var *array = gen.find_array(assign_index->ident);
+                if (array == nullptr) {
+                    return;
+                }
+                gen.m_output << "    ; assigning an array element\n";
+                if (auto index = checked_index(assign_index->index, *array)) {
+                    gen.gen_expr(assign_index->expr);
+                    gen.pop("rax");
+                    gen.m_output << "    mov " << gen.address(*array, index.value() * 8) << ", rax\n";
+                    return;
+                }
+                gen.gen_expr(assign_index->index);
+                gen.gen_expr(assign_index->expr);
+                gen.pop("rbx");
+                gen.pop("rax");
+                gen.gen_bounds_check(*array);
+                gen.m_output << "    mov " << gen.address(*array, 0, "rax") << ", rbx\n";
+            }
+
+            void operator()(const NodeStmtParallel *stmt_parallel) const {
+                gen.gen_parallel(stmt_parallel);
+            }
+
+            void operator()(const NodeStmtFn *stmt_fn) const {
+                gen.gen_function(stmt_fn);
+            }
+
+            void operator()(const NodeStmtReturn *stmt_return) const {
+                gen.gen_return(stmt_return);
             }
         };
 
+        const int outer_line = m_line;
+        if (stmt->line > 0) {
+            m_line = stmt->line;
+        }
+        mark_line(m_line);
+
         // construct visitor instance, it will call the suited method for the variable type
         StmtVisitor visitor{.gen = *this};
         std::visit(visitor, stmt->var);
+        m_line = outer_line;
     }
 
-    std::string gen_prog() {
+    // moves what was generated so far to out, so the consumer can start on it and the buffer stays small
+    void flush_output(std::ostream &out) {
+        if (m_output.tellp() <= 0) {
+            return; // inserting an empty buffer would put out into a failed state
+        }
+        out << m_output.rdbuf();
+        m_output.str("");
+        m_output.clear();
+    }
+
+    // what a shard generated, label numbers in code and data are relative to label_base
+    struct Shard {
+        std::string code;
+        std::string data;
+        std::string rodata;
+        int label_count = 0;
+        int first_line = -1; // line of the first `%line` directive, which is dropped if the assembler is already there
+        int last_line = -1; // line the assembler is at after the shard, -1 if the shard has no `%line` directive
+        std::string cold;
+        std::optional<Diagnostic> error{};
+        bool index_checks = false;
+        bool vectorized = false;
+        bool parallel = false;
+        size_t frame_size = 0;
+    };
+
+    // generates the top-level statements [begin, end). Between top-level statements only the variables declared at
+    // the top level are live, so the state a shard starts with is the slots they got from the statements before it
+    Shard gen_shard(size_t begin, size_t end) const {
+        Generator gen(NodeProg{}, m_options);
+        gen.m_shard = true;
+        gen.m_marked_line = -1;
+        gen.m_sites = m_sites;
+        gen.m_functions = m_functions;
+        gen.m_lists.push_back({.last_uses = m_lists.front().last_uses, .depth = 0});
+        for (size_t i = 0; i < begin; i++) {
+            gen.m_lists.back().index = i;
+            if (auto stmt_let = std::get_if<NodeStmtLet *>(&m_prog.stmts[i]->var)) {
+                gen.declare((*stmt_let)->ident.value.value());
+            } else if (auto stmt_let_array = std::get_if<NodeStmtLetArray *>(&m_prog.stmts[i]->var)) {
+                // an invalid size was reported by the shard generating the declaration
+                gen.declare((*stmt_let_array)->ident.value.value(), array_length(*stmt_let_array).value_or(1));
+            }
+            gen.release_dead();
+        }
+
+        for (size_t i = begin; i < end && !gen.m_error.has_value(); i++) {
+            gen.m_lists.back().index = i;
+            gen.gen_stmt(m_prog.stmts[i]);
+            gen.release_dead();
+        }
+        return {.code = gen.m_output.str(), .data = gen.m_data.str(), .rodata = gen.m_rodata.str(),
+                .label_count = gen.m_label_count, .first_line = gen.m_first_line, .last_line = gen.m_marked_line,
+                .cold = gen.m_cold.str(), .error = gen.m_error, .index_checks = gen.m_index_checks,
+                .vectorized = gen.m_vectorized, .parallel = gen.m_parallel, .frame_size = gen.m_frame_size};
+    }
+
+    // copies shard output to out with the label numbers shifted by label_base and the first `%line` directive
+    // dropped when the assembler is already on that line
+    static void write_shard(std::ostream &out, const std::string &text, int label_base, int marked_line, int first_line) {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            const size_t marker = text.find_first_of(std::string{label_begin, first_mark}, pos);
+            if (marker == std::string::npos) {
+                out.write(text.data() + pos, static_cast<std::streamsize>(text.size() - pos));
+                break;
+            }
+            out.write(text.data() + pos, static_cast<std::streamsize>(marker - pos));
+            if (text[marker] == label_begin) {
+                const size_t number_end = text.find(label_end, marker);
+                out << label_base + std::stoi(text.substr(marker + 1, number_end - marker - 1));
+                pos = number_end + 1;
+            } else if (first_line == marked_line) {
+                pos = text.find('\n', marker) + 1;
+            } else {
+                pos = marker + 1;
+            }
+        }
+    }
+
+    // generates the top-level statements on several threads, the shards are written in order as they finish
+    void gen_shards(std::ostream &out, unsigned threads) {
+        const size_t count = m_prog.stmts.size();
+        std::vector<Shard> shards(threads);
+        std::vector<std::jthread> workers;
+        for (unsigned k = 0; k < threads; k++) {
+            workers.emplace_back([&, k]() {
+                shards[k] = gen_shard(count * k / threads, count * (k + 1) / threads);
+            });
+        }
+
+        for (unsigned k = 0; k < threads; k++) {
+            workers[k].join();
+            Shard &shard = shards[k];
+            write_shard(out, shard.code, m_label_count, m_marked_line, shard.first_line);
+            if (shard.error.has_value()) {
+                throw CompileError(shard.error.value());
+            }
+            write_shard(m_data, shard.data, m_label_count, m_marked_line, -1);
+            write_shard(m_rodata, shard.rodata, m_label_count, m_marked_line, -1);
+            write_shard(m_cold, shard.cold, m_label_count, m_marked_line, -1);
+            m_label_count += shard.label_count;
+            m_index_checks |= shard.index_checks;
+            m_vectorized |= shard.vectorized;
+            m_parallel |= shard.parallel;
+            m_frame_size = std::max(m_frame_size, shard.frame_size);
+            if (shard.last_line >= 0) {
+                m_marked_line = shard.last_line;
+            }
+            shard = Shard{}; // free the output that was written
+        }
+    }
+
+    // the runtime that writes the counters and the profile they are written as, see profile.h
+    void gen_profile_data() {
+        gen::genDumpProfile(m_output, 24 + m_sites->count() * 8);
+        m_data << "flitProfilePath:\n    db ";
+        for (const char c: m_options.instrument.value()) {
+            m_data << static_cast<int>(static_cast<unsigned char>(c)) << ", ";
+        }
+        m_data << "0\n";
+        m_data << "    align 8\n";
+        m_data << "flitProfile:\n";
+        m_data << "    db \"" << std::string(profile::magic, sizeof(profile::magic)) << "\"\n";
+        m_data << "    dq " << m_sites->count() << "\n";
+        m_data << "    dq 0x" << std::hex << m_sites->hash << std::dec << "\n";
+        m_data << "flitCounters:\n";
+        m_data << "    times " << m_sites->count() << " dq 0\n";
+    }
+
+    // writes the assembly to out while it is being generated
+    void gen_prog(std::ostream &out) {
         // ads bss section to the top of the assembly code
         gen::genHeader(m_output);
 
         m_output << "\n_start:\n"; // initializing the stringstream with starter code
+        m_output << "    mov rbp, rsp\n";
+        m_output << "    sub rsp, flitFrameSize\n";
 
-        for (const NodeStmt *stmt: m_prog.stmts) {
-            gen_stmt(stmt);
+        if (m_options.instrument.has_value() || m_options.profile.has_value()) {
+            m_sites = std::make_shared<const profile::Sites>(profile::number_sites(m_prog));
+            if (m_options.profile.has_value() && (m_options.profile->hash != m_sites->hash ||
+                                                  m_options.profile->counts.size() != m_sites->count())) {
+                throw CompileError({.stage = Diagnostic::Stage::system,
+                                    .message = "The profile was recorded for another program or with other passes"});
+            }
+        }
+
+        analyze_functions();
+        m_lists.push_back({.last_uses = std::make_shared<const std::unordered_map<std::string, size_t>>(
+                last_uses(m_prog.stmts)), .depth = 0});
+
+        // large programs are split into one shard of top-level statements per thread
+        unsigned threads = m_options.threads;
+        if (threads == 0) {
+            threads = m_prog.stmts.size() >= 4096 ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+        }
+        threads = std::min<size_t>(threads, std::max<size_t>(1, m_prog.stmts.size()));
+
+        if (threads > 1) {
+            flush_output(out);
+            gen_shards(out, threads);
+        } else {
+            for (size_t i = 0; i < m_prog.stmts.size(); i++) {
+                m_lists.back().index = i;
+                gen_stmt(m_prog.stmts[i]);
+                release_dead();
+                if (m_output.tellp() >= 1024 * 64) {
+                    flush_output(out);
+                }
+            }
         }
 
         m_output << "    ; exiting the program\n";
 
         // to exit the program (in case the user hasn't included exit statement)
+        if (m_options.instrument.has_value()) {
+            m_output << "    call _flitDumpProfile\n";
+        }
         m_output << "    mov rax, 60\n"; // syscall 60 for sys_exit
         m_output << "    mov rdi, 0\n"; // return 0
         m_output << "    syscall\n";
+        m_output << "flitFrameSize equ " << m_frame_size * 8 << "\n";
+
+        if (m_cold.tellp() > 0) {
+            m_output << "\n    ; blocks the profile says rarely run\n" << m_cold.str();
+        }
 
         // generates assembly code for printing rax function
+        if (m_options.debug_source.has_value()) {
+            m_output << "%line 1+1 flit_runtime\n";
+        }
         gen::genFooter(m_output);
+        if (m_index_checks) {
+            gen::genIndexError(m_output, m_data);
+        }
+        if (m_vectorized) {
+            gen::genDetectCpu(m_output, m_data, m_options.avx2);
+        }
+        if (m_parallel) {
+            gen::genParallel(m_output, m_data);
+        }
+        if (m_options.instrument.has_value()) {
+            gen_profile_data();
+        }
 
-        return m_output.str();
+        if (m_data.tellp() > 0) {
+            m_output << "\nsection .data\n" << m_data.str();
+        }
+        if (m_rodata.tellp() > 0) {
+            m_output << "\nsection .rodata\n" << m_rodata.str();
+        }
+        flush_output(out);
+    }
+
+    std::string gen_prog() {
+        std::stringstream out;
+        gen_prog(out);
+        return out.str();
     }
 };
\ No newline at end of file
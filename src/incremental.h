@@ -0,0 +1,422 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <utility>
+#include "parser.h"
+
+// sequence that is edited at one place at a time, e.g. by an editor. The elements sit at both ends of one array with
+// a gap between them where the last edit was, so an edit only moves the elements between it and the one before
+template<typename T>
+class GapBuffer {
+private:
+    std::vector<T> m_items;
+    size_t m_gap = 0; // first index of the gap
+    size_t m_back = 0; // first index after the gap
+
+    void grow(size_t count) {
+        const size_t back_size = m_items.size() - m_back;
+        std::vector<T> items(std::max(2 * size(), size() + count) + 16);
+        std::move(m_items.begin(), m_items.begin() + static_cast<ptrdiff_t>(m_gap), items.begin());
+        std::move(m_items.begin() + static_cast<ptrdiff_t>(m_back), m_items.end(),
+                  items.end() - static_cast<ptrdiff_t>(back_size));
+        m_back = items.size() - back_size;
+        m_items = std::move(items);
+    }
+
+public:
+    GapBuffer() = default;
+
+    explicit GapBuffer(std::vector<T> items) : m_items(std::move(items)), m_gap(m_items.size()), m_back(m_gap) {
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_items.size() - (m_back - m_gap);
+    }
+
+    [[nodiscard]] size_t gap() const {
+        return m_gap;
+    }
+
+    [[nodiscard]] std::span<const T> front() const {
+        return {m_items.data(), m_gap};
+    }
+
+    [[nodiscard]] std::span<const T> back() const {
+        return {m_items.data() + m_back, m_items.size() - m_back};
+    }
+
+    [[nodiscard]] const T &operator[](size_t index) const {
+        return m_items[index < m_gap ? index : index - m_gap + m_back];
+    }
+
+    // moves the gap to index, the elements it passes are handed to to_back when they end up after the gap and to
+    // to_front when they end up before it. Returns how many were moved
+    template<typename ToBack, typename ToFront>
+    size_t move_gap(size_t index, ToBack to_back, ToFront to_front) {
+        const size_t moved = index < m_gap ? m_gap - index : index - m_gap;
+        while (m_gap > index) {
+            m_gap--;
+            m_back--;
+            if (m_back != m_gap) {
+                m_items[m_back] = std::move(m_items[m_gap]);
+            }
+            to_back(m_items[m_back]);
+        }
+        while (m_gap < index) {
+            if (m_back != m_gap) {
+                m_items[m_gap] = std::move(m_items[m_back]);
+            }
+            to_front(m_items[m_gap]);
+            m_gap++;
+            m_back++;
+        }
+        return moved;
+    }
+
+    // removes the count elements after the gap
+    void erase(size_t count) {
+        m_back += count;
+    }
+
+    // inserts the elements before the gap
+    template<typename It>
+    void insert(It begin, It end) {
+        const auto count = static_cast<size_t>(std::distance(begin, end));
+        if (m_back - m_gap < count) {
+            grow(count);
+        }
+        for (; begin != end; ++begin) {
+            m_items[m_gap++] = *begin;
+        }
+    }
+
+    void clear() {
+        m_items.clear();
+        m_gap = 0;
+        m_back = 0;
+    }
+};
+
+// Front end for a program that is edited and compiled again and again, e.g. by an editor on every keystroke.
+// It keeps the tokens with their offsets in the source and the top-level statements with the token they start at.
+// After an edit only the tokens around it are lexed again, until the lexer reaches a point between tokens where the
+// old token stream had a token starting at the same text, and only the top-level statements around the changed
+// tokens are parsed again, until the parser reaches the start of an old statement. Every other statement keeps its
+// nodes. Tokens, offsets and statements are kept in gap buffers whose gaps sit at the last edit, and the entries after
+// a gap keep the positions they had when they were moved there: what the edits since then added is kept once for all
+// of them. So an edit takes time for the text it changed and the tokens between it and the previous edit, not for the
+// rest of the file, only the source text is moved as a whole by one memmove, as the lexer reads it in place.
+// Statements that moved to other lines get their line numbers updated when the program is asked for
+class IncrementalFrontend {
+public:
+    // work done by the last edit
+    struct EditStats {
+        size_t relexed_bytes = 0;
+        size_t relexed_tokens = 0;
+        size_t reparsed_stmts = 0;
+        size_t reused_stmts = 0;
+        size_t moved_tokens = 0; // tokens the gap passed on its way from the previous edit
+        bool reparsed_all = false; // the arena was full of replaced nodes, so the whole program was parsed again
+    };
+
+private:
+    struct Stmt {
+        NodeStmt *node;
+        size_t first_token;
+    };
+
+    Tokenizer m_tokenizer;
+    GapBuffer<Token> m_tokens;
+    GapBuffer<size_t> m_offsets; // offset of every token in the source
+    GapBuffer<Stmt> m_stmts;
+    // added to the entries after the gaps: the bytes and lines added before the tokens and the tokens added before the
+    // statements by the edits since the entries were moved there. The unsigned ones wrap around when text is removed
+    size_t m_offset_shift = 0;
+    int m_line_shift = 0;
+    size_t m_token_shift = 0;
+    std::unique_ptr<ArenaAllocator> m_allocator;
+    size_t m_replaced_tokens = 0; // tokens of statements whose nodes were replaced but still take up arena space
+    EditStats m_stats;
+
+    [[nodiscard]] size_t offset(size_t token) const {
+        return token < m_offsets.gap() ? m_offsets[token] : m_offsets[token] + m_offset_shift;
+    }
+
+    [[nodiscard]] int line(size_t token) const {
+        return token < m_tokens.gap() ? m_tokens[token].line : m_tokens[token].line + m_line_shift;
+    }
+
+    [[nodiscard]] size_t first_token(size_t stmt) const {
+        return stmt < m_stmts.gap() ? m_stmts[stmt].first_token : m_stmts[stmt].first_token + m_token_shift;
+    }
+
+    [[nodiscard]] TokenSpan token_span() const {
+        return {.front = m_tokens.front(), .back = m_tokens.back(), .back_line = m_line_shift};
+    }
+
+    // the first index in [0, count) for which below(index) is false, below has to be true for every index before it
+    template<typename Below>
+    static size_t partition_point(size_t count, Below below) {
+        size_t low = 0;
+        while (count > 0) {
+            const size_t half = count / 2;
+            if (below(low + half)) {
+                low += half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+        return low;
+    }
+
+    void move_token_gap(size_t index) {
+        m_stats.moved_tokens = m_tokens.move_gap(index, [&](Token &token) {
+            token.line -= m_line_shift;
+        }, [&](Token &token) {
+            token.line += m_line_shift;
+        });
+        m_offsets.move_gap(index, [&](size_t &offset) {
+            offset -= m_offset_shift;
+        }, [&](size_t &offset) {
+            offset += m_offset_shift;
+        });
+    }
+
+    void move_stmt_gap(size_t index) {
+        m_stmts.move_gap(index, [&](Stmt &stmt) {
+            stmt.first_token -= m_token_shift;
+        }, [&](Stmt &stmt) {
+            stmt.first_token += m_token_shift;
+        });
+    }
+
+    // parses top-level statements from the token at index until the end or until stop(token index) returns true
+    // at the start of a statement, returns whether it was stopped
+    template<typename Stop>
+    bool parse_stmts(size_t index, std::vector<Stmt> &stmts, Stop stop) {
+        Parser parser(token_span(), index, *m_allocator);
+        while (!parser.at_end()) {
+            if (stop(parser.index())) {
+                return true;
+            }
+            const size_t first_token = parser.index();
+            if (auto stmt = parser.parse_stmt()) {
+                stmts.push_back({.node = stmt.value(), .first_token = first_token});
+            } else {
+                parser.error_expected("statement");
+            }
+        }
+        return false;
+    }
+
+    // parses the whole program into a new arena, which frees the nodes of replaced statements
+    void parse_all() {
+        m_stmts.clear();
+        m_allocator = std::make_unique<ArenaAllocator>(1024 * 1024 * 4); // 4mb
+        m_replaced_tokens = 0;
+        std::vector<Stmt> stmts;
+        parse_stmts(0, stmts, [](size_t) {
+            return false;
+        });
+        m_stmts.insert(stmts.begin(), stmts.end());
+    }
+
+    static void shift_lines(NodeScope *scope, int delta) {
+        for (NodeStmt *stmt: scope->stmts) {
+            shift_lines(stmt, delta);
+        }
+    }
+
+    // moves the statement and everything in it by delta lines. Tokens copied into expressions keep their old line,
+    // nothing reads it after parsing
+    static void shift_lines(NodeStmt *stmt, int delta) {
+        stmt->line += delta;
+        if (auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+            shift_lines(*scope, delta);
+        } else if (auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+            shift_lines((*stmt_while)->scope, delta);
+        } else if (auto stmt_parallel = std::get_if<NodeStmtParallel *>(&stmt->var)) {
+            shift_lines((*stmt_parallel)->loop->scope, delta);
+        } else if (auto stmt_fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+            shift_lines((*stmt_fn)->scope, delta);
+        } else if (auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+            shift_lines((*stmt_if)->scope, delta);
+            std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+            while (pred.has_value()) {
+                if (auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                    (*elif)->line += delta;
+                    shift_lines((*elif)->scope, delta);
+                    pred = (*elif)->pred;
+                } else {
+                    shift_lines(std::get<NodeIfPredElse *>(pred.value()->var)->scope, delta);
+                    pred = {};
+                }
+            }
+        }
+    }
+
+    // lexes the text around an edit of [offset, offset + removed) into inserted_size bytes again and replaces the
+    // old tokens there, returns the range of old tokens [first, first + count) that were replaced
+    std::pair<size_t, size_t> relex(size_t offset, size_t removed, size_t inserted_size) {
+        const size_t old_end = offset + removed;
+        const size_t new_end = offset + inserted_size;
+        const size_t count = m_tokens.size();
+
+        // restart at the last token starting before the edit, the edit may extend it or turn it into a comment. With
+        // no token before the edit, restart at the start of the source: the old first token may lie past the edit
+        size_t first = partition_point(count, [&](size_t token) {
+            return this->offset(token) < offset;
+        });
+        size_t restart = 0;
+        int restart_line = 1;
+        if (first > 0) {
+            first--;
+            restart = this->offset(first);
+            restart_line = line(first);
+        }
+
+        // once past the edit, the tokens are the same as before from any point where the old lexer started a token
+        // at the same text: both lexers are outside of a comment there and see the same bytes from there on
+        size_t next = partition_point(count, [&](size_t token) {
+            return this->offset(token) < old_end;
+        });
+        Tokenizer::Chunk chunk = m_tokenizer.lex_from(restart, restart_line, [&](size_t pos) {
+            if (pos < new_end) {
+                return false;
+            }
+            while (next < count && this->offset(next) < pos - new_end + old_end) {
+                next++;
+            }
+            return next < count && this->offset(next) == pos - new_end + old_end;
+        });
+        if (chunk.end >= m_tokenizer.source().length()) {
+            next = count; // lexed up to the end, every old token from first on is replaced
+        }
+        m_stats.relexed_bytes = chunk.end - restart;
+        m_stats.relexed_tokens = chunk.tokens.size();
+
+        // the old tokens from first on are moved after the gap, where the edit moves them all by the same bytes and
+        // lines, and the ones up to next are replaced
+        const int line_delta = next < count ? chunk.end_line - line(next) : 0;
+        move_token_gap(first);
+        m_tokens.erase(next - first);
+        m_tokens.insert(std::make_move_iterator(chunk.tokens.begin()), std::make_move_iterator(chunk.tokens.end()));
+        m_offsets.erase(next - first);
+        m_offsets.insert(chunk.offsets.begin(), chunk.offsets.end());
+        m_offset_shift += new_end - old_end;
+        m_line_shift += line_delta;
+        return {first, next - first};
+    }
+
+public:
+    explicit IncrementalFrontend(std::string src) : m_tokenizer(std::move(src)) {
+        Tokenizer::Chunk chunk = m_tokenizer.lex_from(0, 1);
+        m_tokens = GapBuffer<Token>(std::move(chunk.tokens));
+        m_offsets = GapBuffer<size_t>(std::move(chunk.offsets));
+        parse_all();
+    }
+
+    // replaces `removed` bytes at offset with inserted and brings the tokens and statements up to date. When the new
+    // source doesn't lex or parse this throws and only source() stays valid, the frontend has to be made again from it
+    void edit(size_t offset, size_t removed, std::string_view inserted) {
+        const size_t length = m_tokenizer.source().length();
+        if (offset > length || removed > length - offset) {
+            throw CompileError({.stage = Diagnostic::Stage::system,
+                                .message = "Edit out of range: " + std::to_string(offset) + "+" + std::to_string(removed) +
+                                           " in " + std::to_string(length) + " bytes"});
+        }
+        m_stats = {};
+        m_tokenizer.replace(offset, removed, inserted);
+
+        const size_t old_token_count = m_tokens.size();
+        const auto [first, old_count] = relex(offset, removed, inserted.size());
+        const size_t new_count = m_tokens.size() - old_token_count + old_count;
+        const size_t changed_end = first + new_count; // tokens from here on are the old ones, moved by the edit
+
+        // a statement can look one token past its end (an if checks for elif or else), so parsing starts again at
+        // the statement holding the token before the first changed one, or at the start when the first one changed.
+        // The statements still count their tokens from before the edit
+        size_t from_stmt = 0;
+        if (first > 0) {
+            from_stmt = partition_point(m_stmts.size(), [&](size_t stmt) {
+                return first_token(stmt) < first;
+            });
+            from_stmt = from_stmt == 0 ? 0 : from_stmt - 1;
+        }
+        const size_t from_token = from_stmt > 0 ? first_token(from_stmt) : 0;
+        size_t next = partition_point(m_stmts.size(), [&](size_t stmt) {
+            return first_token(stmt) < first + old_count;
+        });
+
+        // the old statements from from_stmt on are moved after the gap, where the edit moves them all by the same
+        // number of tokens. They are the same as before from any of them starting after the changed tokens
+        move_stmt_gap(from_stmt);
+        m_token_shift += new_count - old_count;
+        std::vector<Stmt> reparsed;
+        const bool stopped = parse_stmts(from_token, reparsed, [&](size_t token) {
+            if (token < changed_end) {
+                return false;
+            }
+            while (next < m_stmts.size() && first_token(next) < token) {
+                next++;
+            }
+            return next < m_stmts.size() && first_token(next) == token;
+        });
+        if (!stopped) {
+            next = m_stmts.size();
+        }
+
+        const size_t reparsed_end = next < m_stmts.size() ? first_token(next) : m_tokens.size();
+        m_replaced_tokens += reparsed_end - new_count + old_count - from_token;
+        m_stmts.erase(next - from_stmt);
+        m_stmts.insert(reparsed.begin(), reparsed.end());
+        m_stats.reparsed_stmts = reparsed.size();
+        m_stats.reused_stmts = m_stmts.size() - reparsed.size();
+
+        // replaced nodes stay in the arena until everything is parsed into a new one
+        if (m_replaced_tokens > 2 * m_tokens.size() + 1024 * 64) {
+            parse_all();
+            m_stats.reparsed_all = true;
+        }
+    }
+
+    // the program as it is after the last edit, only valid until the next edit. Statements whose first token is on
+    // another line than their nodes say, because of edits before them, are moved to it here
+    [[nodiscard]] NodeProg program() {
+        NodeProg prog;
+        prog.stmts.reserve(m_stmts.size());
+        for (size_t i = 0; i < m_stmts.size(); i++) {
+            NodeStmt *node = m_stmts[i].node;
+            const int first_line = line(first_token(i));
+            if (node->line != first_line) {
+                shift_lines(node, first_line - node->line);
+            }
+            prog.stmts.push_back(node);
+        }
+        return prog;
+    }
+
+    [[nodiscard]] const std::string &source() const {
+        return m_tokenizer.source();
+    }
+
+    // the tokens with their lines, copied out of the gap buffer
+    [[nodiscard]] std::vector<Token> tokens() const {
+        const TokenSpan tokens = token_span();
+        std::vector<Token> copy;
+        copy.reserve(tokens.size());
+        for (size_t i = 0; i < tokens.size(); i++) {
+            copy.push_back(tokens.at(i));
+        }
+        return copy;
+    }
+
+    [[nodiscard]] const EditStats &last_edit() const {
+        return m_stats;
+    }
+};
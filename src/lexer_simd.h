@@ -0,0 +1,310 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Bulk character classification for the tokenizer. Runs of whitespace, identifier characters and digits and the ends
+// of comments are found 16 (SSE2) or 32 (AVX2) bytes at a time, newlines inside skipped text are counted with popcount.
+// The implementation is picked once at runtime from the CPU features, with a scalar fallback for other targets.
+// Classification is ASCII only, which matches the "C" locale the tokenizer always ran in.
+namespace lex {
+    inline bool is_space(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    inline bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    inline bool is_alpha(char c) {
+        return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+    }
+
+    inline bool is_alnum(char c) {
+        return is_digit(c) || is_alpha(c);
+    }
+
+    // every kernel starts at pos and returns the index of the first byte that ends the run (or len)
+    struct Kernels {
+        const char *name;
+        // skips whitespace, adding the newlines skipped to lines
+        size_t (*skip_space)(const char *src, size_t pos, size_t len, int &lines);
+        // skips letters and digits
+        size_t (*skip_alnum)(const char *src, size_t pos, size_t len);
+        // skips digits
+        size_t (*skip_digits)(const char *src, size_t pos, size_t len);
+        // finds the next newline
+        size_t (*find_newline)(const char *src, size_t pos, size_t len);
+        // finds the `*` of the next `*/`, adding the newlines before it to lines
+        size_t (*find_comment_end)(const char *src, size_t pos, size_t len, int &lines);
+    };
+
+    namespace scalar {
+        inline size_t skip_space(const char *src, size_t pos, size_t len, int &lines) {
+            while (pos < len && is_space(src[pos])) {
+                lines += src[pos] == '\n';
+                pos++;
+            }
+            return pos;
+        }
+
+        inline size_t skip_alnum(const char *src, size_t pos, size_t len) {
+            while (pos < len && is_alnum(src[pos])) {
+                pos++;
+            }
+            return pos;
+        }
+
+        inline size_t skip_digits(const char *src, size_t pos, size_t len) {
+            while (pos < len && is_digit(src[pos])) {
+                pos++;
+            }
+            return pos;
+        }
+
+        inline size_t find_newline(const char *src, size_t pos, size_t len) {
+            while (pos < len && src[pos] != '\n') {
+                pos++;
+            }
+            return pos;
+        }
+
+        inline size_t find_comment_end(const char *src, size_t pos, size_t len, int &lines) {
+            while (pos < len && !(src[pos] == '*' && pos + 1 < len && src[pos + 1] == '/')) {
+                lines += src[pos] == '\n';
+                pos++;
+            }
+            return pos;
+        }
+
+        const Kernels kernels = {"scalar", skip_space, skip_alnum, skip_digits, find_newline, find_comment_end};
+    }
+
+#if defined(__x86_64__)
+    // SSE2 is part of x86-64, so this is the baseline on every x86-64 CPU
+    namespace sse2 {
+        // unsigned `lo <= c <= hi` for every byte
+        inline __m128i in_range(__m128i c, char lo, char hi) {
+            const __m128i offset = _mm_sub_epi8(c, _mm_set1_epi8(lo));
+            return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(static_cast<char>(hi - lo))), offset);
+        }
+
+        inline unsigned space_mask(__m128i c) {
+            const __m128i space = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), in_range(c, '\t', '\r'));
+            return _mm_movemask_epi8(space);
+        }
+
+        inline unsigned digit_mask(__m128i c) {
+            return _mm_movemask_epi8(in_range(c, '0', '9'));
+        }
+
+        inline unsigned alnum_mask(__m128i c) {
+            const __m128i alpha = in_range(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 'z');
+            return _mm_movemask_epi8(_mm_or_si128(alpha, in_range(c, '0', '9')));
+        }
+
+        inline unsigned newline_mask(__m128i c) {
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+        }
+
+        inline __m128i load(const char *p) {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        }
+
+        inline size_t skip_space(const char *src, size_t pos, size_t len, int &lines) {
+            for (; pos + 16 <= len; pos += 16) {
+                const __m128i c = load(src + pos);
+                const unsigned stop = ~space_mask(c) & 0xFFFF;
+                const unsigned newlines = newline_mask(c);
+                if (stop != 0) {
+                    const int index = __builtin_ctz(stop);
+                    lines += __builtin_popcount(newlines & ((1u << index) - 1));
+                    return pos + index;
+                }
+                lines += __builtin_popcount(newlines);
+            }
+            return scalar::skip_space(src, pos, len, lines);
+        }
+
+        inline size_t skip_alnum(const char *src, size_t pos, size_t len) {
+            for (; pos + 16 <= len; pos += 16) {
+                const unsigned stop = ~alnum_mask(load(src + pos)) & 0xFFFF;
+                if (stop != 0) {
+                    return pos + __builtin_ctz(stop);
+                }
+            }
+            return scalar::skip_alnum(src, pos, len);
+        }
+
+        inline size_t skip_digits(const char *src, size_t pos, size_t len) {
+            for (; pos + 16 <= len; pos += 16) {
+                const unsigned stop = ~digit_mask(load(src + pos)) & 0xFFFF;
+                if (stop != 0) {
+                    return pos + __builtin_ctz(stop);
+                }
+            }
+            return scalar::skip_digits(src, pos, len);
+        }
+
+        inline size_t find_newline(const char *src, size_t pos, size_t len) {
+            for (; pos + 16 <= len; pos += 16) {
+                if (const unsigned found = newline_mask(load(src + pos))) {
+                    return pos + __builtin_ctz(found);
+                }
+            }
+            return scalar::find_newline(src, pos, len);
+        }
+
+        inline size_t find_comment_end(const char *src, size_t pos, size_t len, int &lines) {
+            // the second load is shifted by one byte so both halves of `*/` line up in the same lane
+            for (; pos + 17 <= len; pos += 16) {
+                const __m128i c = load(src + pos);
+                const unsigned star = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('*')));
+                const unsigned slash = _mm_movemask_epi8(_mm_cmpeq_epi8(load(src + pos + 1), _mm_set1_epi8('/')));
+                const unsigned newlines = newline_mask(c);
+                if (const unsigned found = star & slash) {
+                    const int index = __builtin_ctz(found);
+                    lines += __builtin_popcount(newlines & ((1u << index) - 1));
+                    return pos + index;
+                }
+                lines += __builtin_popcount(newlines);
+            }
+            return scalar::find_comment_end(src, pos, len, lines);
+        }
+
+        const Kernels kernels = {"sse2", skip_space, skip_alnum, skip_digits, find_newline, find_comment_end};
+    }
+
+    namespace avx2 {
+#define FLIT_AVX2 __attribute__((target("avx2")))
+
+        FLIT_AVX2 inline __m256i in_range(__m256i c, char lo, char hi) {
+            const __m256i offset = _mm256_sub_epi8(c, _mm256_set1_epi8(lo));
+            return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(static_cast<char>(hi - lo))), offset);
+        }
+
+        FLIT_AVX2 inline unsigned space_mask(__m256i c) {
+            const __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), in_range(c, '\t', '\r'));
+            return _mm256_movemask_epi8(space);
+        }
+
+        FLIT_AVX2 inline unsigned digit_mask(__m256i c) {
+            return _mm256_movemask_epi8(in_range(c, '0', '9'));
+        }
+
+        FLIT_AVX2 inline unsigned alnum_mask(__m256i c) {
+            const __m256i alpha = in_range(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), 'a', 'z');
+            return _mm256_movemask_epi8(_mm256_or_si256(alpha, in_range(c, '0', '9')));
+        }
+
+        FLIT_AVX2 inline unsigned newline_mask(__m256i c) {
+            return _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')));
+        }
+
+        FLIT_AVX2 inline __m256i load(const char *p) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        }
+
+        // masks are 32 bits wide, so the low bits below index are taken with a 64 bit shift
+        inline unsigned below(unsigned mask, int index) {
+            return mask & static_cast<unsigned>((uint64_t{1} << index) - 1);
+        }
+
+        FLIT_AVX2 inline size_t skip_space(const char *src, size_t pos, size_t len, int &lines) {
+            for (; pos + 32 <= len; pos += 32) {
+                const __m256i c = load(src + pos);
+                const unsigned stop = ~space_mask(c);
+                const unsigned newlines = newline_mask(c);
+                if (stop != 0) {
+                    const int index = __builtin_ctz(stop);
+                    lines += __builtin_popcount(below(newlines, index));
+                    return pos + index;
+                }
+                lines += __builtin_popcount(newlines);
+            }
+            return sse2::skip_space(src, pos, len, lines);
+        }
+
+        FLIT_AVX2 inline size_t skip_alnum(const char *src, size_t pos, size_t len) {
+            for (; pos + 32 <= len; pos += 32) {
+                const unsigned stop = ~alnum_mask(load(src + pos));
+                if (stop != 0) {
+                    return pos + __builtin_ctz(stop);
+                }
+            }
+            return sse2::skip_alnum(src, pos, len);
+        }
+
+        FLIT_AVX2 inline size_t skip_digits(const char *src, size_t pos, size_t len) {
+            for (; pos + 32 <= len; pos += 32) {
+                const unsigned stop = ~digit_mask(load(src + pos));
+                if (stop != 0) {
+                    return pos + __builtin_ctz(stop);
+                }
+            }
+            return sse2::skip_digits(src, pos, len);
+        }
+
+        FLIT_AVX2 inline size_t find_newline(const char *src, size_t pos, size_t len) {
+            for (; pos + 32 <= len; pos += 32) {
+                if (const unsigned found = newline_mask(load(src + pos))) {
+                    return pos + __builtin_ctz(found);
+                }
+            }
+            return sse2::find_newline(src, pos, len);
+        }
+
+        FLIT_AVX2 inline size_t find_comment_end(const char *src, size_t pos, size_t len, int &lines) {
+            for (; pos + 33 <= len; pos += 32) {
+                const __m256i c = load(src + pos);
+                const unsigned star = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('*')));
+                const unsigned slash = _mm256_movemask_epi8(_mm256_cmpeq_epi8(load(src + pos + 1), _mm256_set1_epi8('/')));
+                const unsigned newlines = newline_mask(c);
+                if (const unsigned found = star & slash) {
+                    const int index = __builtin_ctz(found);
+                    lines += __builtin_popcount(below(newlines, index));
+                    return pos + index;
+                }
+                lines += __builtin_popcount(newlines);
+            }
+            return sse2::find_comment_end(src, pos, len, lines);
+        }
+
+#undef FLIT_AVX2
+
+        const Kernels kernels = {"avx2", skip_space, skip_alnum, skip_digits, find_newline, find_comment_end};
+    }
+#endif
+
+    // picks the widest implementation the CPU supports, FLIT_LEX_ISA=scalar|sse2|avx2 forces one (for testing)
+    inline const Kernels &select_kernels() {
+        const char *forced = std::getenv("FLIT_LEX_ISA");
+#if defined(__x86_64__)
+        if (forced != nullptr && std::strcmp(forced, "scalar") == 0) {
+            return scalar::kernels;
+        }
+        if (forced != nullptr && std::strcmp(forced, "sse2") == 0) {
+            return sse2::kernels;
+        }
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return avx2::kernels;
+        }
+        return sse2::kernels;
+#else
+        (void) forced;
+        return scalar::kernels;
+#endif
+    }
+
+    inline const Kernels &kernels() {
+        static const Kernels &selected = select_kernels();
+        return selected;
+    }
+}
@@ -1,56 +1,217 @@
+#include <charconv>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <optional>
 #include <vector>
 
-#include "generator.h"
+#include "flit.h"
+#include "server.h"
 
-int main(int argc, char *argv[]) {
+void print_usage() {
+    std::cerr << "Incorrect Usage. Correct Usage is:" << std::endl;
+    std::cerr << "flit [options] <input.flt>" << std::endl;
+    std::cerr << "flit --serve <socket>" << std::endl;
+    std::cerr << "options:" << std::endl;
+    std::cerr << "    -o <output>          name of the executable to produce (default out)" << std::endl;
+    std::cerr << "    -g                   emit DWARF line info mapping the executable back to the .flt source" << std::endl;
+    std::cerr << "    -S                   only write the assembly to <output>.asm" << std::endl;
+    std::cerr << "    --emit-ast           only write the parsed program to <output>.ast, which can be the input later" << std::endl;
+    std::cerr << "    --no-run             only build the executable, don't run it" << std::endl;
+    std::cerr << "    --no-avx2            vectorized loops only use SSE2, even where the CPU has AVX2" << std::endl;
+    std::cerr << "    --instrument         count how often branches run and write the counts to <output>.profile at exit" << std::endl;
+    std::cerr << "    --profile-use=<f>    lay out branches and loops by the counts in profile f, can be repeated" << std::endl;
+    std::cerr << "    --lex-threads=<n>    threads used to tokenize, 0 picks by input size (default 0)" << std::endl;
+    std::cerr << "    --gen-threads=<n>    threads used to generate code, 0 picks by program size (default 0)" << std::endl;
+    std::cerr << "    -O0 | -O1 | -O2      optimization level, picks the passes that run (default -O0)" << std::endl;
+    std::cerr << "    --enable-pass=<p>    run pass p regardless of the optimization level" << std::endl;
+    std::cerr << "    --disable-pass=<p>   don't run pass p regardless of the optimization level" << std::endl;
+    std::cerr << "    --time-passes        print the time and number of changes of every pass" << std::endl;
+    std::cerr << "    --partial-eval       same as --enable-pass=partial-eval" << std::endl;
+    std::cerr << "    --eval-steps=<n>     maximum number of statements and expression nodes evaluated (default 1000000)" << std::endl;
+    std::cerr << "    --eval-memory=<n>    maximum bytes of output and variables held while evaluating (default 16777216)" << std::endl;
+    std::cerr << "    --serve <socket>     run as a compile server listening on a Unix domain socket" << std::endl;
+    std::cerr << "    --connect <socket>   compile through the server (also FLIT_SERVER=<socket>), in-process if it is down" << std::endl;
+}
 
-    // if there are no arguments then throw error
-    if (argc != 2) {
-        std::cerr << "Incorrect Usage. Correct Usage is:" << std::endl;
-        std::cerr << "flit <input.flt>" << std::endl;
-        return EXIT_FAILURE;
+// reads the number after the = of an option into value, false if it isn't a whole number
+template<typename T>
+bool option_number(const std::string &arg, T &value) {
+    const char *begin = arg.data() + arg.find('=') + 1;
+    const char *end = arg.data() + arg.size();
+    auto [ptr, ec] = std::from_chars(begin, end, value);
+    return ec == std::errc() && ptr == end;
+}
+
+// prints why a stage failed the way the errors were always printed, returns whether it succeeded
+template<typename T>
+bool succeeded(const flit::Result<T> &result) {
+    for (const Diagnostic &diagnostic: result.diagnostics) {
+        std::cerr << diagnostic.message << std::endl;
     }
+    return result.ok();
+}
 
-    // reading input from a file
-    std::string contents;
-    // we are using this brackets to define scope so that it will automatically close the file when the scope ends
-    {
-        // read the input file into contents
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
-    } // after this bracket the file will be automatically closed because of scope resolution
+// compiles (and runs) as the command line says, artifact is set to the file that was written
+int compile(const std::vector<std::string> &args, std::optional<std::string> &artifact) {
 
-    // now we will generate token for the input file
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
+    std::optional<std::string> input_path;
+    std::string output_path = "out";
+    bool run = true;
+    bool emit_asm = false;
+    bool emit_ast = false;
+    bool time_passes = false;
+    bool instrument = false;
+    unsigned lex_threads = 0;
+    flit::Options options{.threads = 0};
 
-    // now lets parse all the tokens
-    Parser parser(std::move(tokens));
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string &arg = args[i];
+        if (arg == "-o" && i + 1 < args.size()) {
+            output_path = args[++i];
+        } else if (arg == "-g") {
+            options.debug_info = true;
+        } else if (arg == "-S") {
+            emit_asm = true;
+        } else if (arg == "--emit-ast") {
+            emit_ast = true;
+        } else if (arg == "--instrument") {
+            instrument = true;
+        } else if (arg.starts_with("--profile-use=")) {
+            options.profiles.push_back(arg.substr(arg.find('=') + 1));
+        } else if (arg == "--no-run") {
+            run = false;
+        } else if (arg == "--no-avx2") {
+            options.avx2 = false;
+        } else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            options.opt_level = arg[2] - '0';
+        } else if (arg.starts_with("--enable-pass=")) {
+            options.passes.emplace_back(arg.substr(arg.find('=') + 1), true);
+        } else if (arg.starts_with("--disable-pass=")) {
+            options.passes.emplace_back(arg.substr(arg.find('=') + 1), false);
+        } else if (arg.starts_with("--lex-threads=")) {
+            if (!option_number(arg, lex_threads)) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (arg.starts_with("--gen-threads=")) {
+            if (!option_number(arg, options.threads)) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--time-passes") {
+            time_passes = true;
+        } else if (arg == "--partial-eval") {
+            options.passes.emplace_back("partial-eval", true);
+        } else if (arg.starts_with("--eval-steps=")) {
+            if (!option_number(arg, options.eval_steps)) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (arg.starts_with("--eval-memory=")) {
+            if (!option_number(arg, options.eval_memory)) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (!arg.starts_with("-") && !input_path.has_value()) {
+            input_path = arg;
+        } else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
 
-    // make a root node of tree for parser
-    std::optional<NodeProg> prog = parser.parse_prog();
-    if (!prog.has_value()) {
-        std::cerr << "Invalid Code! Please fix the error and try again." << std::endl;
-        exit(EXIT_FAILURE);
+    // if there is no input file then throw error
+    if (!input_path.has_value()) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    options.lex_threads = lex_threads;
+    if (time_passes) {
+        options.pass_report = &std::cerr;
+    }
+    if (instrument) {
+        options.instrument = std::filesystem::absolute(output_path + ".profile").string();
     }
 
-    // generate assembly code based using root node of the parse tree
-    {
-        Generator generator(prog.value());
+    // a source is tokenized and parsed, a precompiled AST skips both
+    flit::Result<flit::Ast> ast = flit::parse_file(input_path.value(), options);
+    if (!succeeded(ast)) {
+        return EXIT_FAILURE;
+    }
+
+    if (emit_ast) {
+        flit::Result<std::string> ast_bytes = flit::write_ast(ast.value.value());
+        if (!succeeded(ast_bytes)) {
+            return EXIT_FAILURE;
+        }
+        std::fstream file(output_path + ".ast", std::ios::out | std::ios::binary);
+        file << ast_bytes.value.value();
+        artifact = std::filesystem::absolute(output_path + ".ast").string();
+        return EXIT_SUCCESS;
+    }
+
+    if (emit_asm) {
         // this will make an output file with assembly code
-        std::fstream file("out.asm", std::ios::out);
-        file << generator.gen_prog();
+        flit::Result<std::string> assembly = flit::compile_to_asm(std::move(ast.value.value()), options);
+        if (!succeeded(assembly)) {
+            return EXIT_FAILURE;
+        }
+        std::fstream file(output_path + ".asm", std::ios::out);
+        file << assembly.value.value();
+        artifact = std::filesystem::absolute(output_path + ".asm").string();
+        return EXIT_SUCCESS;
+    }
+
+    // the assembly and the object file only ever live in memory
+    flit::Result<flit::Image> image = flit::compile_to_image(std::move(ast.value.value()), options);
+    if (!succeeded(image)) {
+        return EXIT_FAILURE;
+    }
+    flit::Result<std::string> saved = image.value->save(output_path);
+    if (!succeeded(saved)) {
+        return EXIT_FAILURE;
     }
+    artifact = saved.value;
+
+    if (!run) {
+        return EXIT_SUCCESS;
+    }
+    // run the program directly (no shell) and pass its exit code on
+    flit::Result<int> code = image.value->run();
+    return succeeded(code) ? code.value.value() : EXIT_FAILURE;
+}
+
+// compiles a small program, so the requests a server handles start with the allocator, the iostreams and the SIMD
+// kernel choice already set up
+void warm_up() {
+    flit::compile_to_asm("let x = (1 + 2) * 3; /* warm up */ if (x) { print(x); } else { exit(x / 2); }");
+}
 
-    // execute the assembly code and make an output file from it (machine code)
-    system("nasm -felf64 out.asm");
-    system("ld -o out out.o");
-    system("./out");
-    return EXIT_SUCCESS;
+int main(int argc, char *argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    std::optional<std::string> server_socket;
+    if (const char *env = std::getenv("FLIT_SERVER"); env != nullptr && env[0] != '\0') {
+        server_socket = env;
+    }
+    for (size_t i = 0; i + 1 < args.size(); i++) {
+        if (args[i] == "--serve") {
+            return server::serve(args[i + 1], compile, warm_up);
+        }
+        if (args[i] == "--connect") {
+            server_socket = args[i + 1];
+            args.erase(args.begin() + i, args.begin() + i + 2);
+            break;
+        }
+    }
+
+    // forward to the compile server if there is one, and compile here if it can't be reached
+    if (server_socket.has_value()) {
+        if (std::optional<int> code = server::forward(server_socket.value(), args)) {
+            return code.value();
+        }
+    }
+    std::optional<std::string> artifact;
+    return compile(args, artifact);
 }
\ No newline at end of file
@@ -1,15 +1,44 @@
 #pragma once
 
+#include <memory>
+#include <span>
+#include <stdexcept>
 #include <variant>
 #include "tokenizer.h"
 #include "arena.h"
 #include "structures/ast_nodes.h"
 
+// tokens a parser reads: one array, or the parts of a gap buffer before and after its gap, where the tokens after the
+// gap are stored with their lines off by back_line
+struct TokenSpan {
+    std::span<const Token> front;
+    std::span<const Token> back{};
+    int back_line = 0;
+
+    [[nodiscard]] size_t size() const {
+        return front.size() + back.size();
+    }
+
+    [[nodiscard]] Token at(size_t index) const {
+        if (index < front.size()) {
+            return front[index];
+        }
+        if (index >= size()) {
+            throw std::out_of_range("token index out of range");
+        }
+        Token token = back[index - front.size()];
+        token.line += back_line;
+        return token;
+    }
+};
+
 class Parser {
 private:
-    const std::vector<Token> m_tokens;
+    std::vector<Token> m_own_tokens;
+    TokenSpan m_tokens;
     size_t m_index = 0;
-    ArenaAllocator m_allocator;
+    std::unique_ptr<ArenaAllocator> m_own_allocator;
+    ArenaAllocator &m_allocator;
 
     [[nodiscard]] std::optional<Token> peek(int offset = 0) const {
         if (m_index + offset >= m_tokens.size()) {
@@ -41,16 +70,45 @@ private:
 
 public:
     explicit Parser(std::vector<Token> tokens) :
-            m_tokens(std::move(tokens)),
-            m_allocator(1024 * 1024 * 4) // 4mb
+            m_own_tokens(std::move(tokens)),
+            m_tokens({.front = m_own_tokens}),
+            m_own_allocator(std::make_unique<ArenaAllocator>(1024 * 1024 * 4)), // 4mb
+            m_allocator(*m_own_allocator)
+    {
+    }
+
+    // parses tokens owned by the caller starting at index, the nodes are allocated in the caller's arena and
+    // outlive the parser. Used to reparse part of a program after an edit
+    Parser(TokenSpan tokens, size_t index, ArenaAllocator &allocator) :
+            m_tokens(tokens),
+            m_index(index),
+            m_allocator(allocator)
     {
     }
 
-    void error_expected(const std::string &msg) {
-        std::cerr << "[Parsing Error] Expected `" << msg << "` on line " << peek(-1).value().line << std::endl;
-        exit(EXIT_FAILURE);
+    // the tokens and the arena may be referenced, so a copy would point into the original
+    Parser(const Parser &other) = delete;
+
+    Parser &operator=(const Parser &other) = delete;
+
+    // index of the next token to parse
+    [[nodiscard]] size_t index() const {
+        return m_index;
+    }
+
+    [[nodiscard]] bool at_end() const {
+        return m_index >= m_tokens.size();
     }
 
+    [[noreturn]] void error_expected(const std::string &msg) {
+        // the line of the last token that was read, or of the first one when nothing was read yet
+        const int line = m_index > 0 ? m_tokens.at(m_index - 1).line : peek().has_value() ? peek().value().line : 0;
+        throw CompileError({.stage = Diagnostic::Stage::parse,
+                            .message = "[Parsing Error] Expected `" + msg + "` on line " + std::to_string(line),
+                            .line = line});
+    }
+
+    // parses an integer literal, identifier, array element or length, parenthesis are handled by parse_expr
     std::optional<NodeTerm *> parse_term() {
         if (auto int_lit = try_consume(TokenType::int_lit)) { // if integer
             auto term_int_lit = m_allocator.alloc<NodeTermIntLit>();
@@ -60,97 +118,197 @@ public:
             term->var = term_int_lit;
             return term;
         }
-        if (auto ident = try_consume(TokenType::ident)) { // if identifier
-            auto term_ident = m_allocator.alloc<NodeTermIdent>();
-            term_ident->ident = ident.value();
+        if (peek().has_value() && peek().value().type == TokenType::ident && peek(1).has_value() &&
+            peek(1).value().type == TokenType::open_bracket) {
+            auto term_index = m_allocator.alloc<NodeTermIndex>();
+            term_index->ident = consume();
+            consume(); // consume open bracket
+
+            // the index is a whole expression, only nested indexing recurses
+            if (auto index = parse_expr()) {
+                term_index->index = index.value();
+            } else {
+                error_expected("expression");
+            }
+            try_consume_err(TokenType::close_bracket);
 
             auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_ident;
+            term->var = term_index;
             return term;
         }
-        if (auto open_paren = try_consume(TokenType::open_paren)) {
-            auto expr = parse_expr();
-            if (!expr.has_value()) {
-                error_expected("expression");
+        if (try_consume(TokenType::len)) {
+            try_consume_err(TokenType::open_paren);
+            auto term_len = m_allocator.alloc<NodeTermLen>();
+            term_len->ident = try_consume_err(TokenType::ident);
+            try_consume_err(TokenType::close_paren);
+
+            auto term = m_allocator.alloc<NodeTerm>();
+            term->var = term_len;
+            return term;
+        }
+        if (peek().has_value() && peek().value().type == TokenType::ident && peek(1).has_value() &&
+            peek(1).value().type == TokenType::open_paren) {
+            auto term_call = m_allocator.alloc<NodeTermCall>();
+            term_call->ident = consume();
+            consume(); // consume open parenthesis
+
+            // the arguments are whole expressions, only nested calls recurse
+            if (auto arg = parse_expr()) {
+                term_call->args.push_back(arg.value());
+                while (try_consume(TokenType::comma)) {
+                    if (auto next = parse_expr()) {
+                        term_call->args.push_back(next.value());
+                    } else {
+                        error_expected("expression");
+                    }
+                }
             }
             try_consume_err(TokenType::close_paren);
 
-            auto term_paren = m_allocator.alloc<NodeTermParen>();
-            term_paren->expr = expr.value();
             auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_paren;
+            term->var = term_call;
+            return term;
+        }
+        if (auto ident = try_consume(TokenType::ident)) { // if identifier
+            auto term_ident = m_allocator.alloc<NodeTermIdent>();
+            term_ident->ident = ident.value();
 
+            auto term = m_allocator.alloc<NodeTerm>();
+            term->var = term_ident;
             return term;
         }
         return {};
     }
 
-    std::optional<NodeExpr *> parse_expr(int min_prec = 0) {
+    // shunting-yard parser: operands and pending operators live on explicit stacks instead of the native stack,
+    // so deeply nested parenthesis or long operator chains are parsed in linear time without recursion
+    std::optional<NodeExpr *> parse_expr() {
+        // an entry without an operator marks an open parenthesis
+        struct PendingOp {
+            std::optional<TokenType> op;
+            int prec;
+        };
+        std::vector<NodeExpr *> operands;
+        std::vector<PendingOp> ops;
+        size_t open_parens = 0;
+
+        // pops the top operator and combines the two topmost operands into a binary expression
+        const auto reduce = [&]() {
+            const TokenType op = ops.back().op.value();
+            ops.pop_back();
+            NodeExpr *expr_rhs = operands.back();
+            operands.pop_back();
+            NodeExpr *expr_lhs = operands.back();
 
-        std::optional<NodeTerm *> term_lhs = parse_term();
-        if (!term_lhs.has_value()) {
-            return {};
-        }
-        auto expr_lhs = m_allocator.alloc<NodeExpr>();
-        expr_lhs->var = term_lhs.value();
+            auto expr = m_allocator.alloc<NodeBinExpr>();
+            const auto make = [&](auto *bin) {
+                bin->lhs = expr_lhs;
+                bin->rhs = expr_rhs;
+                expr->var = bin;
+            };
+            switch (op) {
+                case TokenType::plus:
+                    make(m_allocator.alloc<NodeBinExprAdd>());
+                    break;
+                case TokenType::minus:
+                    make(m_allocator.alloc<NodeBinExprMinus>());
+                    break;
+                case TokenType::multi:
+                    make(m_allocator.alloc<NodeBinExprMulti>());
+                    break;
+                case TokenType::div:
+                    make(m_allocator.alloc<NodeBinExprDiv>());
+                    break;
+                case TokenType::eq_eq:
+                    make(m_allocator.alloc<NodeBinExprEq>());
+                    break;
+                case TokenType::bang_eq:
+                    make(m_allocator.alloc<NodeBinExprNotEq>());
+                    break;
+                case TokenType::less:
+                    make(m_allocator.alloc<NodeBinExprLess>());
+                    break;
+                case TokenType::less_eq:
+                    make(m_allocator.alloc<NodeBinExprLessEq>());
+                    break;
+                case TokenType::greater:
+                    make(m_allocator.alloc<NodeBinExprGreater>());
+                    break;
+                case TokenType::greater_eq:
+                    make(m_allocator.alloc<NodeBinExprGreaterEq>());
+                    break;
+                case TokenType::and_and:
+                    make(m_allocator.alloc<NodeBinExprAnd>());
+                    break;
+                case TokenType::or_or:
+                    make(m_allocator.alloc<NodeBinExprOr>());
+                    break;
+                default:
+                    assert(false); // unreachable
+            }
 
-        while (true) {
-            std::optional<Token> curr_token = peek();
-            std::optional<int> prec;
+            auto expr_bin = m_allocator.alloc<NodeExpr>();
+            expr_bin->var = expr;
+            operands.back() = expr_bin;
+        };
 
-            if (curr_token.has_value()) {
-                prec = bin_prec(curr_token->type);
-                if (!prec.has_value() || prec < min_prec) {
-                    break;
+        while (true) {
+            // expecting an operand, which can be preceded by any number of open parenthesis
+            while (try_consume(TokenType::open_paren)) {
+                ops.push_back({.op = {}, .prec = -1});
+                open_parens++;
+            }
+            std::optional<NodeTerm *> term = parse_term();
+            if (!term.has_value()) {
+                if (operands.empty() && ops.empty()) {
+                    return {};
                 }
-            } else {
-                break;
+                error_expected("expression");
+            }
+            auto expr_term = m_allocator.alloc<NodeExpr>();
+            expr_term->var = term.value();
+            operands.push_back(expr_term);
+
+            // expecting an operator or the closing of a parenthesis
+            while (open_parens > 0 && peek().has_value() && peek().value().type == TokenType::close_paren) {
+                consume();
+                while (ops.back().op.has_value()) {
+                    reduce();
+                }
+                ops.pop_back();
+                open_parens--;
+
+                auto term_paren = m_allocator.alloc<NodeTermParen>();
+                term_paren->expr = operands.back();
+                auto paren = m_allocator.alloc<NodeTerm>();
+                paren->var = term_paren;
+                auto expr_paren = m_allocator.alloc<NodeExpr>();
+                expr_paren->var = paren;
+                operands.back() = expr_paren;
             }
 
-            Token op = consume();
-            int next_min_prec = prec.value() + 1;
-            auto expr_rhs = parse_expr(next_min_prec);
-            if (!expr_rhs.has_value()) {
-                error_expected("expression");
+            std::optional<int> prec;
+            if (peek().has_value()) {
+                prec = bin_prec(peek().value().type);
+            }
+            if (!prec.has_value()) {
+                break;
             }
 
-            auto expr = m_allocator.alloc<NodeBinExpr>();
-            auto expr_lhs2 = m_allocator.alloc<NodeExpr>();
-
-            if (op.type == TokenType::plus) {
-                auto add = m_allocator.alloc<NodeBinExprAdd>();
-                expr_lhs2->var = expr_lhs->var;
-
-                add->lhs = expr_lhs2;
-                add->rhs = expr_rhs.value();
-                expr->var = add;
-            } else if (op.type == TokenType::minus) {
-                auto sub = m_allocator.alloc<NodeBinExprMinus>();
-                expr_lhs2->var = expr_lhs->var;
-
-                sub->lhs = expr_lhs2;
-                sub->rhs = expr_rhs.value();
-                expr->var = sub;
-            } else if (op.type == TokenType::multi) {
-                auto multi = m_allocator.alloc<NodeBinExprMulti>();
-                expr_lhs2->var = expr_lhs->var;
-
-                multi->lhs = expr_lhs2;
-                multi->rhs = expr_rhs.value();
-                expr->var = multi;
-            } else if (op.type == TokenType::div) {
-                auto div = m_allocator.alloc<NodeBinExprDiv>();
-                expr_lhs2->var = expr_lhs->var;
-
-                div->lhs = expr_lhs2;
-                div->rhs = expr_rhs.value();
-                expr->var = div;
-            } else {
-                assert(false); // unreachable
+            // every operator is left associative, so pending operators with same or higher precedence are applied first
+            while (!ops.empty() && ops.back().op.has_value() && ops.back().prec >= prec.value()) {
+                reduce();
             }
-            expr_lhs->var = expr;
+            ops.push_back({.op = consume().type, .prec = prec.value()});
         }
-        return expr_lhs;
+
+        if (open_parens > 0) {
+            try_consume_err(TokenType::close_paren);
+        }
+        while (!ops.empty()) {
+            reduce();
+        }
+        return operands.back();
     }
 
     std::optional<NodeScope *> parse_scope() {
@@ -166,8 +324,9 @@ public:
     }
 
     std::optional<NodeIfPred *> parse_if_pred() {
-        if (try_consume(TokenType::elif)) {
+        if (auto elif = try_consume(TokenType::elif)) {
             auto elif_pred = m_allocator.alloc<NodeIfPredElif>();
+            elif_pred->line = elif.value().line;
 
             try_consume_err(TokenType::open_paren);
             if (auto expr = parse_expr()) {
@@ -205,6 +364,9 @@ public:
     }
 
     std::optional<NodeStmt *> parse_stmt() {
+        // line of the first token, kept on the statement for diagnostics and debug info
+        const int line = peek().has_value() ? peek().value().line : 0;
+
         // for exit token
         if (peek().has_value() && peek().value().type == TokenType::exit && peek(1).has_value() &&
             peek(1).value().type == TokenType::open_paren) {
@@ -223,6 +385,7 @@ public:
 
             auto node_stmt = m_allocator.alloc<NodeStmt>();
             node_stmt->var = stmt_exit;
+            node_stmt->line = line;
             return node_stmt;
         }
         if (peek().has_value() && peek().value().type == TokenType::let && peek(1).has_value() &&
@@ -243,6 +406,24 @@ public:
             try_consume_err(TokenType::semi);
             auto node_stmt = m_allocator.alloc<NodeStmt>();
             node_stmt->var = stmt_let;
+            node_stmt->line = line;
+            return node_stmt;
+        }
+        if (peek().has_value() && peek().value().type == TokenType::let && peek(1).has_value() &&
+            peek(1).value().type == TokenType::ident && peek(2).has_value() &&
+            peek(2).value().type == TokenType::open_bracket) {
+
+            consume(); // consumes let token
+            auto stmt_let_array = m_allocator.alloc<NodeStmtLetArray>();
+            stmt_let_array->ident = consume(); // consumes array name
+            consume(); // consumes open bracket
+            stmt_let_array->size = try_consume_err(TokenType::int_lit); // the size has to be known at compile time
+            try_consume_err(TokenType::close_bracket);
+            try_consume_err(TokenType::semi);
+
+            auto node_stmt = m_allocator.alloc<NodeStmt>();
+            node_stmt->var = stmt_let_array;
+            node_stmt->line = line;
             return node_stmt;
         }
         if (peek().has_value() && peek().value().type == TokenType::ident && peek(1).has_value() &&
@@ -261,6 +442,70 @@ public:
 
             auto node_stmt = m_allocator.alloc<NodeStmt>();
             node_stmt->var = assign_var;
+            node_stmt->line = line;
+            return node_stmt;
+        }
+        if (peek().has_value() && peek().value().type == TokenType::ident && peek(1).has_value() &&
+            peek(1).value().type == TokenType::open_bracket) {
+
+            auto assign_index = m_allocator.alloc<NodeStmtAssignIndex>();
+            assign_index->ident = consume();
+            consume(); // consume open bracket
+
+            if (auto index = parse_expr()) {
+                assign_index->index = index.value();
+            } else {
+                error_expected("expression");
+            }
+            try_consume_err(TokenType::close_bracket);
+            try_consume_err(TokenType::eq);
+
+            if (auto expr = parse_expr()) {
+                assign_index->expr = expr.value();
+            } else {
+                error_expected("Variable Assignment");
+            }
+            try_consume_err(TokenType::semi);
+
+            auto node_stmt = m_allocator.alloc<NodeStmt>();
+            node_stmt->var = assign_index;
+            node_stmt->line = line;
+            return node_stmt;
+        }
+        if (try_consume(TokenType::fn)) {
+            auto stmt_fn = m_allocator.alloc<NodeStmtFn>();
+            stmt_fn->ident = try_consume_err(TokenType::ident);
+            try_consume_err(TokenType::open_paren);
+            if (auto param = try_consume(TokenType::ident)) {
+                stmt_fn->params.push_back(param.value());
+                while (try_consume(TokenType::comma)) {
+                    stmt_fn->params.push_back(try_consume_err(TokenType::ident));
+                }
+            }
+            try_consume_err(TokenType::close_paren);
+            if (auto scope = parse_scope()) {
+                stmt_fn->scope = scope.value();
+            } else {
+                error_expected("scope");
+            }
+
+            auto node_stmt = m_allocator.alloc<NodeStmt>();
+            node_stmt->var = stmt_fn;
+            node_stmt->line = line;
+            return node_stmt;
+        }
+        if (try_consume(TokenType::return_)) {
+            auto stmt_return = m_allocator.alloc<NodeStmtReturn>();
+            if (auto node_expr = parse_expr()) {
+                stmt_return->expr = node_expr.value();
+            } else {
+                error_expected("expression");
+            }
+            try_consume_err(TokenType::semi);
+
+            auto node_stmt = m_allocator.alloc<NodeStmt>();
+            node_stmt->var = stmt_return;
+            node_stmt->line = line;
             return node_stmt;
         }
         if (peek().has_value() && peek().value().type == TokenType::print && peek(1).has_value() &&
@@ -280,12 +525,14 @@ public:
 
             auto node_stmt = m_allocator.alloc<NodeStmt>();
             node_stmt->var = stmt_print;
+            node_stmt->line = line;
             return node_stmt;
         }
         if (peek().has_value() && peek().value().type == TokenType::open_curly) {
             if (auto scope = parse_scope()) {
                 auto stmt = m_allocator.alloc<NodeStmt>();
                 stmt->var = scope.value();
+                stmt->line = line;
                 return stmt;
             }
             error_expected("scope");
@@ -310,6 +557,7 @@ public:
             stmt_if->pred = parse_if_pred();
             auto stmt = m_allocator.alloc<NodeStmt>();
             stmt->var = stmt_if;
+            stmt->line = line;
             return stmt;
         }
         if (try_consume(TokenType::while_)) {
@@ -330,6 +578,50 @@ public:
 
             auto stmt = m_allocator.alloc<NodeStmt>();
             stmt->var = stmt_while;
+            stmt->line = line;
+            return stmt;
+        }
+        if (try_consume(TokenType::parallel)) {
+            try_consume_err(TokenType::while_);
+            try_consume_err(TokenType::open_paren);
+            auto stmt_parallel = m_allocator.alloc<NodeStmtParallel>();
+            stmt_parallel->loop = m_allocator.alloc<NodeStmtWhile>();
+            if (auto expr = parse_expr()) {
+                stmt_parallel->loop->expr = expr.value();
+            } else {
+                error_expected("expression");
+            }
+            try_consume_err(TokenType::close_paren);
+
+            if (try_consume(TokenType::reduce)) {
+                try_consume_err(TokenType::open_paren);
+                do {
+                    NodeReduction reduction{};
+                    const Token op = try_consume_err(TokenType::ident);
+                    if (op.value == "sum") {
+                        reduction.op = NodeReduction::Op::sum;
+                    } else if (op.value == "min") {
+                        reduction.op = NodeReduction::Op::min;
+                    } else if (op.value == "max") {
+                        reduction.op = NodeReduction::Op::max;
+                    } else {
+                        error_expected("sum`, `min` or `max");
+                    }
+                    reduction.ident = try_consume_err(TokenType::ident);
+                    stmt_parallel->reductions.push_back(std::move(reduction));
+                } while (try_consume(TokenType::comma));
+                try_consume_err(TokenType::close_paren);
+            }
+
+            if (auto scope = parse_scope()) {
+                stmt_parallel->loop->scope = scope.value();
+            } else {
+                error_expected("scope");
+            }
+
+            auto stmt = m_allocator.alloc<NodeStmt>();
+            stmt->var = stmt_parallel;
+            stmt->line = line;
             return stmt;
         }
         return {};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include "pass.h"
+
+// replaces binary expressions whose operands are both integer literals with the literal they evaluate to, and `&&`
+// and `||` whose lhs already decides the result
+class ConstantFoldPass : public Pass {
+private:
+    // the literal an expression is, looking through parenthesis
+    static std::optional<uint64_t> literal_value(const NodeExpr *expr) {
+        while (true) {
+            auto term = std::get_if<NodeTerm *>(&expr->var);
+            if (term == nullptr) {
+                return {};
+            }
+            if (auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+                expr = (*term_paren)->expr;
+                continue;
+            }
+            auto term_int_lit = std::get_if<NodeTermIntLit *>(&(*term)->var);
+            if (term_int_lit == nullptr) {
+                return {};
+            }
+            const std::string &lit = (*term_int_lit)->int_lit.value.value();
+            uint64_t value;
+            if (std::from_chars(lit.data(), lit.data() + lit.size(), value).ec != std::errc()) {
+                return {}; // doesn't fit in 64 bits, leave it to the assembler
+            }
+            return value;
+        }
+    }
+
+    static std::optional<uint64_t> fold(const NodeBinExpr *bin_expr) {
+        const auto [lhs_expr, rhs_expr] = std::visit([](const auto *bin) {
+            return std::pair<const NodeExpr *, const NodeExpr *>{bin->lhs, bin->rhs};
+        }, bin_expr->var);
+        const std::optional<uint64_t> lhs = literal_value(lhs_expr);
+        const std::optional<uint64_t> rhs = literal_value(rhs_expr);
+        // rhs isn't evaluated then, so it doesn't matter what it is
+        if (std::holds_alternative<NodeBinExprAnd *>(bin_expr->var) && lhs == 0u) {
+            return 0;
+        }
+        if (std::holds_alternative<NodeBinExprOr *>(bin_expr->var) && lhs.has_value() && lhs != 0u) {
+            return 1;
+        }
+        if (!lhs.has_value() || !rhs.has_value()) {
+            return {};
+        }
+
+        // same unsigned wrapping arithmetic as the generated code
+        if (std::holds_alternative<NodeBinExprAdd *>(bin_expr->var)) {
+            return lhs.value() + rhs.value();
+        }
+        if (std::holds_alternative<NodeBinExprMinus *>(bin_expr->var)) {
+            return lhs.value() - rhs.value();
+        }
+        if (std::holds_alternative<NodeBinExprMulti *>(bin_expr->var)) {
+            return lhs.value() * rhs.value();
+        }
+        if (std::holds_alternative<NodeBinExprEq *>(bin_expr->var)) {
+            return lhs.value() == rhs.value();
+        }
+        if (std::holds_alternative<NodeBinExprNotEq *>(bin_expr->var)) {
+            return lhs.value() != rhs.value();
+        }
+        if (std::holds_alternative<NodeBinExprLess *>(bin_expr->var)) {
+            return lhs.value() < rhs.value();
+        }
+        if (std::holds_alternative<NodeBinExprLessEq *>(bin_expr->var)) {
+            return lhs.value() <= rhs.value();
+        }
+        if (std::holds_alternative<NodeBinExprGreater *>(bin_expr->var)) {
+            return lhs.value() > rhs.value();
+        }
+        if (std::holds_alternative<NodeBinExprGreaterEq *>(bin_expr->var)) {
+            return lhs.value() >= rhs.value();
+        }
+        if (std::holds_alternative<NodeBinExprAnd *>(bin_expr->var) ||
+            std::holds_alternative<NodeBinExprOr *>(bin_expr->var)) {
+            return rhs.value() != 0; // lhs didn't decide
+        }
+        if (rhs.value() == 0) {
+            return {}; // keep the division so the program still faults at runtime
+        }
+        return lhs.value() / rhs.value();
+    }
+
+    static size_t fold_expr(NodeExpr *root, ArenaAllocator &allocator) {
+        // operands are folded before the expression using them
+        size_t changes = 0;
+        passes::walk_post_order(root, [&](const auto &frame, auto &frames) {
+            if (!frame.operands_done) {
+                passes::push_operands(frames, frame);
+                return;
+            }
+            auto bin_expr = std::get_if<NodeBinExpr *>(&frame.expr->var);
+            if (bin_expr == nullptr) {
+                return;
+            }
+            if (auto value = fold(*bin_expr)) {
+                auto term_int_lit = allocator.alloc<NodeTermIntLit>();
+                term_int_lit->int_lit = {};
+                term_int_lit->int_lit.type = TokenType::int_lit;
+                term_int_lit->int_lit.value = std::to_string(value.value());
+                auto term = allocator.alloc<NodeTerm>();
+                term->var = term_int_lit;
+                frame.expr->var = term;
+                changes++;
+            }
+        });
+        return changes;
+    }
+
+public:
+    [[nodiscard]] std::string name() const override {
+        return "constant-fold";
+    }
+
+    size_t run(NodeProg &prog, ArenaAllocator &allocator) override {
+        size_t changes = 0;
+        passes::for_each_expr(prog, [&](NodeExpr *&expr) {
+            changes += fold_expr(expr, allocator);
+        });
+        return changes;
+    }
+};
@@ -0,0 +1,475 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include "pass.h"
+
+// common subexpression elimination by value numbering. Literals are numbered by their value, variables by their name
+// and a version that changes whenever they are assigned (or may have been, by a loop or an if arm) and binary
+// expressions by their operator and the numbers of their operands. When a number shows up again while its first
+// computation is still in scope, that computation is moved into a `let _cseN` right before the statement it was in
+// and every occurrence is replaced with `_cseN`. Identifiers can't start with `_`, so the temporaries can't clash with
+// the program's variables.
+//
+// Statements compute their expressions unconditionally, so the `let` computes the same value at the same point. The
+// exceptions are elif tests and the rhs of `&&` and `||`, which only reuse earlier computations, and while tests, which
+// are computed again every iteration and only provide computations that don't use a variable assigned in the loop.
+// A temporary for a computation in a loop body goes before the outermost loop around it that doesn't declare or assign
+// its variables instead, so the body keeps the shape the vectorizer takes. Divisions stay in the loop, which might not
+// run while the divisor is 0.
+class CsePass : public Pass {
+private:
+    // where a temporary for an expression first computed in a statement goes
+    struct Site {
+        std::vector<NodeStmt *> *stmts;
+        size_t index;
+        int line;
+        size_t loops; // while loops around the statement
+    };
+
+    struct Loop {
+        Site site;
+        std::set<std::string> assigned;
+        size_t scopes; // scopes open outside of its body
+    };
+
+    struct Available {
+        NodeExpr *first; // first computation, until it is moved into the temporary
+        std::optional<std::string> temp;
+        Site site;
+    };
+
+    ArenaAllocator *m_allocator = nullptr;
+    std::map<std::tuple<int, uint64_t, uint64_t>, uint32_t> m_numbers{};
+    std::unordered_map<std::string, uint32_t> m_strings{}; // literals and variable names
+    std::unordered_map<std::string, uint64_t> m_versions{}; // variables in scope
+    uint64_t m_next_version = 0;
+    std::unordered_map<uint32_t, Available> m_available{};
+    std::unordered_map<const NodeExpr *, uint32_t> m_first{}; // numbers by their first computation
+    std::vector<std::vector<uint32_t>> m_scope_numbers{}; // numbers that became available in each open scope
+    std::vector<std::vector<std::string>> m_scope_vars{}; // variables declared in each open scope
+    std::vector<Loop> m_loops{}; // while loops around the statement, outermost first
+    std::unordered_map<const std::vector<NodeStmt *> *, std::vector<std::pair<size_t, NodeStmt *>>> m_inserts{};
+    size_t m_temps = 0;
+    size_t m_eliminated = 0;
+
+    uint32_t number(int kind, uint64_t a, uint64_t b) {
+        return m_numbers.try_emplace({kind, a, b}, m_numbers.size()).first->second;
+    }
+
+    uint32_t intern(const std::string &str) {
+        return m_strings.try_emplace(str, m_strings.size()).first->second;
+    }
+
+    // the value number of every node of the expression that has one, and whether it uses one of the varying variables
+    struct Numbered {
+        std::unordered_map<const NodeExpr *, uint32_t> numbers;
+        std::unordered_map<const NodeExpr *, bool> varying;
+    };
+
+    Numbered number_expr(const NodeExpr *root, const std::set<std::string> &varying_vars) {
+        Numbered numbered;
+        passes::walk_post_order(root, [&](const auto &frame, auto &frames) {
+            auto term = std::get_if<NodeTerm *>(&frame.expr->var);
+            // the index and the arguments of array elements and calls aren't walked, see below
+            if (!frame.operands_done && (term == nullptr || std::holds_alternative<NodeTermParen *>((*term)->var))) {
+                passes::push_operands(frames, frame);
+                return;
+            }
+
+            if (term != nullptr) {
+                if (auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+                    const NodeExpr *inner = (*term_paren)->expr;
+                    if (numbered.numbers.contains(inner)) {
+                        numbered.numbers[frame.expr] = numbered.numbers[inner];
+                    }
+                    numbered.varying[frame.expr] = numbered.varying[inner];
+                } else if (auto int_lit = std::get_if<NodeTermIntLit *>(&(*term)->var)) {
+                    numbered.numbers[frame.expr] = number(0, intern((*int_lit)->int_lit.value.value()), 0);
+                } else if (auto term_ident = std::get_if<NodeTermIdent *>(&(*term)->var)) {
+                    const std::string &name = (*term_ident)->ident.value.value();
+                    // undeclared variables are left alone, so the generator still reports them where they are
+                    if (auto version = m_versions.find(name); version != m_versions.end()) {
+                        numbered.numbers[frame.expr] = number(1, intern(name), version->second);
+                    }
+                    numbered.varying[frame.expr] = varying_vars.contains(name);
+                } else {
+                    // array elements change without an assignment to a variable and calls can print, so neither ever
+                    // gets a number
+                    numbered.varying[frame.expr] = false;
+                }
+                return;
+            }
+
+            const NodeBinExpr *bin_expr = std::get<NodeBinExpr *>(frame.expr->var);
+            const auto [lhs, rhs] = std::visit([](const auto *bin) {
+                return std::pair<const NodeExpr *, const NodeExpr *>{bin->lhs, bin->rhs};
+            }, bin_expr->var);
+            numbered.varying[frame.expr] = numbered.varying[lhs] || numbered.varying[rhs];
+            auto lhs_number = numbered.numbers.find(lhs);
+            auto rhs_number = numbered.numbers.find(rhs);
+            if (lhs_number == numbered.numbers.end() || rhs_number == numbered.numbers.end()) {
+                return;
+            }
+            uint64_t a = lhs_number->second;
+            uint64_t b = rhs_number->second;
+            const auto index = bin_expr->var.index();
+            if ((std::holds_alternative<NodeBinExprAdd *>(bin_expr->var) ||
+                 std::holds_alternative<NodeBinExprMulti *>(bin_expr->var) ||
+                 std::holds_alternative<NodeBinExprEq *>(bin_expr->var) ||
+                 std::holds_alternative<NodeBinExprNotEq *>(bin_expr->var)) && b < a) {
+                std::swap(a, b); // commutative
+            }
+            numbered.numbers[frame.expr] = number(static_cast<int>(2 + index), a, b);
+        });
+        return numbered;
+    }
+
+    NodeTerm *ident_term(const std::string &name, int line) const {
+        auto term_ident = m_allocator->alloc<NodeTermIdent>();
+        term_ident->ident = {.type = TokenType::ident, .line = line, .value = name};
+        auto term = m_allocator->alloc<NodeTerm>();
+        term->var = term_ident;
+        return term;
+    }
+
+    // computations inside an expression that is moved into a temporary would be declared after it
+    void forget_inside(const NodeExpr *root) {
+        std::vector<const NodeExpr *> exprs{root};
+        while (!exprs.empty()) {
+            const NodeExpr *expr = exprs.back();
+            exprs.pop_back();
+            if (auto first = m_first.find(expr); first != m_first.end()) {
+                m_available.erase(first->second);
+                m_first.erase(first);
+            }
+            if (auto term = std::get_if<NodeTerm *>(&expr->var)) {
+                if (auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+                    exprs.push_back((*term_paren)->expr);
+                }
+            } else {
+                std::visit([&](const auto *bin) {
+                    exprs.push_back(bin->lhs);
+                    exprs.push_back(bin->rhs);
+                }, std::get<NodeBinExpr *>(expr->var)->var);
+            }
+        }
+    }
+
+    // whether the variable is declared in one of the first scopes, parameters are declared before any of them
+    bool declared_outside(const std::string &name, size_t scopes) const {
+        for (size_t scope = m_scope_vars.size(); scope-- > 0;) {
+            if (std::ranges::find(m_scope_vars[scope], name) != m_scope_vars[scope].end()) {
+                return scope < scopes;
+            }
+        }
+        return m_versions.contains(name);
+    }
+
+    // where the temporary for a computation first made at site is declared
+    Site temp_site(const NodeExpr *expr, const Site &site) const {
+        std::set<std::string> names;
+        bool divides = false;
+        passes::walk_post_order(expr, [&](const auto &frame, auto &frames) {
+            if (!frame.operands_done && passes::push_operands(frames, frame)) {
+                return;
+            }
+            if (auto term = std::get_if<NodeTerm *>(&frame.expr->var)) {
+                if (auto term_ident = std::get_if<NodeTermIdent *>(&(*term)->var)) {
+                    names.insert((*term_ident)->ident.value.value());
+                }
+            } else if (std::holds_alternative<NodeBinExprDiv *>(std::get<NodeBinExpr *>(frame.expr->var)->var)) {
+                divides = true;
+            }
+        });
+        if (divides) {
+            return site;
+        }
+        for (size_t i = 0; i < site.loops; i++) {
+            const Loop &loop = m_loops[i];
+            if (std::ranges::all_of(names, [&](const std::string &name) {
+                return !loop.assigned.contains(name) && declared_outside(name, loop.scopes);
+            })) {
+                return loop.site;
+            }
+        }
+        return site;
+    }
+
+    // moves the first computation into a new temporary declared before its statement, or before the loops around it
+    void make_temp(Available &available) {
+        const std::string name = "_cse" + std::to_string(m_temps++);
+        NodeExpr *first = available.first;
+        m_first.erase(first);
+        const Site site = temp_site(first, available.site);
+
+        auto expr = m_allocator->alloc<NodeExpr>();
+        expr->var = first->var;
+        forget_inside(expr);
+        first->var = ident_term(name, available.site.line);
+
+        auto stmt_let = m_allocator->alloc<NodeStmtLet>();
+        stmt_let->ident = {.type = TokenType::ident, .line = site.line, .value = name};
+        stmt_let->expr = expr;
+        auto stmt = m_allocator->alloc<NodeStmt>();
+        stmt->line = site.line;
+        stmt->var = stmt_let;
+        m_inserts[site.stmts].emplace_back(site.index, stmt);
+
+        available.first = nullptr;
+        available.temp = name;
+    }
+
+    // replaces computations that are available with their temporary. New ones become available when provide is set,
+    // except for those using a varying variable and those in the rhs of `&&` and `||`, which doesn't always run
+    void eliminate(NodeExpr *root, const Site &site, bool provide, const std::set<std::string> &varying_vars = {}) {
+        const Numbered numbered = number_expr(root, varying_vars);
+        // the state of a frame is whether it provides
+        passes::walk_post_order(root, provide, [&](const auto &frame, auto &frames) {
+            if (auto term = std::get_if<NodeTerm *>(&frame.expr->var)) {
+                if (auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+                    frames.push_back({(*term_paren)->expr, false, frame.state});
+                }
+                return;
+            }
+
+            auto number = numbered.numbers.find(frame.expr);
+            if (frame.operands_done) {
+                // the operands weren't available, so this is the first computation
+                m_available[number->second] = {.first = frame.expr, .temp = {}, .site = site};
+                m_first[frame.expr] = number->second;
+                m_scope_numbers.back().push_back(number->second);
+                return;
+            }
+            if (number != numbered.numbers.end()) {
+                if (auto available = m_available.find(number->second); available != m_available.end()) {
+                    if (!available->second.temp.has_value()) {
+                        make_temp(available->second);
+                    }
+                    frame.expr->var = ident_term(available->second.temp.value(), site.line);
+                    m_eliminated++;
+                    return;
+                }
+                if (frame.state && !numbered.varying.at(frame.expr)) {
+                    frames.push_back({frame.expr, true, true});
+                }
+            }
+            NodeBinExpr *bin_expr = std::get<NodeBinExpr *>(frame.expr->var);
+            const bool short_circuit = std::holds_alternative<NodeBinExprAnd *>(bin_expr->var) ||
+                                       std::holds_alternative<NodeBinExprOr *>(bin_expr->var);
+            std::visit([&](auto *bin) {
+                frames.push_back({bin->rhs, false, frame.state && !short_circuit});
+                frames.push_back({bin->lhs, false, frame.state});
+            }, bin_expr->var);
+        });
+    }
+
+    // a new version for a variable that is (or may have been) assigned
+    void kill(const std::string &name) {
+        if (auto version = m_versions.find(name); version != m_versions.end()) {
+            version->second = ++m_next_version;
+        }
+    }
+
+    static void assigned_in(const std::vector<NodeStmt *> &stmts, std::set<std::string> &names) {
+        for (const NodeStmt *stmt: stmts) {
+            if (auto stmt_assign = std::get_if<NodeStmtAssign *>(&stmt->var)) {
+                names.insert((*stmt_assign)->ident.value.value());
+            } else if (auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                assigned_in((*scope)->stmts, names);
+            } else if (auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                assigned_in((*stmt_while)->scope->stmts, names);
+            } else if (auto stmt_parallel = std::get_if<NodeStmtParallel *>(&stmt->var)) {
+                assigned_in((*stmt_parallel)->loop->scope->stmts, names);
+            } else if (auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                assigned_in((*stmt_if)->scope->stmts, names);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        assigned_in((*elif)->scope->stmts, names);
+                        pred = (*elif)->pred;
+                    } else {
+                        assigned_in(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts, names);
+                        pred = {};
+                    }
+                }
+            }
+        }
+    }
+
+    void run_stmt(std::vector<NodeStmt *> &stmts, size_t index) {
+        struct StmtVisitor {
+            CsePass &cse;
+            const Site site;
+
+            void operator()(NodeStmtExit *stmt_exit) const {
+                cse.eliminate(stmt_exit->expr, site, true);
+            }
+
+            void operator()(NodeStmtPrint *stmt_print) const {
+                cse.eliminate(stmt_print->expr, site, true);
+            }
+
+            void operator()(NodeStmtLet *stmt_let) const {
+                cse.eliminate(stmt_let->expr, site, true);
+                const std::string &name = stmt_let->ident.value.value();
+                cse.m_versions[name] = ++cse.m_next_version;
+                cse.m_scope_vars.back().push_back(name);
+            }
+
+            void operator()(NodeStmtAssign *stmt_assign) const {
+                cse.eliminate(stmt_assign->expr, site, true);
+                cse.kill(stmt_assign->ident.value.value());
+            }
+
+            void operator()(NodeScope *scope) const {
+                cse.run_stmts(scope->stmts);
+            }
+
+            void operator()(NodeStmtIf *stmt_if) const {
+                cse.eliminate(stmt_if->expr, site, true);
+                cse.run_stmts(stmt_if->scope->stmts);
+                std::optional<NodeIfPred *> pred = stmt_if->pred;
+                while (pred.has_value()) {
+                    if (auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        cse.eliminate((*elif)->expr, site, false);
+                        cse.run_stmts((*elif)->scope->stmts);
+                        pred = (*elif)->pred;
+                    } else {
+                        cse.run_stmts(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts);
+                        pred = {};
+                    }
+                }
+                // after the if the variables hold whatever the arm that ran left in them
+                std::set<std::string> assigned;
+                assigned_in({site.stmts->at(site.index)}, assigned);
+                for (const std::string &name: assigned) {
+                    cse.kill(name);
+                }
+            }
+
+            void operator()(NodeStmtWhile *stmt_while) const {
+                std::set<std::string> assigned;
+                assigned_in(stmt_while->scope->stmts, assigned);
+                for (const std::string &name: assigned) {
+                    cse.kill(name);
+                }
+                cse.eliminate(stmt_while->expr, site, true, assigned);
+                cse.m_loops.push_back({.site = site, .assigned = assigned, .scopes = cse.m_scope_vars.size()});
+                cse.run_stmts(stmt_while->scope->stmts);
+                cse.m_loops.pop_back();
+                for (const std::string &name: assigned) {
+                    cse.kill(name);
+                }
+            }
+
+            void operator()(NodeStmtWrite *) const {
+            }
+
+            void operator()(NodeStmtLetArray *stmt_let_array) const {
+                const std::string &name = stmt_let_array->ident.value.value();
+                cse.m_versions[name] = ++cse.m_next_version;
+                cse.m_scope_vars.back().push_back(name);
+            }
+
+            void operator()(NodeStmtAssignIndex *assign_index) const {
+                cse.eliminate(assign_index->index, site, true);
+                cse.eliminate(assign_index->expr, site, true);
+            }
+
+            // a function only sees its parameters and its own variables, so nothing computed outside of it is available
+            void operator()(NodeStmtFn *stmt_fn) const {
+                auto versions = std::move(cse.m_versions);
+                auto available = std::move(cse.m_available);
+                auto first = std::move(cse.m_first);
+                auto loops = std::move(cse.m_loops);
+                cse.m_versions.clear();
+                cse.m_available.clear();
+                cse.m_first.clear();
+                cse.m_loops.clear();
+                for (const Token &param: stmt_fn->params) {
+                    cse.m_versions[param.value.value()] = ++cse.m_next_version;
+                }
+                cse.run_stmts(stmt_fn->scope->stmts);
+                cse.m_versions = std::move(versions);
+                cse.m_available = std::move(available);
+                cse.m_first = std::move(first);
+                cse.m_loops = std::move(loops);
+            }
+
+            void operator()(NodeStmtReturn *stmt_return) const {
+                cse.eliminate(stmt_return->expr, site, true);
+            }
+
+            // the body of a parallel loop is left alone, the generator needs its closing `i = i + 1` as written
+            void operator()(NodeStmtParallel *stmt_parallel) const {
+                std::set<std::string> assigned;
+                assigned_in(stmt_parallel->loop->scope->stmts, assigned);
+                for (const NodeReduction &reduction: stmt_parallel->reductions) {
+                    assigned.insert(reduction.ident.value.value());
+                }
+                for (const std::string &name: assigned) {
+                    cse.kill(name);
+                }
+            }
+        };
+
+        NodeStmt *stmt = stmts[index];
+        StmtVisitor visitor{.cse = *this,
+                            .site = {.stmts = &stmts, .index = index, .line = stmt->line, .loops = m_loops.size()}};
+        std::visit(visitor, stmt->var);
+    }
+
+    void run_stmts(std::vector<NodeStmt *> &stmts) {
+        m_scope_numbers.emplace_back();
+        m_scope_vars.emplace_back();
+        for (size_t i = 0; i < stmts.size(); i++) {
+            run_stmt(stmts, i);
+        }
+        // what was computed or declared in the scope is gone after it
+        for (uint32_t number: m_scope_numbers.back()) {
+            if (auto available = m_available.find(number); available != m_available.end()) {
+                m_first.erase(available->second.first);
+                m_available.erase(available);
+            }
+        }
+        for (const std::string &name: m_scope_vars.back()) {
+            m_versions.erase(name);
+        }
+        m_scope_numbers.pop_back();
+        m_scope_vars.pop_back();
+
+        // the temporaries go right before the statement that first computed them, in the order they were made
+        auto inserts = m_inserts.find(&stmts);
+        if (inserts == m_inserts.end()) {
+            return;
+        }
+        std::ranges::stable_sort(inserts->second, {}, &std::pair<size_t, NodeStmt *>::first);
+        std::vector<NodeStmt *> merged;
+        merged.reserve(stmts.size() + inserts->second.size());
+        size_t next = 0;
+        for (size_t i = 0; i < stmts.size(); i++) {
+            while (next < inserts->second.size() && inserts->second[next].first == i) {
+                merged.push_back(inserts->second[next++].second);
+            }
+            merged.push_back(stmts[i]);
+        }
+        stmts = std::move(merged);
+        m_inserts.erase(inserts);
+    }
+
+public:
+    [[nodiscard]] std::string name() const override {
+        return "cse";
+    }
+
+    // returns the number of computations that were replaced with a temporary
+    size_t run(NodeProg &prog, ArenaAllocator &allocator) override {
+        *this = CsePass();
+        m_allocator = &allocator;
+        run_stmts(prog.stmts);
+        return m_eliminated;
+    }
+};
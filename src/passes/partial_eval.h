@@ -0,0 +1,26 @@
+#pragma once
+
+#include "pass.h"
+#include "../evaluator.h"
+
+// runs the program at compile time and replaces what finished within the budget with its output, see Evaluator
+class PartialEvalPass : public Pass {
+private:
+    const size_t m_max_steps;
+    const size_t m_max_memory;
+
+public:
+    PartialEvalPass(size_t max_steps, size_t max_memory) : m_max_steps(max_steps), m_max_memory(max_memory) {
+    }
+
+    [[nodiscard]] std::string name() const override {
+        return "partial-eval";
+    }
+
+    size_t run(NodeProg &prog, ArenaAllocator &allocator) override {
+        Evaluator evaluator(prog, allocator, m_max_steps, m_max_memory);
+        NodeProg residual = evaluator.evaluate();
+        prog = std::move(residual);
+        return evaluator.folded();
+    }
+};
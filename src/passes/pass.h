@@ -0,0 +1,182 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+#include "../parser.h"
+
+// an optimization that rewrites the parsed program before code generation
+class Pass {
+public:
+    virtual ~Pass() = default;
+
+    // name used on the command line (--enable-pass / --disable-pass) and in the timing report
+    [[nodiscard]] virtual std::string name() const = 0;
+
+    // rewrites the program in place and returns how many changes were made, new nodes come from the given arena
+    virtual size_t run(NodeProg &prog, ArenaAllocator &allocator) = 0;
+};
+
+namespace passes {
+    // a frame of walk_post_order: the expression, whether its operands were walked already and the state the walk
+    // passes down the tree
+    template<typename Expr, typename State = std::monostate>
+    struct ExprFrame {
+        Expr *expr;
+        bool operands_done;
+        State state;
+    };
+
+    template<typename Expr, typename State = std::monostate>
+    using ExprFrames = std::vector<ExprFrame<Expr, State>>;
+
+    // walks the expression in post-order with an explicit stack instead of recursion, so machine generated
+    // expressions with very deep nesting can't overflow the native stack. visit(frame, frames) is called with every
+    // frame popped off the stack and pushes the frames to walk next, the last one pushed is visited first. When visit
+    // returns false the walk stops and returns false
+    template<typename Expr, typename State, typename Visit>
+    bool walk_post_order(Expr *root, State state, Visit &&visit) {
+        ExprFrames<Expr, State> frames{{root, false, state}};
+        while (!frames.empty()) {
+            const ExprFrame<Expr, State> frame = frames.back();
+            frames.pop_back();
+            if constexpr (std::is_void_v<std::invoke_result_t<Visit &, const ExprFrame<Expr, State> &,
+                                                               ExprFrames<Expr, State> &>>) {
+                visit(frame, frames);
+            } else if (!visit(frame, frames)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename Expr, typename Visit>
+    bool walk_post_order(Expr *root, Visit &&visit) {
+        return walk_post_order(root, std::monostate{}, std::forward<Visit>(visit));
+    }
+
+    // pushes the frame again with operands_done set and then its operands with the frame's state, so they are
+    // visited first and left to right: lhs and rhs, the expression in parentheses, the index or the arguments of a
+    // call. Pushes nothing and returns false for literals, identifiers and len
+    template<typename Expr, typename State>
+    bool push_operands(ExprFrames<Expr, State> &frames, const ExprFrame<Expr, State> &frame) {
+        auto term = std::get_if<NodeTerm *>(&frame.expr->var);
+        if (term != nullptr && !std::holds_alternative<NodeTermParen *>((*term)->var) &&
+            !std::holds_alternative<NodeTermIndex *>((*term)->var) &&
+            !std::holds_alternative<NodeTermCall *>((*term)->var)) {
+            return false;
+        }
+
+        frames.push_back({frame.expr, true, frame.state});
+        if (term == nullptr) {
+            std::visit([&](auto *bin) {
+                frames.push_back({bin->rhs, false, frame.state});
+                frames.push_back({bin->lhs, false, frame.state});
+            }, std::get<NodeBinExpr *>(frame.expr->var)->var);
+        } else if (auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+            frames.push_back({(*term_paren)->expr, false, frame.state});
+        } else if (auto term_index = std::get_if<NodeTermIndex *>(&(*term)->var)) {
+            frames.push_back({(*term_index)->index, false, frame.state});
+        } else {
+            const std::vector<NodeExpr *> &args = std::get<NodeTermCall *>((*term)->var)->args;
+            for (auto arg = args.rbegin(); arg != args.rend(); ++arg) {
+                frames.push_back({*arg, false, frame.state});
+            }
+        }
+        return true;
+    }
+
+    inline void for_each_expr(NodeScope *scope, const std::function<void(NodeExpr *&)> &fn);
+
+    inline void for_each_expr(NodeIfPred *if_pred, const std::function<void(NodeExpr *&)> &fn) {
+        if (auto elif = std::get_if<NodeIfPredElif *>(&if_pred->var)) {
+            fn((*elif)->expr);
+            for_each_expr((*elif)->scope, fn);
+            if ((*elif)->pred.has_value()) {
+                for_each_expr((*elif)->pred.value(), fn);
+            }
+        } else {
+            for_each_expr(std::get<NodeIfPredElse *>(if_pred->var)->scope, fn);
+        }
+    }
+
+    // calls fn on the root expression of every statement, in source order
+    inline void for_each_expr(NodeStmt *stmt, const std::function<void(NodeExpr *&)> &fn) {
+        struct StmtVisitor {
+            const std::function<void(NodeExpr *&)> &fn;
+
+            void operator()(NodeStmtExit *stmt_exit) const {
+                fn(stmt_exit->expr);
+            }
+
+            void operator()(NodeStmtLet *stmt_let) const {
+                fn(stmt_let->expr);
+            }
+
+            void operator()(NodeStmtPrint *stmt_print) const {
+                fn(stmt_print->expr);
+            }
+
+            void operator()(NodeScope *scope) const {
+                for_each_expr(scope, fn);
+            }
+
+            void operator()(NodeStmtIf *stmt_if) const {
+                fn(stmt_if->expr);
+                for_each_expr(stmt_if->scope, fn);
+                if (stmt_if->pred.has_value()) {
+                    for_each_expr(stmt_if->pred.value(), fn);
+                }
+            }
+
+            void operator()(NodeStmtAssign *stmt_assign) const {
+                fn(stmt_assign->expr);
+            }
+
+            void operator()(NodeStmtWhile *stmt_while) const {
+                fn(stmt_while->expr);
+                for_each_expr(stmt_while->scope, fn);
+            }
+
+            void operator()(NodeStmtWrite *) const {
+            }
+
+            void operator()(NodeStmtLetArray *) const {
+            }
+
+            void operator()(NodeStmtAssignIndex *assign_index) const {
+                fn(assign_index->index);
+                fn(assign_index->expr);
+            }
+
+            void operator()(NodeStmtParallel *stmt_parallel) const {
+                (*this)(stmt_parallel->loop);
+            }
+
+            void operator()(NodeStmtFn *stmt_fn) const {
+                for_each_expr(stmt_fn->scope, fn);
+            }
+
+            void operator()(NodeStmtReturn *stmt_return) const {
+                fn(stmt_return->expr);
+            }
+        };
+
+        StmtVisitor visitor{.fn = fn};
+        std::visit(visitor, stmt->var);
+    }
+
+    inline void for_each_expr(NodeScope *scope, const std::function<void(NodeExpr *&)> &fn) {
+        for (NodeStmt *stmt: scope->stmts) {
+            for_each_expr(stmt, fn);
+        }
+    }
+
+    inline void for_each_expr(NodeProg &prog, const std::function<void(NodeExpr *&)> &fn) {
+        for (NodeStmt *stmt: prog.stmts) {
+            for_each_expr(stmt, fn);
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include "pass.h"
+#include "constant_fold.h"
+#include "partial_eval.h"
+#include "cse.h"
+
+// runs the optimization pipeline picked by the optimization level on the parsed program,
+// keeping per pass timing and change counters
+class PassManager {
+private:
+    struct Entry {
+        std::unique_ptr<Pass> pass;
+        int min_level; // lowest optimization level that runs this pass
+        std::optional<bool> forced{}; // set by --enable-pass / --disable-pass, overrides the level
+        double millis = 0;
+        size_t changes = 0;
+        bool ran = false;
+    };
+    std::vector<Entry> m_entries{};
+    int m_level = 0;
+    ArenaAllocator m_allocator; // nodes created by the passes, must outlive the generator
+
+    Entry *find(const std::string &name) {
+        auto it = std::ranges::find_if(m_entries, [&](const Entry &entry) {
+            return entry.pass->name() == name;
+        });
+        return it == m_entries.end() ? nullptr : &*it;
+    }
+
+public:
+    struct Options {
+        int level = 0;
+        size_t eval_steps = 1'000'000;
+        size_t eval_memory = 16 * 1024 * 1024;
+    };
+
+    explicit PassManager(const Options &options) :
+            m_level(options.level),
+            m_allocator(1024 * 256) // 256kb
+    {
+        // passes run in the order they are added
+        add(std::make_unique<ConstantFoldPass>(), 1);
+        add(std::make_unique<PartialEvalPass>(options.eval_steps, options.eval_memory), 2);
+        add(std::make_unique<CsePass>(), 1);
+    }
+
+    void add(std::unique_ptr<Pass> pass, int min_level) {
+        m_entries.push_back({.pass = std::move(pass), .min_level = min_level});
+    }
+
+    // returns false if there is no pass with that name
+    bool set_enabled(const std::string &name, bool enabled) {
+        Entry *entry = find(name);
+        if (entry == nullptr) {
+            return false;
+        }
+        entry->forced = enabled;
+        return true;
+    }
+
+    [[nodiscard]] std::vector<std::string> pass_names() const {
+        std::vector<std::string> names;
+        for (const Entry &entry: m_entries) {
+            names.push_back(entry.pass->name());
+        }
+        return names;
+    }
+
+    void run(NodeProg &prog) {
+        for (Entry &entry: m_entries) {
+            if (!entry.forced.value_or(m_level >= entry.min_level)) {
+                continue;
+            }
+            const auto start = std::chrono::steady_clock::now();
+            entry.changes = entry.pass->run(prog, m_allocator);
+            const auto end = std::chrono::steady_clock::now();
+            entry.millis = std::chrono::duration<double, std::milli>(end - start).count();
+            entry.ran = true;
+        }
+    }
+
+    void report(std::ostream &out) const {
+        out << "[passes] -O" << m_level << std::endl;
+        for (const Entry &entry: m_entries) {
+            out << "[passes] " << std::left << std::setw(16) << entry.pass->name() << std::right;
+            if (entry.ran) {
+                out << std::setw(10) << std::fixed << std::setprecision(3) << entry.millis << " ms"
+                    << std::setw(10) << entry.changes << " changes" << std::endl;
+            } else {
+                out << "  disabled" << std::endl;
+            }
+        }
+    }
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "diagnostics.h"
+#include "structures/ast_nodes.h"
+
+// profile guided layout: `--instrument` gives every if and while statement and every scope they branch to a
+// counter, which the program writes to a profile file when it exits. `--profile-use` reads the counts back, the
+// sites are numbered the same way as long as the program and the passes that ran on it are the same.
+//
+// profile file: "FLITPROF", the number of sites and a hash of the program's sites as uint64, then one uint64 count
+// per site.
+namespace profile {
+
+    constexpr char magic[8] = {'F', 'L', 'I', 'T', 'P', 'R', 'O', 'F'};
+
+    // counter sites in source order by node (NodeStmtIf, NodeStmtWhile and the NodeScope of every if arm and loop)
+    struct Sites {
+        std::unordered_map<const void *, uint32_t> ids;
+        uint64_t hash = 14695981039346656037ull;
+
+        [[nodiscard]] uint32_t count() const {
+            return ids.size();
+        }
+    };
+
+    struct Profile {
+        uint64_t hash = 0;
+        std::vector<uint64_t> counts;
+    };
+
+    inline void add_site(Sites &sites, const void *node, int kind, int line) {
+        sites.ids.emplace(node, sites.ids.size());
+        // FNV-1a over the kind and line of every site, so a profile of another program is caught
+        for (const int value: {kind, line}) {
+            sites.hash = (sites.hash ^ static_cast<uint32_t>(value)) * 1099511628211ull;
+        }
+    }
+
+    inline void number_sites(Sites &sites, const std::vector<NodeStmt *> &stmts);
+
+    inline void number_sites(Sites &sites, const NodeScope *scope, int line) {
+        add_site(sites, scope, 0, line);
+        number_sites(sites, scope->stmts);
+    }
+
+    inline void number_sites(Sites &sites, const std::vector<NodeStmt *> &stmts) {
+        for (const NodeStmt *stmt: stmts) {
+            if (auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                number_sites(sites, (*scope)->stmts);
+            } else if (auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                add_site(sites, *stmt_while, 1, stmt->line);
+                number_sites(sites, (*stmt_while)->scope, stmt->line);
+            } else if (auto stmt_parallel = std::get_if<NodeStmtParallel *>(&stmt->var)) {
+                number_sites(sites, (*stmt_parallel)->loop->scope, stmt->line);
+            } else if (auto stmt_fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+                number_sites(sites, (*stmt_fn)->scope, stmt->line);
+            } else if (auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                add_site(sites, *stmt_if, 2, stmt->line);
+                number_sites(sites, (*stmt_if)->scope, stmt->line);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        number_sites(sites, (*elif)->scope, (*elif)->line);
+                        pred = (*elif)->pred;
+                    } else {
+                        number_sites(sites, std::get<NodeIfPredElse *>(pred.value()->var)->scope, stmt->line);
+                        pred = {};
+                    }
+                }
+            }
+        }
+    }
+
+    inline Sites number_sites(const NodeProg &prog) {
+        Sites sites;
+        number_sites(sites, prog.stmts);
+        return sites;
+    }
+
+    // reads the profiles of several runs and adds up their counts
+    inline Profile read(const std::vector<std::string> &paths) {
+        Profile profile;
+        for (const std::string &path: paths) {
+            const auto fail = [&](const std::string &reason) {
+                throw CompileError({.stage = Diagnostic::Stage::system,
+                                    .message = "Invalid profile " + path + ": " + reason});
+            };
+            std::ifstream file(path, std::ios::binary);
+            if (!file) {
+                fail(strerror(errno));
+            }
+            char file_magic[sizeof(magic)];
+            uint64_t count = 0;
+            uint64_t hash = 0;
+            if (!file.read(file_magic, sizeof(file_magic)) || std::memcmp(file_magic, magic, sizeof(magic)) != 0 ||
+                !file.read(reinterpret_cast<char *>(&count), sizeof(count)) ||
+                !file.read(reinterpret_cast<char *>(&hash), sizeof(hash))) {
+                fail("not a profile");
+            }
+            if (count > (1u << 28)) {
+                fail("too many sites");
+            }
+            std::vector<uint64_t> counts(count);
+            if (!file.read(reinterpret_cast<char *>(counts.data()), static_cast<std::streamsize>(count * 8))) {
+                fail("truncated");
+            }
+            if (&path == &paths.front()) {
+                profile = {.hash = hash, .counts = std::move(counts)};
+                continue;
+            }
+            if (hash != profile.hash || count != profile.counts.size()) {
+                fail("recorded for another program than " + paths.front());
+            }
+            for (size_t i = 0; i < count; i++) {
+                profile.counts[i] += counts[i];
+            }
+        }
+        return profile;
+    }
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// compile server: `flit --serve <socket>` keeps a warmed up compiler process listening on a Unix domain socket and
+// `flit --connect <socket> ...` (or FLIT_SERVER=<socket>) forwards the command line to it instead of starting the
+// compiler from scratch.
+//
+// request: the length of the payload as a uint32 followed by the working directory and the arguments, each ended by
+// a '\0'. The client's stdout is passed along as SCM_RIGHTS so a program run by the server prints to the client.
+// response: "status <code>\n", "artifact <path>\n" when an executable or assembly file was written and
+// "diagnostics <length>\n" followed by everything the compiler, nasm and ld wrote to stderr.
+//
+// Every connection is handled by a process forked from the server, so requests run concurrently and start with the
+// allocator, the SIMD kernel choice and the iostreams the server warmed up. Its stdout and stderr are pointed at the
+// client's stdout and at an in-memory file that becomes the diagnostics of the response. What a request allocates,
+// its arena, symbol tables and output buffers, goes away with its process, so they aren't reused by later requests.
+// At most max_connections requests are handled at once, further connections wait in the listen backlog.
+namespace server {
+
+    // requests run as processes of their own, a program a request runs keeps its slot until it exits
+    constexpr int max_connections = 64;
+
+    // a request is a command line, which the kernel caps at 2 MiB (ARG_MAX) as well
+    constexpr uint32_t max_payload = 2 * 1024 * 1024;
+
+    // runs a compiler command line and sets artifact to the file it wrote, returns the exit code
+    using CompileFn = std::function<int(const std::vector<std::string> &args, std::optional<std::string> &artifact)>;
+
+    inline char socket_path_to_remove[sizeof(sockaddr_un::sun_path)] = {};
+
+    inline std::optional<sockaddr_un> make_address(const std::string &path) {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path is too long: " << path << std::endl;
+            return {};
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    inline bool write_all(int fd, const char *data, size_t size) {
+        while (size > 0) {
+            const ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    inline bool read_all(int fd, char *data, size_t size) {
+        while (size > 0) {
+            const ssize_t got = ::read(fd, data, size);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return false;
+            }
+            data += got;
+            size -= got;
+        }
+        return true;
+    }
+
+    inline std::string read_file(int fd) {
+        std::string contents(lseek(fd, 0, SEEK_END), '\0');
+        if (pread(fd, contents.data(), contents.size(), 0) != static_cast<ssize_t>(contents.size())) {
+            contents.clear();
+        }
+        return contents;
+    }
+
+    // receives a request, returns the working directory followed by the arguments and the client's stdout
+    inline std::optional<std::pair<std::vector<std::string>, int>> receive_request(int connection) {
+        uint32_t size;
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        iovec iov{.iov_base = &size, .iov_len = sizeof(size)};
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(connection, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(size)) {
+            return {};
+        }
+        const cmsghdr *header = CMSG_FIRSTHDR(&message);
+        if (header == nullptr || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+            return {};
+        }
+        int client_stdout;
+        std::memcpy(&client_stdout, CMSG_DATA(header), sizeof(int));
+        if (size > max_payload) {
+            close(client_stdout);
+            return {};
+        }
+
+        std::string payload(size, '\0');
+        if (!read_all(connection, payload.data(), payload.size())) {
+            close(client_stdout);
+            return {};
+        }
+        std::vector<std::string> fields;
+        std::stringstream stream(payload);
+        for (std::string field; std::getline(stream, field, '\0');) {
+            fields.push_back(field);
+        }
+        if (fields.empty()) {
+            close(client_stdout);
+            return {};
+        }
+        return std::pair{fields, client_stdout};
+    }
+
+    // runs one request in the connection process and sends the response
+    inline void handle(int connection, const CompileFn &compile) {
+        auto request = receive_request(connection);
+        if (!request.has_value()) {
+            return;
+        }
+        auto &[fields, client_stdout] = request.value();
+        const int diagnostics = memfd_create("flit-diagnostics", MFD_CLOEXEC);
+        if (diagnostics < 0) {
+            return;
+        }
+        dup2(client_stdout, STDOUT_FILENO);
+        dup2(diagnostics, STDERR_FILENO);
+
+        int code = EXIT_FAILURE;
+        std::optional<std::string> artifact;
+        if (chdir(fields[0].c_str()) != 0) {
+            std::cerr << "Failed to change directory to " << fields[0] << ": " << strerror(errno) << std::endl;
+        } else {
+            code = compile({fields.begin() + 1, fields.end()}, artifact);
+        }
+        std::cout.flush();
+        std::cerr.flush();
+
+        std::stringstream response;
+        const std::string diagnostics_text = read_file(diagnostics);
+        response << "status " << code << "\n";
+        if (artifact.has_value()) {
+            response << "artifact " << artifact.value() << "\n";
+        }
+        response << "diagnostics " << diagnostics_text.size() << "\n" << diagnostics_text;
+        const std::string text = response.str();
+        write_all(connection, text.data(), text.size());
+    }
+
+    inline void remove_socket(int signal) {
+        unlink(socket_path_to_remove);
+        _exit(128 + signal);
+    }
+
+    // listens on socket_path until killed, warm_up runs once before the first request
+    inline int serve(const std::string &socket_path, const CompileFn &compile, const std::function<void()> &warm_up) {
+        std::optional<sockaddr_un> address = make_address(socket_path);
+        if (!address.has_value()) {
+            return EXIT_FAILURE;
+        }
+        const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(socket_path.c_str()); // a socket left behind by a server that was killed
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address.value()), sizeof(sockaddr_un)) != 0 ||
+            listen(listener, 128) != 0) {
+            std::cerr << "Failed to listen on " << socket_path << ": " << strerror(errno) << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::memcpy(socket_path_to_remove, address->sun_path, sizeof(socket_path_to_remove));
+        std::signal(SIGINT, remove_socket);
+        std::signal(SIGTERM, remove_socket);
+        std::signal(SIGPIPE, SIG_IGN); // a client that went away shouldn't end the server
+        struct sigaction child_exited{};
+        child_exited.sa_handler = [](int) {}; // without SA_RESTART, so accept4 returns and the process is reaped
+        sigaction(SIGCHLD, &child_exited, nullptr);
+
+        warm_up();
+        std::cerr << "flit: serving on " << socket_path << std::endl;
+
+        int connections = 0;
+        while (true) {
+            // reaps the connection processes that are done, and waits for one when all slots are taken
+            while (connections > 0 && waitpid(-1, nullptr, connections < max_connections ? WNOHANG : 0) > 0) {
+                connections--;
+            }
+            const int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                std::cerr << "Failed to accept a connection: " << strerror(errno) << std::endl;
+                return EXIT_FAILURE;
+            }
+            const pid_t pid = fork();
+            if (pid == 0) {
+                close(listener);
+                std::signal(SIGINT, SIG_DFL);
+                std::signal(SIGTERM, SIG_DFL);
+                std::signal(SIGCHLD, SIG_DFL); // the connection process waits for the programs it runs
+                handle(connection, compile);
+                _exit(EXIT_SUCCESS);
+            }
+            if (pid > 0) {
+                connections++;
+            }
+            close(connection);
+        }
+    }
+
+    // sends the command line to the server and prints its diagnostics, returns nothing when the server can't be
+    // reached so the caller can compile in-process instead
+    inline std::optional<int> forward(const std::string &socket_path, const std::vector<std::string> &args) {
+        std::optional<sockaddr_un> address = make_address(socket_path);
+        if (!address.has_value()) {
+            return {};
+        }
+        const int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connection < 0) {
+            return {};
+        }
+        if (connect(connection, reinterpret_cast<sockaddr *>(&address.value()), sizeof(sockaddr_un)) != 0) {
+            close(connection);
+            return {};
+        }
+
+        char cwd[4096];
+        if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+            close(connection);
+            return {};
+        }
+        std::string payload = std::string(cwd) + '\0';
+        for (const std::string &arg: args) {
+            payload += arg + '\0';
+        }
+        if (payload.size() > max_payload) {
+            close(connection);
+            return {};
+        }
+        uint32_t size = payload.size();
+
+        int client_stdout = STDOUT_FILENO;
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        iovec iov{.iov_base = &size, .iov_len = sizeof(size)};
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &client_stdout, sizeof(int));
+        if (sendmsg(connection, &message, MSG_NOSIGNAL) != sizeof(size) ||
+            !write_all(connection, payload.data(), payload.size())) {
+            close(connection);
+            return {};
+        }
+
+        // the request reached the server, from here on its answer counts even if it is broken
+        std::string response;
+        char buffer[1024 * 16];
+        for (ssize_t got; (got = ::read(connection, buffer, sizeof(buffer))) != 0;) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                break;
+            }
+            response.append(buffer, got);
+        }
+        close(connection);
+
+        std::stringstream stream(response);
+        std::string key;
+        int code = EXIT_FAILURE;
+        bool answered = false;
+        while (stream >> key) {
+            if (key == "status") {
+                answered = static_cast<bool>(stream >> code);
+            } else if (key == "artifact") {
+                std::string path;
+                std::getline(stream >> std::ws, path);
+            } else if (key == "diagnostics") {
+                size_t length = 0;
+                stream >> length;
+                stream.get(); // newline after the length
+                std::string text(length, '\0');
+                stream.read(text.data(), static_cast<std::streamsize>(length));
+                std::cerr << text;
+            }
+        }
+        if (!answered) {
+            std::cerr << "flit: no answer from the compile server at " << socket_path << std::endl;
+            return EXIT_FAILURE;
+        }
+        return code;
+    }
+}
@@ -1,3 +1,11 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+#include "tokens.h"
+
 struct NodeTermIntLit {
     Token int_lit;
 };
@@ -8,10 +16,27 @@ struct NodeTermIdent {
 
 struct NodeExpr;
 
+// `name(args)` calls the function declared with `fn name(params)`
+struct NodeTermCall {
+    Token ident;
+    std::vector<NodeExpr *> args;
+};
+
 struct NodeTermParen {
     NodeExpr *expr;
 };
 
+// `a[i]`, reading an element of a fixed-size array
+struct NodeTermIndex {
+    Token ident;
+    NodeExpr *index;
+};
+
+// `len(a)`, the number of elements the array was declared with
+struct NodeTermLen {
+    Token ident;
+};
+
 struct NodeBinExprAdd {
     NodeExpr *lhs;
     NodeExpr *rhs;
@@ -32,12 +57,56 @@ struct NodeBinExprDiv {
     NodeExpr *rhs;
 };
 
+// comparisons and logical operators evaluate to 1 or 0, comparisons are unsigned like the arithmetic
+struct NodeBinExprEq {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprNotEq {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprLess {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprLessEq {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprGreater {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprGreaterEq {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+// logical operators only evaluate rhs when lhs doesn't decide the result already
+struct NodeBinExprAnd {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprOr {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
 struct NodeBinExpr {
-    std::variant<NodeBinExprAdd *, NodeBinExprMinus *, NodeBinExprMulti *, NodeBinExprDiv *> var; // var can be any of the types specified inside the variant<> similar to enum
+    std::variant<NodeBinExprAdd *, NodeBinExprMinus *, NodeBinExprMulti *, NodeBinExprDiv *, NodeBinExprEq *,
+            NodeBinExprNotEq *, NodeBinExprLess *, NodeBinExprLessEq *, NodeBinExprGreater *, NodeBinExprGreaterEq *,
+            NodeBinExprAnd *, NodeBinExprOr *> var; // var can be any of the types specified inside the variant<> similar to enum
 };
 
 struct NodeTerm {
-    std::variant<NodeTermIntLit *, NodeTermIdent *, NodeTermParen *> var;
+    std::variant<NodeTermIntLit *, NodeTermIdent *, NodeTermParen *, NodeTermIndex *, NodeTermLen *, NodeTermCall *> var;
 };
 
 struct NodeExpr {
@@ -66,6 +135,7 @@ struct NodeScope {
 struct NodeIfPred;
 
 struct NodeIfPredElif {
+    int line = 0;
     NodeExpr *expr;
     NodeScope *scope;
     std::optional<NodeIfPred *> pred;
@@ -95,8 +165,59 @@ struct NodeStmtAssign {
     NodeExpr *expr;
 };
 
+// `let a[8];` declares an array of 8 elements that start out as 0
+struct NodeStmtLetArray {
+    Token ident;
+    Token size;
+};
+
+// `a[i] = expr;`
+struct NodeStmtAssignIndex {
+    Token ident;
+    NodeExpr *index;
+    NodeExpr *expr;
+};
+
+// `sum s`, `min s` or `max s` in the reduce clause of a parallel loop
+struct NodeReduction {
+    enum class Op { sum, min, max };
+    Op op;
+    Token ident;
+};
+
+// `parallel while (i < n) reduce(sum s) { ...; i = i + 1; }` runs the iterations on all cores, in any order. Every
+// thread has its own copy of the counter and of the reduction variables, which are combined when the loop is done
+struct NodeStmtParallel {
+    NodeStmtWhile *loop;
+    std::vector<NodeReduction> reductions;
+};
+
+// `fn name(a, b) { ... }` at the top level. The body only sees its parameters and its own variables, it can be
+// called from anywhere in the program
+struct NodeStmtFn {
+    Token ident;
+    std::vector<Token> params;
+    NodeScope *scope;
+};
+
+// the arguments are passed in rdi, rsi, rdx, rcx, r8 and r9
+constexpr size_t max_params = 6;
+
+// `return expr;` ends the function it is in, a function that runs to its end returns 0
+struct NodeStmtReturn {
+    NodeExpr *expr;
+};
+
+// not produced by the parser, the evaluator replaces statements it could run at compile time with their output
+struct NodeStmtWrite {
+    std::string text;
+    std::string digit_space; // contents of the print buffer after the folded statements ran
+};
+
 struct NodeStmt {
-    std::variant<NodeStmtExit *, NodeStmtLet *, NodeStmtPrint *, NodeScope *, NodeStmtIf *, NodeStmtAssign *, NodeStmtWhile *> var;
+    int line = 0; // source line the statement starts on, 0 for statements the compiler made up
+    std::variant<NodeStmtExit *, NodeStmtLet *, NodeStmtPrint *, NodeScope *, NodeStmtIf *, NodeStmtAssign *, NodeStmtWhile *, NodeStmtWrite *,
+            NodeStmtLetArray *, NodeStmtAssignIndex *, NodeStmtParallel *, NodeStmtFn *, NodeStmtReturn *> var;
 };
 
 struct NodeProg {
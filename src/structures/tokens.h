@@ -1,3 +1,9 @@
+#pragma once
+
+#include <cassert>
+#include <optional>
+#include <string>
+
 enum class TokenType {
     exit,
     int_lit,
@@ -17,10 +23,26 @@ enum class TokenType {
     if_,
     elif,
     else_,
-    while_
+    while_,
+    eq_eq,
+    bang_eq,
+    less,
+    less_eq,
+    greater,
+    greater_eq,
+    and_and,
+    or_or,
+    open_bracket,
+    close_bracket,
+    len,
+    parallel,
+    reduce,
+    comma,
+    fn,
+    return_
 };
 
-std::string to_string(const TokenType type) {
+inline std::string to_string(const TokenType type) {
     switch (type) {
         case TokenType::exit:
             return "`exit`";
@@ -60,18 +82,62 @@ std::string to_string(const TokenType type) {
             return "`print`";
         case TokenType::while_:
             return "`while`";
+        case TokenType::eq_eq:
+            return "`==`";
+        case TokenType::bang_eq:
+            return "`!=`";
+        case TokenType::less:
+            return "`<`";
+        case TokenType::less_eq:
+            return "`<=`";
+        case TokenType::greater:
+            return "`>`";
+        case TokenType::greater_eq:
+            return "`>=`";
+        case TokenType::and_and:
+            return "`&&`";
+        case TokenType::or_or:
+            return "`||`";
+        case TokenType::open_bracket:
+            return "`[`";
+        case TokenType::close_bracket:
+            return "`]`";
+        case TokenType::len:
+            return "`len`";
+        case TokenType::parallel:
+            return "`parallel`";
+        case TokenType::reduce:
+            return "`reduce`";
+        case TokenType::comma:
+            return "`,`";
+        case TokenType::fn:
+            return "`fn`";
+        case TokenType::return_:
+            return "`return`";
     }
     assert(false);
 }
 
-std::optional<int> bin_prec(TokenType type) {
+inline std::optional<int> bin_prec(TokenType type) {
     switch (type) {
+        case TokenType::or_or:
+            return 0;
+        case TokenType::and_and:
+            return 1;
+        case TokenType::eq_eq:
+        case TokenType::bang_eq:
+            return 2;
+        case TokenType::less:
+        case TokenType::less_eq:
+        case TokenType::greater:
+        case TokenType::greater_eq:
+            return 3;
         case TokenType::plus:
         case TokenType::minus:
-            return 0;
+            return 4;
         case TokenType::multi:
         case TokenType::div:
-            return 1;
+            return 5;
         default:
             return {};
     }
@@ -1,148 +1,317 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
+#include "diagnostics.h"
+#include "lexer_simd.h"
 #include "structures/tokens.h"
 
 class Tokenizer {
+public:
+    // tokens of a part of the source, the state at its end and where lexing stopped because of an error
+    struct Chunk {
+        std::vector<Token> tokens;
+        std::vector<size_t> offsets{}; // offset of every token in the source, only filled when asked for
+        bool ends_in_comment = false;
+        std::optional<int> error_line{};
+        size_t end = 0; // where lexing stopped
+        int end_line = 0; // line lexing stopped on
+    };
+
 private:
-    const std::string m_src;
-    size_t m_index = 0;
-
-    [[nodiscard]] std::optional<char> peek(int offset = 0) const {
-        if (m_index + offset >= m_src.length()) {
-            return {};
-        } else {
-            return m_src.at(m_index + offset);
+    std::string m_src;
+
+    struct NoStop {
+        bool operator()(size_t) const {
+            return false;
         }
-    }
+    };
 
-    // returns the current element and then increases index
-    char consume() {
-        return m_src.at(m_index++);
-    }
+    // lexes m_src[begin, end) starting on the given line, `in_comment` means it starts inside a `/* */` comment.
+    // stop is asked at every position between tokens, whitespace and comments and ends lexing early when it agrees
+    template<bool track_offsets = false, typename Stop = NoStop>
+    Chunk lex_range(size_t begin, size_t end, bool in_comment, int line_count, Stop stop = {}) const {
+        // whitespace, comments, identifiers and numbers are skipped in bulk by the SIMD kernels
+        const lex::Kernels &kernels = lex::kernels();
+        const char *src = m_src.data();
+        const size_t len = end;
 
-public:
-    // explicit because it shouldn't accidentally convert string into a tokenizer
-    explicit Tokenizer(std::string src) : m_src(std::move(src)) {
-    }
+        Chunk chunk;
+        std::vector<Token> &tokens = chunk.tokens;
+        size_t i = begin;
 
-    // tokenizer: this function will read the string and make a vector with all the tokens
-    std::vector<Token> tokenize() {
-        std::vector<Token> tokens;
-        std::string buff;
-        int line_count = 1;
+        if (in_comment) {
+            i = kernels.find_comment_end(src, i, len, line_count);
+            if (i >= len) {
+                chunk.ends_in_comment = true;
+                return chunk;
+            }
+            i += 2; // consume `*/`
+        }
 
-        while (peek().has_value()) {
-            if (std::isalpha(peek().value())) {
+        while (i < len) {
+            if (stop(i)) {
+                break;
+            }
+            const size_t start = i;
+            const char c = src[i];
+            if (lex::is_alpha(c)) {
                 // as the token can't start with numeric we will start with alpha only
-                buff.push_back(consume());
-
-                while (peek().has_value() && std::isalnum(peek().value())) {
-                    buff.push_back(consume()); // push the character to buffer until there is alphanumeric after it.
-                }
+                const size_t end = kernels.skip_alnum(src, i + 1, len);
+                const std::string_view word(src + i, end - i);
+                i = end;
 
-                // if the buffer value is a keyword
-                if (buff == "exit") {
-                    // push the token to vector and clear the buffer
+                // if the word is a keyword push the keyword token, otherwise it is an identifier
+                if (word == "exit") {
                     tokens.push_back({TokenType::exit, line_count});
-                    buff.clear();
-                } else if (buff == "let") {
+                } else if (word == "let") {
                     tokens.push_back({TokenType::let, line_count});
-                    buff.clear();
-                } else if (buff == "print") {
+                } else if (word == "print") {
                     tokens.push_back({TokenType::print, line_count});
-                    buff.clear();
-                } else if (buff == "if") {
+                } else if (word == "if") {
                     tokens.push_back({TokenType::if_, line_count});
-                    buff.clear();
-                } else if (buff == "elif") {
+                } else if (word == "elif") {
                     tokens.push_back({TokenType::elif, line_count});
-                    buff.clear();
-                } else if (buff == "else") {
+                } else if (word == "else") {
                     tokens.push_back({TokenType::else_, line_count});
-                    buff.clear();
-                } else if (buff == "while") {
+                } else if (word == "while") {
                     tokens.push_back({TokenType::while_, line_count});
-                    buff.clear();
-                } else { // if it's not a keyword then make it an identifier
-                    tokens.push_back({TokenType::ident, line_count, buff});
-                    buff.clear();
+                } else if (word == "len") {
+                    tokens.push_back({TokenType::len, line_count});
+                } else if (word == "parallel") {
+                    tokens.push_back({TokenType::parallel, line_count});
+                } else if (word == "reduce") {
+                    tokens.push_back({TokenType::reduce, line_count});
+                } else if (word == "fn") {
+                    tokens.push_back({TokenType::fn, line_count});
+                } else if (word == "return") {
+                    tokens.push_back({TokenType::return_, line_count});
+                } else {
+                    tokens.push_back({TokenType::ident, line_count, std::string(word)});
                 }
-            } else if (std::isdigit(peek().value())) {
+            } else if (lex::is_digit(c)) {
                 // if token is starting with a number then it must be an integer literal
-                buff.push_back(consume());
-
-                while (peek().has_value() && std::isdigit(peek().value())) {
-                    buff.push_back(consume());
+                const size_t end = kernels.skip_digits(src, i + 1, len);
+                tokens.push_back({.type = TokenType::int_lit, .line = line_count, .value = std::string(src + i, end - i)});
+                i = end;
+            } else if (c == '/' && i + 1 < len && src[i + 1] == '/') {
+                // skip until the newline, which is consumed (and counted) as whitespace
+                i = kernels.find_newline(src, i + 2, len);
+            } else if (c == '/' && i + 1 < len && src[i + 1] == '*') {
+                i = kernels.find_comment_end(src, i + 2, len, line_count);
+                chunk.ends_in_comment = i >= len;
+                i = std::min(i + 2, len); // consume `*/` if the comment was closed
+            } else if (lex::is_space(c)) {
+                i = kernels.skip_space(src, i, len, line_count);
+            } else {
+                std::optional<TokenType> type;
+                size_t length = 1;
+                // `==`, `!=`, `<=`, `>=`, `&&` and `||` are the only tokens that are two characters long
+                const char next = i + 1 < len ? src[i + 1] : '\0';
+                switch (c) {
+                    case '(':
+                        type = TokenType::open_paren;
+                        break;
+                    case ')':
+                        type = TokenType::close_paren;
+                        break;
+                    case ';':
+                        type = TokenType::semi;
+                        break;
+                    case ',':
+                        type = TokenType::comma;
+                        break;
+                    case '=':
+                        type = next == '=' ? TokenType::eq_eq : TokenType::eq;
+                        break;
+                    case '!':
+                        if (next == '=') {
+                            type = TokenType::bang_eq;
+                        }
+                        break;
+                    case '<':
+                        type = next == '=' ? TokenType::less_eq : TokenType::less;
+                        break;
+                    case '>':
+                        type = next == '=' ? TokenType::greater_eq : TokenType::greater;
+                        break;
+                    case '&':
+                        if (next == '&') {
+                            type = TokenType::and_and;
+                        }
+                        break;
+                    case '|':
+                        if (next == '|') {
+                            type = TokenType::or_or;
+                        }
+                        break;
+                    case '+':
+                        type = TokenType::plus;
+                        break;
+                    case '-':
+                        type = TokenType::minus;
+                        break;
+                    case '*':
+                        type = TokenType::multi;
+                        break;
+                    case '/':
+                        type = TokenType::div;
+                        break;
+                    case '[':
+                        type = TokenType::open_bracket;
+                        break;
+                    case ']':
+                        type = TokenType::close_bracket;
+                        break;
+                    case '{':
+                        type = TokenType::open_curly;
+                        break;
+                    case '}':
+                        type = TokenType::close_curly;
+                        break;
+                    default:
+                        break;
                 }
-
-                // push the int_lit to tokens and give it value of buffer
-                tokens.push_back({.type = TokenType::int_lit, .value = buff});
-                buff.clear();
-            } else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
-                // consume both '/'
-                consume();
-                consume();
-                while (peek().has_value() && peek().value() != '\n') {
-                    consume();
+                if (!type.has_value()) {
+                    // some syntax error happened, the caller reports it
+                    chunk.error_line = line_count;
+                    return chunk;
                 }
-            } else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*') {
-                // consume '/' then '*'
-                consume();
-                consume();
-                while (peek().has_value()) {
-                    if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') {
-                        break;
-                    }
-                    if (peek().value() == '\n') line_count++;
-                    consume();
+                if (type == TokenType::eq_eq || type == TokenType::bang_eq || type == TokenType::less_eq ||
+                    type == TokenType::greater_eq || type == TokenType::and_and || type == TokenType::or_or) {
+                    length = 2;
                 }
-                if (peek().has_value()) consume(); // consume '*'
-                if (peek().has_value()) consume(); // consume '/'
-            } else if (peek().value() == '(') {
-                consume();
-                tokens.push_back({TokenType::open_paren, line_count});
-            } else if (peek().value() == ')') {
-                consume();
-                tokens.push_back({TokenType::close_paren, line_count});
-            } else if (peek().value() == ';') {
-                consume();
-                tokens.push_back({TokenType::semi, line_count});
-            } else if (peek().value() == '=') {
-                consume();
-                tokens.push_back({TokenType::eq, line_count});
-            } else if (peek().value() == '+') {
-                consume();
-                tokens.push_back({TokenType::plus, line_count});
-            } else if (peek().value() == '-') {
-                consume();
-                tokens.push_back({TokenType::minus, line_count});
-            } else if (peek().value() == '*') {
-                consume();
-                tokens.push_back({TokenType::multi, line_count});
-            } else if (peek().value() == '/') {
-                consume();
-                tokens.push_back({TokenType::div, line_count});
-            } else if (peek().value() == '{') {
-                consume();
-                tokens.push_back({TokenType::open_curly, line_count});
-            } else if (peek().value() == '}') {
-                consume();
-                tokens.push_back({TokenType::close_curly, line_count});
-            } else if (peek().value() == '\n') {
-                consume();
-                line_count++;
-            } else if (isspace(peek().value())) {
-                consume();
-            } else {
-                // some syntax error happened
-                std::cerr << "Unexpected Token on line " << line_count << std::endl;
-                exit(EXIT_FAILURE);
+                tokens.push_back({type.value(), line_count});
+                i += length;
+            }
+            if constexpr (track_offsets) {
+                chunk.offsets.resize(tokens.size(), start); // whitespace and comments don't add a token
             }
         }
 
-        m_index = 0; // resetting index
+        chunk.end = std::min(i, len);
+        chunk.end_line = line_count;
+        return chunk;
+    }
+
+    [[noreturn]] static void error_unexpected(int line) {
+        throw CompileError({.stage = Diagnostic::Stage::lex, .message = "Unexpected Token on line " + std::to_string(line), .line = line});
+    }
+
+public:
+    // explicit because it shouldn't accidentally convert string into a tokenizer
+    explicit Tokenizer(std::string src) : m_src(std::move(src)) {
+    }
+
+    [[nodiscard]] const std::string &source() const {
+        return m_src;
+    }
+
+    // replaces `removed` bytes at offset with inserted, the tokens have to be lexed again by the caller
+    void replace(size_t offset, size_t removed, std::string_view inserted) {
+        m_src.replace(offset, removed, inserted);
+    }
+
+    // lexes from begin, which has to be the start of a token or of the source, until the end or until stop(position)
+    // returns true at a position between tokens. Every token comes with its offset, used to re-lex after an edit
+    template<typename Stop = NoStop>
+    Chunk lex_from(size_t begin, int line, Stop stop = {}) const {
+        Chunk chunk = lex_range<true>(begin, m_src.length(), false, line, stop);
+        if (chunk.error_line.has_value()) {
+            error_unexpected(chunk.error_line.value());
+        }
+        return chunk;
+    }
+
+    // tokenizer: this function will read the string and make a vector with all the tokens.
+    // large sources are tokenized on several threads, the result is the same either way
+    std::vector<Token> tokenize(unsigned threads = 0) {
+        if (threads == 0) {
+            threads = m_src.length() >= 1024 * 1024 ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+        }
+        if (threads > 1) {
+            return tokenize_parallel(threads);
+        }
+
+        Chunk chunk = lex_range(0, m_src.length(), false, 1);
+        if (chunk.error_line.has_value()) {
+            error_unexpected(chunk.error_line.value());
+        }
+        return std::move(chunk.tokens);
+    }
+
+    // splits the source into chunks at line boundaries and lexes them concurrently.
+    // a line comment always ends at the newline, so the only state that crosses a chunk boundary is being inside a
+    // `/* */` comment: every chunk but the first is lexed speculatively for both states, and the right result is
+    // picked once the state at the end of the previous chunk is known. Line numbers are fixed up with a prefix sum of
+    // the newlines in each chunk, and the chunks are copied into the final token stream in parallel.
+    std::vector<Token> tokenize_parallel(unsigned threads) {
+        const lex::Kernels &kernels = lex::kernels();
+        const size_t len = m_src.length();
+
+        std::vector<size_t> bounds{0};
+        for (unsigned k = 1; k < threads; k++) {
+            const size_t newline = kernels.find_newline(m_src.data(), std::max(bounds.back(), len / threads * k), len);
+            if (newline + 1 >= len) {
+                break;
+            }
+            bounds.push_back(newline + 1);
+        }
+        bounds.push_back(len);
+        const size_t chunk_count = bounds.size() - 1;
+
+        // lex every chunk from both possible starting states, lines are relative to the start of the chunk
+        std::vector<std::array<Chunk, 2>> variants(chunk_count);
+        std::vector<int> newlines(chunk_count);
+        {
+            std::vector<std::jthread> workers;
+            for (size_t k = 0; k < chunk_count; k++) {
+                workers.emplace_back([&, k]() {
+                    const char *begin = m_src.data() + bounds[k];
+                    const char *end = m_src.data() + bounds[k + 1];
+                    newlines[k] = static_cast<int>(std::count(begin, end, '\n'));
+                    variants[k][0] = lex_range(bounds[k], bounds[k + 1], false, 0);
+                    if (k > 0) {
+                        variants[k][1] = lex_range(bounds[k], bounds[k + 1], true, 0);
+                    }
+                });
+            }
+        }
+
+        // resolve the state each chunk starts in, and where its tokens go in the output
+        std::vector<const Chunk *> picked(chunk_count);
+        std::vector<int> first_line(chunk_count);
+        std::vector<size_t> offsets(chunk_count + 1, 0);
+        bool in_comment = false;
+        int line = 1;
+        for (size_t k = 0; k < chunk_count; k++) {
+            picked[k] = &variants[k][in_comment ? 1 : 0];
+            first_line[k] = line;
+            if (picked[k]->error_line.has_value()) {
+                error_unexpected(line + picked[k]->error_line.value());
+            }
+            offsets[k + 1] = offsets[k] + picked[k]->tokens.size();
+            in_comment = picked[k]->ends_in_comment;
+            line += newlines[k];
+        }
+
+        std::vector<Token> tokens(offsets.back());
+        {
+            std::vector<std::jthread> workers;
+            for (size_t k = 0; k < chunk_count; k++) {
+                workers.emplace_back([&, k]() {
+                    std::vector<Token> &chunk_tokens = variants[k][picked[k] == &variants[k][1] ? 1 : 0].tokens;
+                    for (size_t t = 0; t < chunk_tokens.size(); t++) {
+                        chunk_tokens[t].line += first_line[k];
+                        tokens[offsets[k] + t] = std::move(chunk_tokens[t]);
+                    }
+                });
+            }
+        }
         return tokens;
     }
 };
\ No newline at end of file
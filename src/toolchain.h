@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "diagnostics.h"
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// runs the external assembler and linker without a shell and without temporary files.
+// nasm reads its input once per pass, so it can't read from a pipe: the assembly is streamed into an anonymous
+// in-memory file (memfd) while the generator produces it, and the object file lives in another one that ld reads.
+// The files are close-on-exec, a child only gets the ones spawn passes it, so compiles running on other threads
+// don't leak their files into each other's nasm, ld or programs.
+namespace toolchain {
+
+    // output stream buffer writing straight into a file descriptor
+    class FdStreamBuf : public std::streambuf {
+    private:
+        int m_fd;
+        std::vector<char> m_buffer;
+
+        bool flush_buffer() {
+            const char *data = pbase();
+            size_t left = pptr() - pbase();
+            while (left > 0) {
+                ssize_t written = ::write(m_fd, data, left);
+                if (written <= 0) {
+                    return false;
+                }
+                data += written;
+                left -= written;
+            }
+            setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+            return true;
+        }
+
+    protected:
+        int overflow(int ch) override {
+            if (!flush_buffer()) {
+                return traits_type::eof();
+            }
+            if (ch != traits_type::eof()) {
+                *pptr() = static_cast<char>(ch);
+                pbump(1);
+            }
+            return ch == traits_type::eof() ? 0 : ch;
+        }
+
+        int sync() override {
+            return flush_buffer() ? 0 : -1;
+        }
+
+    public:
+        explicit FdStreamBuf(int fd) : m_fd(fd), m_buffer(1024 * 64) {
+            setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+        }
+
+        ~FdStreamBuf() override {
+            sync();
+        }
+    };
+
+    // anonymous file that only exists in memory and isn't inherited by child processes
+    struct MemFile {
+        int fd;
+
+        explicit MemFile(const char *name) : fd(memfd_create(name, MFD_CLOEXEC)) {
+            if (fd < 0) {
+                throw CompileError({.stage = Diagnostic::Stage::system,
+                                    .message = std::string("Failed to create in-memory file: ") + strerror(errno)});
+            }
+        }
+
+        MemFile(const MemFile &other) = delete;
+
+        MemFile &operator=(const MemFile &other) = delete;
+
+        MemFile(MemFile &&other) noexcept : fd(other.fd) {
+            other.fd = -1;
+        }
+
+        ~MemFile() {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        // everything written to the file so far
+        [[nodiscard]] std::string contents() const {
+            std::string contents(lseek(fd, 0, SEEK_END), '\0');
+            if (pread(fd, contents.data(), contents.size(), 0) != static_cast<ssize_t>(contents.size())) {
+                contents.clear();
+            }
+            return contents;
+        }
+    };
+
+    // path under which a child started by spawn opens the file passed to it at index
+    inline std::string child_path(size_t index) {
+        return "/proc/self/fd/" + std::to_string(3 + index);
+    }
+
+    // starts the program (looked up in PATH) and returns its pid, the output goes to the given descriptors if they are
+    // set and to ours otherwise. The child gets files as its descriptors 3, 4, ... and none of our other files
+    inline pid_t spawn(const std::vector<std::string> &args, Diagnostic::Stage stage, int stdout_fd = -1,
+                       int stderr_fd = -1, const std::vector<int> &files = {}) {
+        std::vector<char *> argv;
+        for (const std::string &arg: args) {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (stdout_fd >= 0) {
+            posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+        }
+        if (stderr_fd >= 0) {
+            posix_spawn_file_actions_adddup2(&actions, stderr_fd, STDERR_FILENO);
+        }
+        // the files first move above every descriptor involved, so putting one in place can't overwrite another.
+        // dup2 clears close-on-exec on the copies
+        int staging = static_cast<int>(2 + files.size());
+        for (int fd: files) {
+            staging = std::max(staging, fd);
+        }
+        staging++;
+        for (size_t i = 0; i < files.size(); i++) {
+            posix_spawn_file_actions_adddup2(&actions, files[i], staging + static_cast<int>(i));
+        }
+        for (size_t i = 0; i < files.size(); i++) {
+            posix_spawn_file_actions_adddup2(&actions, staging + static_cast<int>(i), 3 + static_cast<int>(i));
+            posix_spawn_file_actions_addclose(&actions, staging + static_cast<int>(i));
+        }
+        pid_t pid;
+        const int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (err != 0) {
+            throw CompileError({.stage = stage, .message = "Failed to start " + args[0] + ": " + strerror(err)});
+        }
+        return pid;
+    }
+
+    // waits for the process and returns its exit code, a process killed by a signal returns 128 + signal like a shell
+    inline int wait(pid_t pid) {
+        int status;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                return EXIT_FAILURE;
+            }
+        }
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+
+    // runs a toolchain step, its error output goes into errors if set. Fails if it can't be started or fails
+    inline void run_step(const std::vector<std::string> &args, Diagnostic::Stage stage, const std::vector<int> &files,
+                         const MemFile *errors = nullptr) {
+        const pid_t pid = spawn(args, stage, -1, errors != nullptr ? errors->fd : -1, files);
+        if (int code = wait(pid); code != 0) {
+            const std::string output = errors != nullptr ? errors->contents() : "";
+            throw CompileError({.stage = stage,
+                                .message = output + args[0] + " failed with exit status " + std::to_string(code)});
+        }
+    }
+
+    // assembles the assembly in asm_file and links it into an executable in image_file
+    inline void assemble_and_link(const MemFile &asm_file, const MemFile &image_file, bool debug_info,
+                                  const MemFile *errors = nullptr) {
+        MemFile obj_file("flit-obj");
+        std::vector<std::string> nasm = {"nasm", "-felf64"};
+        if (debug_info) {
+            nasm.insert(nasm.end(), {"-g", "-F", "dwarf"});
+        }
+        nasm.insert(nasm.end(), {"-o", child_path(0), child_path(1)});
+        run_step(nasm, Diagnostic::Stage::assemble, {obj_file.fd, asm_file.fd}, errors);
+        run_step({"ld", "-o", child_path(0), child_path(1)}, Diagnostic::Stage::link, {image_file.fd, obj_file.fd},
+                 errors);
+    }
+}
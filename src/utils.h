@@ -60,6 +60,286 @@ namespace gen {
         m_output << "    ret\n";
     }
 
+    // writes the `size` bytes of the profile at flitProfile to the file named by flitProfilePath, the counts are lost
+    // if it can't be opened
+    void genDumpProfile(std::stringstream &m_output, size_t size) {
+        m_output << "\n_flitDumpProfile:\n";
+        m_output << "    mov rax, 2 ; sys_open\n";
+        m_output << "    mov rdi, flitProfilePath\n";
+        m_output << "    mov rsi, 577 ; O_WRONLY | O_CREAT | O_TRUNC\n";
+        m_output << "    mov rdx, 420 ; 0644\n";
+        m_output << "    syscall\n";
+        m_output << "    cmp rax, 0\n";
+        m_output << "    jl _flitDumpProfileEnd\n";
+        m_output << "    mov r8, rax\n";
+        m_output << "    mov rsi, flitProfile\n";
+        m_output << "    mov rdx, " << size << "\n\n";
+
+        m_output << "_flitDumpProfileLoop:\n";
+        m_output << "    mov rax, 1\n";
+        m_output << "    mov rdi, r8\n";
+        m_output << "    syscall\n";
+        m_output << "    cmp rax, 0\n";
+        m_output << "    jle _flitDumpProfileClose\n";
+        m_output << "    add rsi, rax\n";
+        m_output << "    sub rdx, rax\n";
+        m_output << "    jnz _flitDumpProfileLoop\n\n";
+
+        m_output << "_flitDumpProfileClose:\n";
+        m_output << "    mov rax, 3 ; sys_close\n";
+        m_output << "    mov rdi, r8\n";
+        m_output << "    syscall\n\n";
+
+        m_output << "_flitDumpProfileEnd:\n";
+        m_output << "    ret\n";
+    }
+
+    // reached by a failed bounds check, writes the error to stderr and exits with status 1. It can be reached from the
+    // body of a parallel loop, so every thread of the program is stopped
+    void genIndexError(std::stringstream &m_output, std::stringstream &m_data) {
+        const std::string message = "Index out of bounds\n";
+        m_output << "\n_flitIndexError:\n";
+        m_output << "    mov rax, 1\n";
+        m_output << "    mov rdi, 2\n";
+        m_output << "    mov rsi, flitIndexErrorText\n";
+        m_output << "    mov rdx, " << message.size() << "\n";
+        m_output << "    syscall\n";
+        m_output << "    mov rax, 231 ; sys_exit_group\n";
+        m_output << "    mov rdi, 1\n";
+        m_output << "    syscall\n";
+
+        m_data << "flitIndexErrorText:\n    db ";
+        for (size_t i = 0; i < message.size(); i++) {
+            m_data << (i > 0 ? ", " : "") << static_cast<int>(message[i]);
+        }
+        m_data << "\n";
+    }
+
+    // sets flitCpuLevel to 2 when AVX2 can be used and to 1 otherwise, SSE2 is part of x86-64. The level is
+    // returned in eax, vectorized loops only call this the first time they run
+    void genDetectCpu(std::stringstream &m_output, std::stringstream &m_data, bool avx2) {
+        m_output << "\n_flitDetectCpu:\n";
+        m_output << "    mov r11d, 1\n";
+        m_output << "    xor eax, eax\n";
+        m_output << "    cpuid\n";
+        m_output << "    cmp eax, 7\n";
+        m_output << "    jb _flitDetectCpuEnd\n";
+        m_output << "    mov eax, 1\n";
+        m_output << "    cpuid\n";
+        m_output << "    bt ecx, 27 ; OSXSAVE, needed to ask the OS\n";
+        m_output << "    jnc _flitDetectCpuEnd\n";
+        m_output << "    bt ecx, 28 ; AVX\n";
+        m_output << "    jnc _flitDetectCpuEnd\n";
+        m_output << "    xor ecx, ecx\n";
+        m_output << "    xgetbv\n";
+        m_output << "    and eax, 6 ; the OS saves the xmm and ymm registers\n";
+        m_output << "    cmp eax, 6\n";
+        m_output << "    jne _flitDetectCpuEnd\n";
+        m_output << "    mov eax, 7\n";
+        m_output << "    xor ecx, ecx\n";
+        m_output << "    cpuid\n";
+        m_output << "    bt ebx, 5 ; AVX2\n";
+        m_output << "    jnc _flitDetectCpuEnd\n";
+        m_output << "    mov r11d, 2\n\n";
+
+        m_output << "_flitDetectCpuEnd:\n";
+        m_output << "    mov byte [flitCpuLevel], r11b\n";
+        m_output << "    mov eax, r11d\n";
+        m_output << "    ret\n";
+
+        // the level is only detected while it is 0, starting out at 1 keeps the loops on SSE2
+        m_data << "flitCpuLevel:\n    db " << (avx2 ? 0 : 1) << "\n";
+    }
+
+    // the thread runtime of parallel loops. _flitParallel is called with the body routine in rdi, the range in
+    // flitParStart and flitParEnd and the frame of the calling thread in r15. It splits the range into about 4 chunks
+    // per thread, starts a thread per core besides itself with clone and runs the body itself too. Every thread
+    // claims the next chunk with _flitParallelClaim until none are left, so a thread that is done early takes over
+    // the chunks of slower ones. The threads exit when the body returns and the last one wakes the calling thread.
+    // The number of threads comes from the CPU affinity mask the first time, along with their 8mb stacks
+    void genParallel(std::stringstream &m_output, std::stringstream &m_data) {
+        m_output << "\n_flitParallel:\n";
+        m_output << "    mov [flitParBody], rdi\n";
+        m_output << "    mov [flitParFrame], r15\n";
+        m_output << "    mov r12, [flitThreads]\n";
+        m_output << "    test r12, r12\n";
+        m_output << "    jnz _flitParallelChunks\n";
+        m_output << "    call _flitParallelSetup\n";
+        m_output << "    mov r12, [flitThreads]\n\n";
+
+        m_output << "_flitParallelChunks:\n";
+        m_output << "    mov rcx, [flitParEnd]\n";
+        m_output << "    sub rcx, [flitParStart]\n";
+        m_output << "    lea rbx, [r12*4]\n";
+        m_output << "    mov rax, rcx\n";
+        m_output << "    xor edx, edx\n";
+        m_output << "    div rbx\n";
+        m_output << "    mov ebx, 1\n";
+        m_output << "    test rax, rax\n";
+        m_output << "    cmovz rax, rbx ; at least 1 iteration per chunk\n";
+        m_output << "    mov [flitParChunk], rax\n";
+        m_output << "    mov rbx, rax\n";
+        m_output << "    mov rax, rcx\n";
+        m_output << "    xor edx, edx\n";
+        m_output << "    div rbx\n";
+        m_output << "    test rdx, rdx\n";
+        m_output << "    setnz dl ; the last chunk can be shorter\n";
+        m_output << "    movzx edx, dl\n";
+        m_output << "    add rax, rdx\n";
+        m_output << "    mov [flitParChunks], rax\n";
+        m_output << "    mov qword [flitParNext], 0\n";
+        m_output << "    lea rax, [r12 - 1]\n";
+        m_output << "    mov [flitParPending], eax\n";
+        m_output << "    mov r13, 1 ; syscalls change rcx and r11, the loop uses r12 and r13\n\n";
+
+        m_output << "_flitParallelSpawn:\n";
+        m_output << "    cmp r13, r12\n";
+        m_output << "    jae _flitParallelRun\n";
+        m_output << "    mov rsi, r13\n";
+        m_output << "    shl rsi, 23\n";
+        m_output << "    add rsi, [flitParStacks] ; thread k uses the 8mb below k << 23 in the mapping\n";
+        m_output << "    mov rax, 56 ; sys_clone\n";
+        m_output << "    mov rdi, 0x50f00 ; CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM\n";
+        m_output << "    xor edx, edx\n";
+        m_output << "    xor r10d, r10d\n";
+        m_output << "    xor r8d, r8d\n";
+        m_output << "    syscall\n";
+        m_output << "    test rax, rax\n";
+        m_output << "    jz _flitParallelWorker\n";
+        m_output << "    jns _flitParallelSpawned\n";
+        m_output << "    lock dec dword [flitParPending] ; the threads that did start run its chunks\n\n";
+
+        m_output << "_flitParallelSpawned:\n";
+        m_output << "    inc r13\n";
+        m_output << "    jmp _flitParallelSpawn\n\n";
+
+        m_output << "_flitParallelRun:\n";
+        m_output << "    call [flitParBody]\n\n";
+
+        m_output << "_flitParallelWait:\n";
+        m_output << "    mov edx, [flitParPending]\n";
+        m_output << "    test edx, edx\n";
+        m_output << "    jz _flitParallelEnd\n";
+        m_output << "    mov rax, 202 ; sys_futex, sleeps unless pending changed since it was read\n";
+        m_output << "    mov rdi, flitParPending\n";
+        m_output << "    mov rsi, 128 ; FUTEX_WAIT_PRIVATE\n";
+        m_output << "    xor r10d, r10d\n";
+        m_output << "    syscall\n";
+        m_output << "    jmp _flitParallelWait\n\n";
+
+        m_output << "_flitParallelEnd:\n";
+        m_output << "    ret\n";
+
+        m_output << "\n_flitParallelWorker:\n";
+        m_output << "    mov r15, [flitParFrame]\n";
+        m_output << "    call [flitParBody]\n";
+        m_output << "    lock dec dword [flitParPending]\n";
+        m_output << "    jnz _flitParallelExit\n";
+        m_output << "    mov rax, 202 ; sys_futex\n";
+        m_output << "    mov rdi, flitParPending\n";
+        m_output << "    mov rsi, 129 ; FUTEX_WAKE_PRIVATE\n";
+        m_output << "    mov rdx, 1\n";
+        m_output << "    syscall\n\n";
+
+        m_output << "_flitParallelExit:\n";
+        m_output << "    mov rax, 60 ; sys_exit, only this thread\n";
+        m_output << "    xor edi, edi\n";
+        m_output << "    syscall\n";
+
+        // returns the next chunk as [rax, rdx), an empty one when all of them were claimed
+        m_output << "\n_flitParallelClaim:\n";
+        m_output << "    mov eax, 1\n";
+        m_output << "    lock xadd [flitParNext], rax\n";
+        m_output << "    cmp rax, [flitParChunks]\n";
+        m_output << "    jae _flitParallelClaimed\n";
+        m_output << "    mul qword [flitParChunk]\n";
+        m_output << "    add rax, [flitParStart]\n";
+        m_output << "    mov rdx, [flitParEnd]\n";
+        m_output << "    sub rdx, rax\n";
+        m_output << "    cmp rdx, [flitParChunk]\n";
+        m_output << "    cmova rdx, [flitParChunk]\n";
+        m_output << "    add rdx, rax\n";
+        m_output << "    ret\n\n";
+
+        m_output << "_flitParallelClaimed:\n";
+        m_output << "    xor eax, eax\n";
+        m_output << "    xor edx, edx\n";
+        m_output << "    ret\n";
+
+        // counts the cores the program may run on, at most 64, and maps a stack for every thread but the first
+        m_output << "\n_flitParallelSetup:\n";
+        m_output << "    sub rsp, 128\n";
+        m_output << "    mov rax, 204 ; sys_sched_getaffinity\n";
+        m_output << "    xor edi, edi\n";
+        m_output << "    mov rsi, 128\n";
+        m_output << "    mov rdx, rsp\n";
+        m_output << "    syscall\n";
+        m_output << "    xor ecx, ecx\n";
+        m_output << "    xor r8d, r8d\n";
+        m_output << "    test rax, rax\n";
+        m_output << "    jle _flitParallelCounted\n";
+        m_output << "    shr rax, 3 ; the mask is written in whole words\n\n";
+
+        m_output << "_flitParallelWord:\n";
+        m_output << "    mov rdx, [rsp + r8*8]\n\n";
+
+        m_output << "_flitParallelBit:\n";
+        m_output << "    test rdx, rdx\n";
+        m_output << "    jz _flitParallelNextWord\n";
+        m_output << "    lea r9, [rdx - 1]\n";
+        m_output << "    and rdx, r9 ; clears the lowest set bit\n";
+        m_output << "    inc rcx\n";
+        m_output << "    jmp _flitParallelBit\n\n";
+
+        m_output << "_flitParallelNextWord:\n";
+        m_output << "    inc r8\n";
+        m_output << "    cmp r8, rax\n";
+        m_output << "    jb _flitParallelWord\n\n";
+
+        m_output << "_flitParallelCounted:\n";
+        m_output << "    add rsp, 128\n";
+        m_output << "    mov eax, 64\n";
+        m_output << "    cmp rcx, rax\n";
+        m_output << "    cmova rcx, rax\n";
+        m_output << "    mov eax, 1\n";
+        m_output << "    test rcx, rcx\n";
+        m_output << "    cmovz rcx, rax\n";
+        m_output << "    mov [flitThreads], rcx\n";
+        m_output << "    cmp rcx, 1\n";
+        m_output << "    je _flitParallelMapped\n";
+        m_output << "    lea rsi, [rcx - 1]\n";
+        m_output << "    shl rsi, 23\n";
+        m_output << "    mov rax, 9 ; sys_mmap\n";
+        m_output << "    xor edi, edi\n";
+        m_output << "    mov rdx, 3 ; PROT_READ | PROT_WRITE\n";
+        m_output << "    mov r10, 0x4022 ; MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE\n";
+        m_output << "    mov r8, -1\n";
+        m_output << "    xor r9d, r9d\n";
+        m_output << "    syscall\n";
+        m_output << "    cmp rax, -4096\n";
+        m_output << "    jbe _flitParallelStacks\n";
+        m_output << "    mov qword [flitThreads], 1 ; without stacks the calling thread runs every chunk\n";
+        m_output << "    jmp _flitParallelMapped\n\n";
+
+        m_output << "_flitParallelStacks:\n";
+        m_output << "    mov [flitParStacks], rax\n\n";
+
+        m_output << "_flitParallelMapped:\n";
+        m_output << "    ret\n";
+
+        m_data << "    align 8\n";
+        m_data << "flitThreads:\n    dq 0\n";
+        m_data << "flitParStacks:\n    dq 0\n";
+        m_data << "flitParBody:\n    dq 0\n";
+        m_data << "flitParFrame:\n    dq 0\n";
+        m_data << "flitParStart:\n    dq 0\n";
+        m_data << "flitParEnd:\n    dq 0\n";
+        m_data << "flitParChunk:\n    dq 0\n";
+        m_data << "flitParChunks:\n    dq 0\n";
+        m_data << "flitParNext:\n    dq 0\n";
+        m_data << "flitParPending:\n    dd 0\n";
+    }
+
     void genFooter(std::stringstream &m_output) {
         genPrintRAX(m_output);
         genPrintRAXLoop(m_output);
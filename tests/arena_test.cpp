@@ -0,0 +1,37 @@
+// checks that the arena runs the destructors of the nodes it constructed, last allocated first, so nodes holding
+// vectors and strings don't leak when a long-lived process compiles again and again
+
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "check.h"
+
+static std::vector<int> destroyed;
+
+struct Tracked {
+    int id = 0;
+    std::vector<int> owned = std::vector<int>(16);
+
+    ~Tracked() {
+        destroyed.push_back(id);
+    }
+};
+
+static void test_destructors() {
+    {
+        ArenaAllocator arena(64); // small blocks, so the nodes span several of them
+        for (int i = 0; i < 10; i++) {
+            arena.alloc<Tracked>()->id = i;
+            *arena.alloc<size_t>() = i; // trivially destructible, nothing to run
+        }
+        check(destroyed.empty(), "nodes were destroyed before the arena");
+    }
+    check(destroyed == std::vector<int>{9, 8, 7, 6, 5, 4, 3, 2, 1, 0},
+          "nodes weren't destroyed exactly once, last allocated first");
+}
+
+int main() {
+    test_destructors();
+    return exit_code();
+}
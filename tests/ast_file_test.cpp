@@ -0,0 +1,149 @@
+// checks that a program written with --emit-ast loads back into the same program, whose assembly is byte-identical to
+// the one of the parsed source, and that files which are damaged or from another version are rejected
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ast_file.h"
+#include "check.h"
+#include "flit.h"
+
+namespace fs = std::filesystem;
+
+static const fs::path ast_path = fs::temp_directory_path() / ("flit-ast-test-" + std::to_string(getpid()) + ".ast");
+
+static std::string read_source(const fs::path &path) {
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// loads the bytes as an AST file, returns the error or nothing when it loaded
+static std::optional<std::string> load(const std::string &bytes) {
+    std::ofstream(ast_path, std::ios::binary | std::ios::trunc) << bytes;
+    flit::Result<flit::Ast> ast = flit::parse_file(ast_path.string());
+    if (ast.ok()) {
+        return {};
+    }
+    return ast.diagnostics[0].message;
+}
+
+static bool rejected(const std::string &bytes, const std::string &reason) {
+    std::optional<std::string> error = load(bytes);
+    return error.has_value() && error->ends_with(": " + reason);
+}
+
+// a file of the given payload whose header matches it
+static std::string with_header(const std::string &payload, uint32_t string_count, uint32_t node_count) {
+    ast_file::Header header{};
+    std::memcpy(header.magic, ast_file::magic, sizeof(ast_file::magic));
+    header.version = ast_file::version;
+    header.string_count = string_count;
+    header.node_count = node_count;
+    header.source_name = 0;
+    header.payload_size = payload.size();
+    header.checksum = ast_file::checksum(payload.data(), payload.size());
+    return std::string(reinterpret_cast<const char *>(&header), sizeof(header)) + payload;
+}
+
+static std::string words(const std::vector<uint32_t> &values) {
+    return {reinterpret_cast<const char *>(values.data()), values.size() * sizeof(uint32_t)};
+}
+
+static void test_round_trip(const fs::path &path) {
+    const std::string name = path.filename().string();
+    flit::Options options;
+    options.source_name = path.string();
+    const std::string source = read_source(path);
+    flit::Result<flit::Ast> parsed = flit::parse(source, options);
+    if (!parsed.ok()) {
+        check(false, name + ": doesn't parse");
+        return;
+    }
+    const std::string bytes = flit::write_ast(parsed.value.value()).value.value();
+    check(!load(bytes).has_value(), name + ": written AST doesn't load");
+
+    flit::Result<flit::Ast> loaded = flit::parse_file(ast_path.string());
+    check(loaded.ok() && loaded.value->source_name == path.string(), name + ": the source name wasn't kept");
+    if (!loaded.ok()) {
+        return;
+    }
+    check(flit::write_ast(loaded.value.value()).value == bytes, name + ": loaded AST doesn't write the same bytes");
+
+    // with -g, so the lines of the statements have to survive as well
+    options.debug_info = true;
+    for (int opt_level: {0, 1}) {
+        options.opt_level = opt_level;
+        const flit::Result<std::string> from_source = flit::compile_to_asm(source, options);
+        flit::Result<flit::Ast> ast = flit::parse_file(ast_path.string());
+        if (!ast.ok()) {
+            check(false, name + ": AST doesn't load again");
+            continue;
+        }
+        const flit::Result<std::string> from_ast = flit::compile_to_asm(std::move(ast.value.value()), options);
+        check(from_source.ok() && from_ast.ok() && from_source.value == from_ast.value,
+              name + ": assembly at -O" + std::to_string(opt_level) + " differs after loading the AST");
+    }
+}
+
+static void test_rejected() {
+    const std::string bytes = flit::write_ast(flit::parse("let x = 6;\nprint(x * 7);\nexit(x);\n").value.value())
+                                      .value.value();
+    check(!load(bytes).has_value(), "the AST of a valid program doesn't load");
+
+    std::string bad_checksum = bytes;
+    bad_checksum.back() ^= 1;
+    check(rejected(bad_checksum, "checksum mismatch"), "a changed payload byte isn't rejected");
+
+    std::string other_version = bytes;
+    const uint32_t next_version = ast_file::version + 1;
+    std::memcpy(other_version.data() + offsetof(ast_file::Header, version), &next_version, sizeof(next_version));
+    check(rejected(other_version, "version " + std::to_string(next_version) + ", this compiler reads version " +
+                                  std::to_string(ast_file::version)), "another version isn't rejected");
+
+    check(rejected(bytes.substr(0, bytes.size() - 4), "size doesn't match the header"),
+          "a file cut short isn't rejected");
+    check(rejected(bytes.substr(0, sizeof(ast_file::Header) - 1), "truncated header"),
+          "a file cut short in the header isn't rejected");
+
+    // a payload that is cut short in the middle of a node, with a header that matches it
+    const auto kind = [](ast_file::Kind kind) {
+        return static_cast<uint32_t>(kind);
+    };
+    const std::string strings = words({1}) + "1" + std::string(3, '\0');
+    check(rejected(with_header(strings + words({kind(ast_file::Kind::int_lit)}), 1, 1), "truncated"),
+          "a node cut short isn't rejected");
+
+    // exit(1) and the program, with the child references changed
+    const auto program = [&](uint32_t expr_back, uint32_t stmt_back) {
+        return with_header(strings + words({kind(ast_file::Kind::int_lit), 0,
+                                            kind(ast_file::Kind::stmt_exit), 1, expr_back,
+                                            kind(ast_file::Kind::prog), 1, stmt_back}), 1, 3);
+    };
+    check(!load(program(1, 1)).has_value(), "a hand-written AST doesn't load");
+    check(rejected(program(2, 1), "bad child reference"), "a child before the first node isn't rejected");
+    check(rejected(program(0, 1), "bad child reference"), "a missing required child isn't rejected");
+    check(rejected(program(1, 2), "bad child reference"), "a child of the wrong kind isn't rejected");
+}
+
+int main() {
+    std::vector<fs::path> programs = {fs::path(FLIT_SOURCE_DIR) / "allFeatures.flt"};
+    for (const auto &entry: fs::directory_iterator(fs::path(FLIT_SOURCE_DIR) / "tests" / "programs")) {
+        programs.push_back(entry.path());
+    }
+    for (const fs::path &path: programs) {
+        test_round_trip(path);
+    }
+    test_rejected();
+    fs::remove(ast_path);
+    return exit_code();
+}
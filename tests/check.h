@@ -0,0 +1,25 @@
+#pragma once
+
+// shared by the tests: check() reports a failed check on stderr and the test keeps going, main returns
+// exit_code(), which is EXIT_FAILURE when any check failed
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+inline int failures = 0;
+
+inline void check(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+inline int exit_code() {
+    if (failures > 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+// checks the assembly the optimizations generate: the vectorized loops and their dispatch, reused common
+// subexpressions, the parallel runtime, inlined calls and self tail calls, frame slots shared by variables, and jump
+// tables that stay read-only whichever thread generates them
+
+#include <string>
+
+#include "check.h"
+#include "flit.h"
+
+static std::string assembly(const std::string &source, const flit::Options &options = {}) {
+    flit::Result<std::string> result = flit::compile_to_asm(source, options);
+    if (!result.ok()) {
+        check(false, "doesn't compile: " + result.diagnostics[0].message + "\n" + source);
+        return "";
+    }
+    return result.value.value();
+}
+
+static size_t count(const std::string &text, const std::string &needle) {
+    size_t found = 0;
+    for (size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + needle.size())) {
+        found++;
+    }
+    return found;
+}
+
+static bool contains(const std::string &text, const std::string &needle) {
+    return text.find(needle) != std::string::npos;
+}
+
+// the text from the line `label:` up to the next label starting with until
+static std::string routine(const std::string &text, const std::string &label, const std::string &until) {
+    const size_t begin = text.find("\n" + label + ":\n");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    const size_t end = text.find("\n" + until, begin + 1);
+    return text.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+}
+
+static void test_vectorizer() {
+    const std::string source = "let a[8];\nlet b[5];\nlet s = 0;\nlet i = 0;\n"
+                               "while (i < len(a)) { a[i] = a[i] * 3 + b[i]; s = s + a[i]; i = i + 1; }\nprint(s);\n";
+    const std::string o0 = assembly(source);
+    const std::string o1 = assembly(source, {.opt_level = 1});
+
+    check(!contains(o0, "_flitDetectCpu") && !contains(o0, "pmuludq"), "vectorizer: -O0 has vector code");
+    check(contains(o1, "    call _flitDetectCpu\n") && contains(o1, "flitCpuLevel:\n    db 0\n"),
+          "vectorizer: the CPU isn't detected when the program runs");
+    // 64 bit multiplies from 32 bit halves, 3 multiplies per vector body
+    check(count(o1, "    vpmuludq ") == 3 && count(o1, "    pmuludq ") == 3,
+          "vectorizer: AVX2 and SSE2 bodies don't multiply from 32 bit halves");
+    check(contains(o1, "    vextracti128 xmm0, ymm15, 1\n") && contains(o1, "    pshufd xmm0, xmm15, 0x4e\n"),
+          "vectorizer: the lanes of the sum aren't added up horizontally");
+    check(contains(o1, "    mov rax, 5\n    cmp r9, rax\n    cmova r9, rax\n"),
+          "vectorizer: the vector loop doesn't stop at the shortest array");
+    check(contains(o1, "    lea r10, [r9 - 4]\n") && contains(o1, "    lea r10, [r9 - 2]\n"),
+          "vectorizer: the vector bodies don't leave the tail to the scalar loop");
+    check(contains(o1, "    jae _flitIndexError\n"), "vectorizer: the scalar loop after the vector loop is missing");
+
+    const std::string sse = assembly(source, {.opt_level = 1, .avx2 = false});
+    check(contains(sse, "flitCpuLevel:\n    db 1\n"), "vectorizer: --no-avx2 doesn't start at the SSE2 level");
+
+    const std::string division = assembly("let a[8];\nlet i = 0;\nwhile (i < len(a)) { a[i] = a[i] / 2; i = i + 1; }\n",
+                                          {.opt_level = 1});
+    check(!contains(division, "_flitDetectCpu"), "vectorizer: a loop dividing elements was vectorized");
+}
+
+static void test_cse() {
+    const std::string source = "let a = 6;\nlet b = 7;\nprint(a * b + a * b);\na = 3;\nprint(a * b);\n";
+    check(count(assembly(source), "    mul ") == 3, "cse: -O0 doesn't compute every product");
+    // the product is reused within the first print, and computed again after a is assigned
+    check(count(assembly(source, {.opt_level = 1}), "    mul ") == 2, "cse: -O1 doesn't reuse exactly one product");
+
+    // the temporary for k * 2 goes before the loop, which is left with assignments the vectorizer takes
+    const std::string loop = "let a[64];\nlet b[64];\nlet k = 3;\nlet i = 0;\n"
+                             "while (i < len(a)) { a[i] = b[i] + k * 2; b[i] = a[i] - k * 2; i = i + 1; }\n";
+    const std::string hoisted = assembly(loop, {.opt_level = 1});
+    check(contains(hoisted, "    call _flitDetectCpu\n") && count(hoisted, "    vpaddq ") == 1 &&
+          count(hoisted, "    vpsubq ") == 1, "cse: a temporary keeps the loop from being vectorized");
+    check(count(hoisted, "    mul ") == 1 && hoisted.find("    mul ") < hoisted.find("; vectorized loop"),
+          "cse: k * 2 isn't computed once before the loop");
+}
+
+static void test_parallel() {
+    const std::string source = "let s = 0;\nlet lo = 100;\nlet hi = 0;\nlet i = 0;\n"
+                               "parallel while (i < 50) reduce(sum s, min lo, max hi) {\n"
+                               "    s = s + i;\n    if (i < lo) { lo = i; }\n    if (i > hi) { hi = i; }\n"
+                               "    i = i + 1;\n}\n";
+    const std::string code = assembly(source);
+    check(contains(code, "    mov rax, 56 ; sys_clone\n"), "parallel: threads aren't started with clone");
+    check(count(code, "    mov rax, 202 ; sys_futex") == 2, "parallel: the starting thread doesn't wait on a futex");
+    check(contains(code, "    lock xadd [flitParNext], rax\n"), "parallel: chunks aren't claimed atomically");
+    check(count(code, "    lock add [r15 ") == 1, "parallel: the sum isn't added atomically");
+    check(count(code, "    lock cmpxchg [r15 ") == 2, "parallel: min and max aren't combined with cmpxchg loops");
+}
+
+static void test_calls() {
+    const std::string source = "fn sumto(n, acc) {\n    if (n == 0) {\n        return acc;\n    }\n"
+                               "    return sumto(n - 1, acc + n);\n}\n"
+                               "fn fib(n) {\n    if (n < 2) {\n        return n;\n    }\n"
+                               "    return fib(n - 1) + fib(n - 2);\n}\n"
+                               "fn sq(x) {\n    return x * x;\n}\n"
+                               "print(sumto(10, 0) + sq(3) + fib(5));\n";
+    const std::string o0 = assembly(source);
+    const std::string o1 = assembly(source, {.opt_level = 1});
+
+    check(contains(o0, "    call _flitFn_sq\n"), "calls: -O0 inlined a call");
+    check(!contains(o1, "call _flitFn_sq") && contains(o1, "; inlined call of sq"), "calls: -O1 didn't inline sq");
+    check(contains(o1, "    call _flitFn_sumto\n") && contains(o1, "    call _flitFn_fib\n"),
+          "calls: -O1 inlined a recursive function");
+
+    const std::string sumto = routine(o0, "_flitFn_sumto", "fnSkip");
+    check(contains(sumto, "; tail call") && !contains(sumto, "call _flitFn_sumto"),
+          "calls: the self tail call in sumto isn't a jump");
+    check(contains(routine(o0, "_flitFn_fib", "fnSkip"), "    call _flitFn_fib\n"),
+          "calls: the recursion in fib, which isn't a tail call, became a jump");
+}
+
+static std::string frame_size(const std::string &source) {
+    const std::string code = assembly(source);
+    const size_t pos = code.find("flitFrameSize equ ");
+    return pos == std::string::npos ? "" : code.substr(pos + 18, code.find('\n', pos) - pos - 18);
+}
+
+static void test_slots() {
+    check(frame_size("{\n    let a = 1;\n    print(a);\n}\n{\n    let b = 2;\n    print(b);\n}\n") == "8",
+          "slots: sibling scopes don't share a slot");
+    check(frame_size("let a = 1;\nprint(a);\nlet b = 2;\nprint(b);\n") == "8",
+          "slots: a variable declared after the last use of another doesn't take its slot");
+    check(frame_size("let a = 1;\nlet b = 2;\nprint(a + b);\n") == "16", "slots: live variables share a slot");
+    check(frame_size("{\n    let x[3];\n    print(x[0]);\n}\n{\n    let y[3];\n    print(y[1]);\n}\n") == "24",
+          "slots: arrays of sibling scopes don't share slots");
+    check(frame_size("let k = 1;\nlet j = 0;\nwhile (j < 3) {\n    let q = k;\n    j = j + q;\n}\nlet z = 5;\n"
+                     "print(z);\n") == "24",
+          "slots: a variable used in a loop gave up its slot before the loop ended");
+}
+
+// generating on several threads gives the same assembly as one
+static void test_shards() {
+    std::string source;
+    for (int i = 0; i < 64; i++) {
+        const std::string name = "v" + std::string(1, static_cast<char>('a' + i % 26)) + std::to_string(i / 26);
+        source += "let " + name + " = " + std::to_string(i % 6) + ";\n";
+        source += "if (" + name + " == 1) { print(1); } elif (" + name + " == 2) { print(2); } elif (" + name +
+                  " == 3) { print(3); } elif (" + name + " == 4) { print(4); } else { print(" + name + "); }\n";
+    }
+    const std::string one = assembly(source, {.opt_level = 1, .threads = 1});
+    check(one == assembly(source, {.opt_level = 1, .threads = 4}), "shards: 4 threads generate different assembly");
+    check(count(one, "\nswitchTable") == 64 && one.find("section .rodata") < one.find("\nswitchTable"),
+          "shards: the jump tables aren't read-only");
+}
+
+int main() {
+    test_vectorizer();
+    test_cse();
+    test_parallel();
+    test_calls();
+    test_slots();
+    test_shards();
+    return exit_code();
+}
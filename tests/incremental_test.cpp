@@ -0,0 +1,175 @@
+// checks that editing through IncrementalFrontend and flit::Document ends up with the same tokens and program as
+// tokenizing and parsing the edited source from scratch
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ast_file.h"
+#include "check.h"
+#include "flit.h"
+#include "incremental.h"
+
+static std::string serialize(const NodeProg &prog) {
+    std::ostringstream out;
+    ast_file::Writer().write(prog, "input.flt", out);
+    return out.str();
+}
+
+static bool same_tokens(const std::vector<Token> &a, const std::vector<Token> &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].type != b[i].type || a[i].line != b[i].line || a[i].value != b[i].value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// compares the frontend with a full tokenize and parse of its source
+static void check_frontend(IncrementalFrontend &frontend, const std::string &what) {
+    flit::Result<std::vector<Token>> tokens = flit::tokenize(frontend.source());
+    flit::Result<flit::Ast> ast = flit::parse(frontend.source());
+    check(tokens.ok() && ast.ok(), what + ": the edited source doesn't parse");
+    if (tokens.ok() && ast.ok()) {
+        check(same_tokens(frontend.tokens(), tokens.value.value()), what + ": tokens differ from a full tokenize");
+        check(serialize(frontend.program()) == serialize(ast.value->prog),
+              what + ": program differs from a full parse");
+    }
+}
+
+struct Edit {
+    std::string name;
+    std::string source;
+    size_t offset;
+    size_t removed;
+    std::string inserted;
+};
+
+static void test_edits() {
+    const std::string program = "let x = 10;\nif (x == 10) {\n    print(x);\n} else {\n    print(0);\n}\n"
+                                "// count down\nwhile (x) {\n    x = x - 1;\n}\nexit(x);\n";
+    const std::vector<Edit> edits = {
+            {"delete a comment at offset 0", "//c\nlet x = 1;", 0, 3, ""},
+            {"insert before leading whitespace", "   \nlet x = 1;\nprint(x);", 0, 0, "let z = 3;\n"},
+            {"insert at offset 0", program, 0, 0, "let y = 2;\n"},
+            {"replace the first token", program, 0, 3, "exit(1); let"},
+            {"extend an identifier mid-token", program, 5, 0, "yz"},
+            {"split an integer mid-token", program, 9, 0, ";\nlet y = 1"},
+            {"edit inside a comment", program, program.find("count"), 5, "run"},
+            {"turn a comment into code", program, program.find("// count"), 14, "print(7);"},
+            {"open a block comment", program, program.find("if"), 0, "/*"},
+            {"add lines before the last statements", program, program.find("while"), 0, "print(1);\n\n\n"},
+            {"remove lines", program, program.find("} else"), program.find("// count") - program.find("} else"),
+             "}\n"},
+            {"add an elif to an if", program, program.find("} else") + 1, 0, " elif (x) {\n    print(2);\n}"},
+            {"append at EOF", program, program.size(), 0, "print(x);\n"},
+            {"append at EOF without a newline", "let x = 1;", 10, 0, " print(x);"},
+            {"remove the end", program, program.find("exit"), program.size() - program.find("exit"), ""},
+            {"insert into an empty source", "", 0, 0, "let x = 1;"},
+    };
+    for (const Edit &edit: edits) {
+        IncrementalFrontend frontend(edit.source);
+        frontend.edit(edit.offset, edit.removed, edit.inserted);
+        check_frontend(frontend, edit.name);
+    }
+
+    // only the statements around an edit in the middle are parsed again
+    IncrementalFrontend frontend(program);
+    frontend.edit(program.find("x - 1"), 1, "x");
+    check_frontend(frontend, "edit in the middle");
+    check(frontend.last_edit().reused_stmts >= 2, "edit in the middle: statements around it weren't reused");
+}
+
+// many random edits in a row, each one only applied when the edited source still parses
+static void test_random_edits() {
+    const std::vector<std::string> snippets = {
+            "let a = 1;\n", "print(a);", "a = a + 2;", "{ let b = a * 3; print(b); }\n", "if (a < 4) { print(1); }",
+            " elif (a) { a = 0; }", " else { exit(2); }", "while (a > 9) { a = a - 1; }\n", "// note\n",
+            "/* block\ncomment */", "\n\n", "  ", "7", "b", ";", "(", ")", "}", "let c[4];\n", "c[1] = a;",
+            "fn f(p, q) { return p + q; }\n", "print(f(a, 2));",
+    };
+    std::mt19937 rng(12345);
+    std::string source = "let a = 5;\nprint(a);\n";
+    IncrementalFrontend frontend(source);
+    const int failures_before = failures;
+    size_t applied = 0;
+    for (int i = 0; i < 4000; i++) {
+        const size_t offset = rng() % (source.size() + 1);
+        const size_t removed = std::min<size_t>(rng() % 6, source.size() - offset);
+        const std::string &inserted = snippets[rng() % snippets.size()];
+        std::string edited = source;
+        edited.replace(offset, removed, inserted);
+        if (!flit::parse(edited).ok() || edited.size() > 4000) {
+            continue;
+        }
+        frontend.edit(offset, removed, inserted);
+        source = std::move(edited);
+        applied++;
+        check(frontend.source() == source, "random edit " + std::to_string(i) + ": source differs");
+        check_frontend(frontend, "random edit " + std::to_string(i));
+        if (failures > failures_before) {
+            std::cerr << "source after the edit:\n" << source << std::endl;
+            return;
+        }
+    }
+    check(applied > 200, "too few random edits parsed: " + std::to_string(applied));
+}
+
+// edits at the same place one after the other only move the tokens between them, wherever they are in the file
+static void test_edit_cost() {
+    std::string source;
+    for (int i = 0; i < 3000; i++) {
+        source += "let v" + std::to_string(i) + " = " + std::to_string(i) + ";\nif (v" + std::to_string(i) +
+                  ") {\n    print(v" + std::to_string(i) + ");\n}\n";
+    }
+    IncrementalFrontend frontend(source);
+    for (const bool at_end: {false, true}) {
+        const std::string where = at_end ? "at the end" : "at the start";
+        size_t moved = 0;
+        for (int i = 0; i < 20; i++) {
+            frontend.edit(at_end ? frontend.source().size() : 0, 0, "print(1);\n");
+            if (i > 0) {
+                moved = std::max(moved, frontend.last_edit().moved_tokens);
+            }
+            check(frontend.last_edit().reparsed_stmts <= 2 && frontend.last_edit().relexed_tokens <= 10,
+                  "edit cost: edit " + where + " relexed or reparsed too much");
+        }
+        check(moved <= 10, "edit cost: edits " + where + " moved the gap over " + std::to_string(moved) + " tokens");
+    }
+    check_frontend(frontend, "edit cost");
+}
+
+// a document keeps going through edits that leave the source broken
+static void test_document() {
+    flit::Document document("let x = 1;\nprint(x);\n");
+    check(document.diagnostics().empty() && document.program().has_value(), "document: initial source has errors");
+
+    check(!document.edit(0, 3, "lte"), "document: broken edit reported no errors");
+    check(!document.diagnostics().empty() && !document.program().has_value(), "document: broken source has a program");
+    check(document.tokens().empty(), "document: broken source has tokens");
+    check(document.source() == "lte x = 1;\nprint(x);\n", "document: broken source wasn't kept");
+
+    check(document.edit(0, 3, "let"), "document: fixing edit reported errors");
+    check(document.program().has_value() && document.program()->stmts.size() == 2, "document: fixed program");
+    check(document.edit(document.source().size(), 0, "exit(x);"), "document: edit after a fix reported errors");
+    flit::Result<flit::Ast> ast = flit::parse(document.source());
+    check(ast.ok() && serialize(document.program().value()) == serialize(ast.value->prog),
+          "document: program differs from a full parse");
+
+    check(!document.edit(document.source().size(), 1, ""), "document: edit out of range was accepted");
+    check(document.program().has_value(), "document: edit out of range dropped the program");
+}
+
+int main() {
+    test_edits();
+    test_random_edits();
+    test_edit_cost();
+    test_document();
+    return exit_code();
+}
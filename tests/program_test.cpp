@@ -0,0 +1,144 @@
+// compiles every program in tests/programs with each optimization configuration, runs it and checks what it prints
+// and its exit code against the `// out:` and `// exit:` lines at its top, so the optimized builds have to do
+// exactly what -O0 does. Skipped when nasm or ld isn't installed
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "flit.h"
+
+static constexpr int skipped = 77; // SKIP_RETURN_CODE of the test
+
+struct Expected {
+    std::vector<std::string> out;
+    int exit_code = 0;
+};
+
+struct Config {
+    std::string name;
+    flit::Options options;
+};
+
+static bool on_path(const std::string &name) {
+    const char *path = std::getenv("PATH");
+    std::stringstream dirs(path != nullptr ? path : "");
+    std::string dir;
+    while (std::getline(dirs, dir, ':')) {
+        if (!dir.empty() && access((dir + "/" + name).c_str(), X_OK) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static Expected expected(const std::string &source) {
+    Expected result;
+    std::stringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line) && line.starts_with("// ")) {
+        std::stringstream words(line.substr(3));
+        std::string key;
+        words >> key;
+        if (key == "out:") {
+            for (std::string word; words >> word;) {
+                result.out.push_back(word);
+            }
+        } else if (key == "exit:") {
+            words >> result.exit_code;
+        }
+    }
+    return result;
+}
+
+// the printed values, print writes a byte left over in its buffer before the digits, which is dropped
+static std::vector<std::string> printed(const std::string &output) {
+    std::vector<std::string> values;
+    std::stringstream lines(output);
+    std::string line;
+    while (std::getline(lines, line)) {
+        values.push_back(line.empty() ? line : line.substr(1));
+    }
+    return values;
+}
+
+static std::string joined(const std::vector<std::string> &values) {
+    std::string text;
+    for (const std::string &value: values) {
+        text += (text.empty() ? "" : " ") + value;
+    }
+    return text;
+}
+
+// builds and runs the program, returns what it did wrong or nothing when it did what it should
+static std::string run_program(const std::string &source, const Expected &expect, const flit::Options &options) {
+    flit::Result<flit::Image> image = flit::compile_to_image(source, options);
+    if (!image.ok()) {
+        return "doesn't compile: " + image.diagnostics[0].message;
+    }
+    const int out_fd = memfd_create("flit-test-out", MFD_CLOEXEC);
+    flit::Result<int> status = image.value->run(out_fd);
+    std::string output(lseek(out_fd, 0, SEEK_END), '\0');
+    const bool read_all = pread(out_fd, output.data(), output.size(), 0) == static_cast<ssize_t>(output.size());
+    close(out_fd);
+    if (!status.ok() || !read_all) {
+        return "doesn't run";
+    }
+
+    std::string problem;
+    if (status.value.value() != expect.exit_code) {
+        problem = "exit code " + std::to_string(status.value.value()) + " instead of " +
+                  std::to_string(expect.exit_code);
+    }
+    const std::vector<std::string> values = printed(output);
+    if (values != expect.out) {
+        problem += (problem.empty() ? "" : ", ") + std::string("printed ") + joined(values) + " instead of " +
+                   joined(expect.out);
+    }
+    return problem;
+}
+
+int main() {
+    if (!on_path("nasm") || !on_path("ld")) {
+        std::cerr << "nasm or ld isn't installed, skipping" << std::endl;
+        return skipped;
+    }
+
+    const std::vector<Config> configs = {
+            {"-O0", {}},
+            {"-O1", {.opt_level = 1}},
+            {"-O1 --no-avx2", {.opt_level = 1, .avx2 = false}},
+            {"-O1 on 4 threads", {.opt_level = 1, .threads = 4}},
+            {"-O2", {.opt_level = 2}},
+    };
+    std::vector<std::filesystem::path> programs;
+    for (const auto &entry: std::filesystem::directory_iterator(FLIT_TEST_PROGRAMS)) {
+        if (entry.path().extension() == ".flt") {
+            programs.push_back(entry.path());
+        }
+    }
+    std::ranges::sort(programs);
+
+    check(!programs.empty(), std::string("no programs in ") + FLIT_TEST_PROGRAMS);
+    for (const std::filesystem::path &program: programs) {
+        std::ifstream file(program);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        const std::string source = contents.str();
+        const Expected expect = expected(source);
+        for (const Config &config: configs) {
+            const std::string found = run_program(source, expect, config.options);
+            check(found.empty(), program.filename().string() + " (" + config.name + ") " + found);
+        }
+    }
+    return exit_code();
+}
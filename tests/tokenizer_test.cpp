@@ -0,0 +1,130 @@
+// checks that tokenizing on several threads gives the same tokens, lines and errors as tokenizing on one, for sources
+// whose chunk boundaries fall inside block comments, after `/*` in line comments and in the middle of long lines.
+// ctest runs it with every lexer implementation forced by FLIT_LEX_ISA, skipping the ones the CPU doesn't support
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "flit.h"
+#include "lexer_simd.h"
+
+static constexpr int skipped = 77; // SKIP_RETURN_CODE of the test
+
+using Tokens = flit::Result<std::vector<Token>>;
+
+static bool same(const Tokens &a, const Tokens &b) {
+    if (a.ok() != b.ok()) {
+        return false;
+    }
+    if (!a.ok()) {
+        return a.diagnostics[0].message == b.diagnostics[0].message && a.diagnostics[0].line == b.diagnostics[0].line;
+    }
+    const std::vector<Token> &x = a.value.value();
+    const std::vector<Token> &y = b.value.value();
+    if (x.size() != y.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < x.size(); i++) {
+        if (x[i].type != y[i].type || x[i].line != y[i].line || x[i].value != y[i].value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void compare(const std::string &source, const std::string &what) {
+    const Tokens expected = flit::tokenize(source, {.lex_threads = 1});
+    for (unsigned threads: {2u, 3u, 4u, 7u, 16u, 61u}) {
+        check(same(expected, flit::tokenize(source, {.lex_threads = threads})),
+              what + ": " + std::to_string(threads) + " threads don't match 1");
+    }
+}
+
+static std::string repeated(const std::string &text, size_t times) {
+    std::string result;
+    for (size_t i = 0; i < times; i++) {
+        result += text;
+    }
+    return result;
+}
+
+static void test_block_comments() {
+    // every chunk but the first starts inside the comment
+    compare("let a = 1;\n/*\n" + repeated("x * / // /* y = 2;\n", 400) + "*/\nprint(a);\n", "long block comment");
+    // comments opening and closing on every line, so boundaries fall on both sides of them
+    compare(repeated("let b = 2; /* c */ print(b); /* d\n e */ b = b * 3;\n", 300), "short block comments");
+    // `/*` in a line comment doesn't start a block comment, `//` in a block comment doesn't end it
+    compare(repeated("// /* not a block comment\nlet c = 3;\n/* // *\n/ */ exit(c);\n", 300), "comment markers");
+    check(same(flit::tokenize("/* x\n*/ let d = 4;\n/* y */", {.lex_threads = 1}),
+               flit::tokenize("\n let d = 4;\n", {.lex_threads = 1})),
+          "block comments aren't skipped with their newlines counted");
+    compare(repeated("let e = 5;\n", 300) + "/* never closed\n" + repeated("let f = 6;\n", 300),
+            "unterminated comment");
+}
+
+static void test_long_lines() {
+    // a line longer than a chunk, with runs of spaces, digits and letters longer than the SIMD blocks
+    std::string line = "let g = 0";
+    for (int i = 0; i < 3000; i++) {
+        line += " + " + std::string(40, ' ') + std::to_string(i) + std::string(i % 37, '7') + " * g" +
+                std::string(i % 45, 'h');
+    }
+    const std::string source = "let h = 1;\n" + line + ";\nprint(g);\n";
+    compare(source, "long line");
+    // the same tokens whichever kernels skip the runs
+    const Tokens tokens = flit::tokenize(source, {.lex_threads = 1});
+    check(tokens.ok() && tokens.value->size() == 5 + 4 + 3000 * 4 + 1 + 5 && tokens.value->back().line == 3 &&
+          tokens.value->at(9 + 4 * 2999 + 1).value == "2999" + std::string(2999 % 37, '7'),
+          "long line: the runs aren't skipped exactly");
+    compare(repeated(line + ";\n", 3), "long lines");
+    compare(repeated("\n", 5000) + "exit(0);" + repeated(" ", 5000), "whitespace only lines");
+}
+
+static void test_errors() {
+    compare(repeated("let i = 1;\n", 500) + "let j = $;\n" + repeated("let k = 2;\n", 500), "unexpected token");
+    compare(repeated("let l = 1;\n", 500) + "/* $ */\n" + repeated("let m = @;\n", 500), "error after a comment");
+}
+
+static void test_random_sources() {
+    const std::vector<std::string> snippets = {
+            "let a = 1;\n", "print(a * 2 + 3);\n", "/* block\n comment */", "/* one line */ ", "// line /* comment\n",
+            "// line comment */\n", "while (a < 10) { a = a + 1; }\n", std::string(50, ' '), "\n\n\n",
+            "if (a == 12345678901234567890) {\n", "}\n", "/*\n\n\n*/\n", "identifier_" + std::string(70, 'q') + " ",
+            "*/", "/*", "/", "*", "12345678901234567890123 ", "\t\r\n", "a[3] = len(a);\n", "fn f(x) { return x; }\n",
+    };
+    std::mt19937 random(33);
+    for (int round = 0; round < 200; round++) {
+        std::string source;
+        const size_t count = 50 + random() % 400;
+        for (size_t i = 0; i < count; i++) {
+            source += snippets[random() % snippets.size()];
+        }
+        if (round % 10 == 9) {
+            source.insert(random() % source.size(), "$");
+        }
+        compare(source, "random source " + std::to_string(round));
+    }
+}
+
+int main() {
+    const char *forced = std::getenv("FLIT_LEX_ISA");
+    if (forced != nullptr && std::strcmp(lex::kernels().name, forced) != 0) {
+        if (std::strcmp(forced, "scalar") == 0) {
+            std::cerr << "FLIT_LEX_ISA=scalar picked " << lex::kernels().name << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cerr << "the CPU doesn't support " << forced << ", skipping" << std::endl;
+        return skipped;
+    }
+
+    test_block_comments();
+    test_long_lines();
+    test_errors();
+    test_random_sources();
+    return exit_code();
+}